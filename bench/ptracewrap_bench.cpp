@@ -0,0 +1,287 @@
+// Measures the throughput and latency of ptracewrap's read and write functions with every transfer backend.
+//
+// Usage: ptracewrap_bench [--format csv|json] [--max-size BYTES] [--min-time-ms MS]
+//
+// A child process is forked and stopped, then each operation is timed for sizes from 1 byte up to `--max-size`
+// (64 MiB by default), at an aligned and an unaligned address, repeating each one for at least `--min-time-ms`.
+// One result per line is written to stdout.
+
+#include <ptracewrap.hpp>
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+namespace {
+
+enum class backend {
+    peek_poke,
+    process_vm,
+    proc_mem
+};
+
+const char* backend_name(backend b) {
+    switch (b) {
+    case backend::peek_poke:
+        return "peek_poke";
+    case backend::process_vm:
+        return "process_vm";
+    case backend::proc_mem:
+        return "proc_mem";
+    }
+    return "";
+}
+
+struct options {
+    bool json = false;
+    std::size_t max_size = std::size_t(64) << 20;
+    double min_time_ms = 50;
+};
+
+struct result {
+    const char* operation;
+    backend b;
+    std::size_t size;
+    std::size_t misalignment;
+    std::size_t iterations;
+    double mean_ns;
+    double min_ns;
+};
+
+// The tracee: a stopped child sharing the parent's address space layout
+struct child {
+    pid_t pid;
+    char* remote;
+    std::size_t size;
+};
+
+// Slack for the unaligned case
+constexpr std::size_t misalignment = 3;
+
+child spawn(std::size_t size) {
+    child c;
+    c.size = size + 64;
+    void* buffer = ::mmap(nullptr, c.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        std::perror("mmap");
+        std::exit(1);
+    }
+    c.remote = static_cast<char*>(buffer);
+    std::memset(c.remote, 0x5a, c.size);
+    c.pid = ::fork();
+    if (c.pid == -1) {
+        std::perror("fork");
+        std::exit(1);
+    }
+    if (c.pid == 0) {
+        ptracewrap::ptrace(PTRACE_TRACEME, 0);
+        ::raise(SIGSTOP);
+        for (;;) {
+            ::pause();
+        }
+    }
+    int status;
+    ::waitpid(c.pid, &status, 0);
+    return c;
+}
+
+template<std::size_t N>
+struct blob {
+    char data[N];
+};
+
+// The operations that are timed. Each does one transfer of `size` bytes at `address`
+struct context {
+    pid_t pid;
+    ptracewrap::tracee* target;
+    backend b;
+    std::vector<char> local;
+};
+
+template<class Target>
+void do_read_to(Target& target, char* address, context& ctx, std::size_t size) {
+    ptracewrap::read_to(target, address, ctx.local.data(), size);
+}
+
+template<class Target>
+void do_write(Target& target, char* address, context& ctx, std::size_t size) {
+    ptracewrap::write(target, address, static_cast<const char*>(ctx.local.data()), size);
+}
+
+template<class Target>
+void do_write_iterator(Target& target, char* address, context& ctx, std::size_t size) {
+    std::vector<char>::const_iterator first = ctx.local.begin();
+    ptracewrap::write(target, address, first, first + static_cast<std::ptrdiff_t>(size));
+}
+
+template<class Target, std::size_t N>
+void do_read_n(Target& target, char* address) {
+    blob<N> value = ptracewrap::read<blob<N> >(target, address);
+    static_cast<void>(value);
+}
+
+template<class Target>
+bool do_read(Target& target, char* address, std::size_t size) {
+    switch (size) {
+    case 1:
+        do_read_n<Target, 1>(target, address);
+        return true;
+    case 4:
+        do_read_n<Target, 4>(target, address);
+        return true;
+    case 16:
+        do_read_n<Target, 16>(target, address);
+        return true;
+    case 64:
+        do_read_n<Target, 64>(target, address);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Returns false if the operation isn't available for `size`
+bool run_once(const char* operation, context& ctx, char* address, std::size_t size) {
+    pid_t pid = ctx.pid;
+    bool use_tracee = ctx.b == backend::proc_mem;
+    if (std::strcmp(operation, "read") == 0) {
+        return use_tracee ? do_read(*ctx.target, address, size) : do_read(pid, address, size);
+    }
+    if (std::strcmp(operation, "read_to") == 0) {
+        use_tracee ? do_read_to(*ctx.target, address, ctx, size) : do_read_to(pid, address, ctx, size);
+    } else if (std::strcmp(operation, "write") == 0) {
+        use_tracee ? do_write(*ctx.target, address, ctx, size) : do_write(pid, address, ctx, size);
+    } else {
+        use_tracee ? do_write_iterator(*ctx.target, address, ctx, size) : do_write_iterator(pid, address, ctx, size);
+    }
+    return true;
+}
+
+bool measure(const char* operation, context& ctx, char* address, std::size_t size, const options& opts, result& out) {
+    typedef std::chrono::steady_clock clock;
+    if (!run_once(operation, ctx, address, size)) {
+        return false;
+    }
+    out.operation = operation;
+    out.b = ctx.b;
+    out.size = size;
+    out.iterations = 0;
+    out.min_ns = 0;
+    double total_ns = 0;
+    while (out.iterations == 0 || total_ns < opts.min_time_ms * 1e6) {
+        clock::time_point start = clock::now();
+        run_once(operation, ctx, address, size);
+        double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+        if (out.iterations == 0 || ns < out.min_ns) {
+            out.min_ns = ns;
+        }
+        total_ns += ns;
+        ++out.iterations;
+    }
+    out.mean_ns = total_ns / static_cast<double>(out.iterations);
+    return true;
+}
+
+void print_header(const options& opts) {
+    if (opts.json) {
+        std::printf("[\n");
+    } else {
+        std::printf("operation,backend,size,misalignment,iterations,mean_ns,min_ns,mib_per_s\n");
+    }
+}
+
+void print(const result& r, const options& opts, bool first) {
+    double mib_per_s = r.mean_ns == 0 ? 0 : (static_cast<double>(r.size) / (1024.0 * 1024.0)) / (r.mean_ns / 1e9);
+    if (opts.json) {
+        std::printf(
+            "%s  {\"operation\": \"%s\", \"backend\": \"%s\", \"size\": %zu, \"misalignment\": %zu, "
+            "\"iterations\": %zu, \"mean_ns\": %.1f, \"min_ns\": %.1f, \"mib_per_s\": %.3f}",
+            first ? "" : ",\n", r.operation, backend_name(r.b), r.size, r.misalignment, r.iterations, r.mean_ns, r.min_ns, mib_per_s
+        );
+    } else {
+        std::printf(
+            "%s,%s,%zu,%zu,%zu,%.1f,%.1f,%.3f\n",
+            r.operation, backend_name(r.b), r.size, r.misalignment, r.iterations, r.mean_ns, r.min_ns, mib_per_s
+        );
+    }
+    std::fflush(stdout);
+}
+
+void print_footer(const options& opts) {
+    if (opts.json) {
+        std::printf("\n]\n");
+    }
+}
+
+options parse_options(int argc, char** argv) {
+    options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--format" && i + 1 < argc) {
+            opts.json = std::strcmp(argv[++i], "json") == 0;
+        } else if (arg == "--max-size" && i + 1 < argc) {
+            opts.max_size = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--min-time-ms" && i + 1 < argc) {
+            opts.min_time_ms = std::strtod(argv[++i], nullptr);
+        } else {
+            std::fprintf(stderr, "Usage: %s [--format csv|json] [--max-size BYTES] [--min-time-ms MS]\n", argv[0]);
+            std::exit(arg == "--help" ? 0 : 2);
+        }
+    }
+    return opts;
+}
+
+}
+
+int main(int argc, char** argv) {
+    options opts = parse_options(argc, argv);
+    child c = spawn(opts.max_size);
+    ptracewrap::tracee target(c.pid);
+
+    const char* const operations[] = { "read", "read_to", "write", "write_iterator" };
+    const backend backends[] = { backend::peek_poke, backend::process_vm, backend::proc_mem };
+
+    std::vector<std::size_t> sizes;
+    for (std::size_t size = 1; size <= opts.max_size; size *= 4) {
+        sizes.push_back(size);
+    }
+
+    context ctx;
+    ctx.pid = c.pid;
+    ctx.target = &target;
+    ctx.local.assign(opts.max_size + misalignment, 0x33);
+
+    print_header(opts);
+    bool first = true;
+    for (backend b : backends) {
+        ctx.b = b;
+        if (b != backend::proc_mem) {
+            ptracewrap::set_default_transfer_backend(b == backend::peek_poke ? ptracewrap::transfer_backend::peek_poke : ptracewrap::transfer_backend::process_vm);
+        }
+        for (const char* operation : operations) {
+            for (std::size_t size : sizes) {
+                for (std::size_t offset : { std::size_t(0), misalignment }) {
+                    result r;
+                    r.misalignment = offset;
+                    if (measure(operation, ctx, c.remote + offset, size, opts, r)) {
+                        print(r, opts, first);
+                        first = false;
+                    }
+                }
+            }
+        }
+    }
+    print_footer(opts);
+
+    ::kill(c.pid, SIGKILL);
+    int status;
+    ::waitpid(c.pid, &status, 0);
+    return 0;
+}
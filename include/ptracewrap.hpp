@@ -14,10 +14,28 @@
 #include <type_traits>
 #include <memory>
 #include <string>
+#include <new>
 #include <iterator>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <climits>
+
+#ifdef PTRACEWRAP_INSTRUMENTATION
+#include <chrono>
+#include <mutex>
+#endif
 
 #include <sys/ptrace.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #ifdef USE_LIBEXPLAIN
 extern "C" {
@@ -30,6 +48,7 @@ namespace ptracewrap {
 #ifdef USE_LIBEXPLAIN
 
 class ptrace_error : public ::std::system_error {
+public:
     ptrace_error(::__ptrace_request request, ::pid_t pid, void* addr = nullptr, void* data = nullptr) : ptrace_error(errno, request, pid, addr, data) {}
 
     ptrace_error(int errnum, ::__ptrace_request request, ::pid_t pid, void* addr = nullptr, void* data = nullptr) :
@@ -200,6 +219,521 @@ private:
 };
 #endif
 
+// What a failed ptrace(2) call (Or a transfer done on behalf of one) would have thrown, without throwing it. Only the
+// arguments are stored, so creating one is cheap: the message is only built if it's turned into a `ptrace_error`.
+// Converts to `true` on success
+class ptrace_status {
+public:
+    // Success
+    ptrace_status() noexcept : m_errnum(0), m_request(PTRACE_TRACEME), m_pid(0), m_addr(nullptr), m_data(nullptr) {}
+
+    ptrace_status(int errnum, ::__ptrace_request request, ::pid_t pid, void* addr = nullptr, void* data = nullptr) noexcept :
+      m_errnum(errnum), m_request(request), m_pid(pid), m_addr(addr), m_data(data) {}
+
+    explicit operator bool() const noexcept {
+        return m_errnum == 0;
+    }
+
+    bool ok() const noexcept {
+        return m_errnum == 0;
+    }
+
+    // 0 on success
+    int get_errno() const noexcept {
+        return m_errnum;
+    }
+
+    ::std::error_code code() const noexcept {
+        return ::std::error_code(m_errnum, ::std::generic_category());
+    }
+
+    ::__ptrace_request get_request() const noexcept {
+        return m_request;
+    }
+
+    ::pid_t get_pid() const noexcept {
+        return m_pid;
+    }
+
+    void* get_addr() const noexcept {
+        return m_addr;
+    }
+
+    void* get_data() const noexcept {
+        return m_data;
+    }
+
+    // Only valid if `!ok()`
+    ::ptracewrap::ptrace_error to_error() const {
+        return ::ptracewrap::ptrace_error(m_errnum, m_request, m_pid, m_addr, m_data);
+    }
+
+    void throw_if_error() const {
+        if (m_errnum != 0) {
+            throw to_error();
+        }
+    }
+private:
+    int m_errnum;
+    ::__ptrace_request m_request;
+    ::pid_t m_pid;
+    void* m_addr;
+    void* m_data;
+};
+
+// Either a `T` or the `ptrace_status` of why it couldn't be read
+template<class T>
+class ptrace_result {
+public:
+    ptrace_result(const T& value) noexcept(::std::is_nothrow_copy_constructible<T>::value) : m_value(value), m_status() {}
+
+    ptrace_result(const ::ptracewrap::ptrace_status& status) noexcept(::std::is_nothrow_default_constructible<T>::value) : m_value(), m_status(status) {}
+
+    explicit operator bool() const noexcept {
+        return m_status.ok();
+    }
+
+    bool has_value() const noexcept {
+        return m_status.ok();
+    }
+
+    // Throws the `ptrace_error` if there is no value
+    T& value() {
+        m_status.throw_if_error();
+        return m_value;
+    }
+
+    const T& value() const {
+        m_status.throw_if_error();
+        return m_value;
+    }
+
+    T& operator*() noexcept {
+        return m_value;
+    }
+
+    const T& operator*() const noexcept {
+        return m_value;
+    }
+
+    T* operator->() noexcept {
+        return ::std::addressof(m_value);
+    }
+
+    const T* operator->() const noexcept {
+        return ::std::addressof(m_value);
+    }
+
+    const ::ptracewrap::ptrace_status& status() const noexcept {
+        return m_status;
+    }
+private:
+    T m_value;
+    ::ptracewrap::ptrace_status m_status;
+};
+
+// Counts of the ptrace(2) / process_vm_readv(2) / process_vm_writev(2) calls made by ptracewrap, collected when
+// `PTRACEWRAP_INSTRUMENTATION` is defined
+constexpr ::std::size_t ptrace_latency_buckets = 32;
+
+struct ptrace_call_stats {
+    ::std::uint64_t calls = 0;
+    ::std::uint64_t errors = 0;
+    // Bytes of tracee memory read or written by successful calls
+    ::std::uint64_t bytes = 0;
+    ::std::uint64_t total_ns = 0;
+    // `latency[i]` counts calls that took less than 2^i nanoseconds (And at least 2^(i-1)). The last bucket also
+    // counts every longer call
+    ::std::uint64_t latency[ptrace_latency_buckets] = {};
+};
+
+#ifdef PTRACEWRAP_INSTRUMENTATION
+constexpr bool instrumentation_enabled = true;
+#else
+constexpr bool instrumentation_enabled = false;
+#endif
+
+namespace detail {
+    // Requests 0 to 39 (Including the architecture specific ones) each have their own slot, as do
+    // 0x4200 to 0x420f. Every other request shares one
+    constexpr ::std::size_t instrumentation_low_requests = 40;
+    constexpr ::std::size_t instrumentation_high_slot = instrumentation_low_requests;
+    constexpr ::std::size_t instrumentation_other_slot = instrumentation_high_slot + 16;
+    constexpr ::std::size_t instrumentation_readv_slot = instrumentation_other_slot + 1;
+    constexpr ::std::size_t instrumentation_writev_slot = instrumentation_readv_slot + 1;
+    constexpr ::std::size_t instrumentation_slots = instrumentation_writev_slot + 1;
+    // Errors numbered this or higher are counted together
+    constexpr int instrumentation_errnos = 256;
+
+    inline ::std::size_t instrumentation_slot(long request) noexcept {
+        if (request >= 0 && request < static_cast<long>(instrumentation_low_requests)) {
+            return static_cast< ::std::size_t>(request);
+        }
+        if (request >= 0x4200 && request < 0x4210) {
+            return instrumentation_high_slot + static_cast< ::std::size_t>(request - 0x4200);
+        }
+        return instrumentation_other_slot;
+    }
+
+    inline const char* ptrace_request_name(long request) noexcept {
+        switch (request) {
+            case PTRACE_TRACEME: return "PTRACE_TRACEME";
+            case PTRACE_PEEKTEXT: return "PTRACE_PEEKTEXT";
+            case PTRACE_PEEKDATA: return "PTRACE_PEEKDATA";
+            case PTRACE_PEEKUSER: return "PTRACE_PEEKUSER";
+            case PTRACE_POKETEXT: return "PTRACE_POKETEXT";
+            case PTRACE_POKEDATA: return "PTRACE_POKEDATA";
+            case PTRACE_POKEUSER: return "PTRACE_POKEUSER";
+            case PTRACE_CONT: return "PTRACE_CONT";
+            case PTRACE_KILL: return "PTRACE_KILL";
+            case PTRACE_SINGLESTEP: return "PTRACE_SINGLESTEP";
+#ifdef PTRACE_GETREGS
+            case PTRACE_GETREGS: return "PTRACE_GETREGS";
+            case PTRACE_SETREGS: return "PTRACE_SETREGS";
+#endif
+#ifdef PTRACE_GETFPREGS
+            case PTRACE_GETFPREGS: return "PTRACE_GETFPREGS";
+            case PTRACE_SETFPREGS: return "PTRACE_SETFPREGS";
+#endif
+            case PTRACE_ATTACH: return "PTRACE_ATTACH";
+            case PTRACE_DETACH: return "PTRACE_DETACH";
+            case PTRACE_SYSCALL: return "PTRACE_SYSCALL";
+#ifdef PTRACE_SYSEMU
+            case PTRACE_SYSEMU: return "PTRACE_SYSEMU";
+            case PTRACE_SYSEMU_SINGLESTEP: return "PTRACE_SYSEMU_SINGLESTEP";
+#endif
+            case 0x4200: return "PTRACE_SETOPTIONS";
+            case 0x4201: return "PTRACE_GETEVENTMSG";
+            case 0x4202: return "PTRACE_GETSIGINFO";
+            case 0x4203: return "PTRACE_SETSIGINFO";
+            case 0x4204: return "PTRACE_GETREGSET";
+            case 0x4205: return "PTRACE_SETREGSET";
+            case 0x4206: return "PTRACE_SEIZE";
+            case 0x4207: return "PTRACE_INTERRUPT";
+            case 0x4208: return "PTRACE_LISTEN";
+            case 0x4209: return "PTRACE_PEEKSIGINFO";
+            case 0x420a: return "PTRACE_GETSIGMASK";
+            case 0x420b: return "PTRACE_SETSIGMASK";
+            case 0x420c: return "PTRACE_SECCOMP_GET_FILTER";
+            case 0x420d: return "PTRACE_SECCOMP_GET_METADATA";
+            case 0x420e: return "PTRACE_GET_SYSCALL_INFO";
+            default: return nullptr;
+        }
+    }
+
+    struct instrumentation_totals {
+        ::ptracewrap::ptrace_call_stats slots[instrumentation_slots];
+        ::std::uint64_t errnos[instrumentation_errnos] = {};
+    };
+}
+
+// The counts of every thread, added together
+class instrumentation_snapshot {
+public:
+    const ::ptracewrap::ptrace_call_stats& get(::__ptrace_request request) const noexcept {
+        return m_totals.slots[::ptracewrap::detail::instrumentation_slot(request)];
+    }
+
+    const ::ptracewrap::ptrace_call_stats& get_process_vm_readv() const noexcept {
+        return m_totals.slots[::ptracewrap::detail::instrumentation_readv_slot];
+    }
+
+    const ::ptracewrap::ptrace_call_stats& get_process_vm_writev() const noexcept {
+        return m_totals.slots[::ptracewrap::detail::instrumentation_writev_slot];
+    }
+
+    // Number of failed calls that set `errno` to `errnum`
+    ::std::uint64_t get_error_count(int errnum) const noexcept {
+        if (errnum <= 0) {
+            return 0;
+        }
+        return m_totals.errnos[::std::min(errnum, ::ptracewrap::detail::instrumentation_errnos - 1)];
+    }
+
+    // Calls `f(const std::string& name, const ptrace_call_stats& stats)` for every kind of call that was made
+    template<class F>
+    void for_each(F&& f) const {
+        for (::std::size_t i = 0; i < ::ptracewrap::detail::instrumentation_slots; ++i) {
+            if (m_totals.slots[i].calls != 0) {
+                f(slot_name(i), static_cast<const ::ptracewrap::ptrace_call_stats&>(m_totals.slots[i]));
+            }
+        }
+    }
+
+    // One line per kind of call, `<name> calls=<n> errors=<n> bytes=<n> total_ns=<n> latency=<bucket>:<n>,...`
+    // (Only listing non-empty buckets by their upper bound in nanoseconds), then one `errno=<n> count=<n>` line per
+    // error that happened
+    ::std::string format() const {
+        ::std::string out;
+        char line[64];
+        for_each([&](const ::std::string& name, const ::ptracewrap::ptrace_call_stats& stats) {
+            out += name;
+            ::std::snprintf(line, sizeof(line), " calls=%llu", static_cast<unsigned long long>(stats.calls));
+            out += line;
+            ::std::snprintf(line, sizeof(line), " errors=%llu", static_cast<unsigned long long>(stats.errors));
+            out += line;
+            ::std::snprintf(line, sizeof(line), " bytes=%llu", static_cast<unsigned long long>(stats.bytes));
+            out += line;
+            ::std::snprintf(line, sizeof(line), " total_ns=%llu latency=", static_cast<unsigned long long>(stats.total_ns));
+            out += line;
+            bool first = true;
+            for (::std::size_t i = 0; i < ::ptracewrap::ptrace_latency_buckets; ++i) {
+                if (stats.latency[i] != 0) {
+                    ::std::snprintf(line, sizeof(line), "%s%llu:%llu", first ? "" : ",", 1ull << i, static_cast<unsigned long long>(stats.latency[i]));
+                    out += line;
+                    first = false;
+                }
+            }
+            out += '\n';
+        });
+        for (int i = 1; i < ::ptracewrap::detail::instrumentation_errnos; ++i) {
+            if (m_totals.errnos[i] != 0) {
+                ::std::snprintf(line, sizeof(line), "errno=%d count=%llu\n", i, static_cast<unsigned long long>(m_totals.errnos[i]));
+                out += line;
+            }
+        }
+        return out;
+    }
+private:
+    friend ::ptracewrap::instrumentation_snapshot get_instrumentation_snapshot();
+
+    static ::std::string slot_name(::std::size_t slot) {
+        if (slot == ::ptracewrap::detail::instrumentation_readv_slot) {
+            return "process_vm_readv";
+        }
+        if (slot == ::ptracewrap::detail::instrumentation_writev_slot) {
+            return "process_vm_writev";
+        }
+        if (slot == ::ptracewrap::detail::instrumentation_other_slot) {
+            return "PTRACE_OTHER";
+        }
+        long request = slot < ::ptracewrap::detail::instrumentation_high_slot ?
+            static_cast<long>(slot) : static_cast<long>(0x4200 + slot - ::ptracewrap::detail::instrumentation_high_slot);
+        if (const char* name = ::ptracewrap::detail::ptrace_request_name(request)) {
+            return name;
+        }
+        char buffer[32];
+        ::std::snprintf(buffer, sizeof(buffer), "PTRACE_%#lx", static_cast<unsigned long>(request));
+        return buffer;
+    }
+
+    ::ptracewrap::detail::instrumentation_totals m_totals;
+};
+
+#ifdef PTRACEWRAP_INSTRUMENTATION
+
+namespace detail {
+    // Only written by the thread that owns it, so it is updated with plain loads and stores. Padded so it doesn't
+    // share a cache line with anything another thread writes to
+    struct instrumentation_counters {
+        struct slot {
+            ::std::atomic< ::std::uint64_t> calls;
+            ::std::atomic< ::std::uint64_t> errors;
+            ::std::atomic< ::std::uint64_t> bytes;
+            ::std::atomic< ::std::uint64_t> total_ns;
+            ::std::atomic< ::std::uint64_t> latency[::ptracewrap::ptrace_latency_buckets];
+        };
+
+        char front_padding[64];
+        slot slots[instrumentation_slots];
+        ::std::atomic< ::std::uint64_t> errnos[instrumentation_errnos];
+        char back_padding[64];
+
+        instrumentation_counters() noexcept {
+            for (slot& s : slots) {
+                s.calls.store(0, ::std::memory_order_relaxed);
+                s.errors.store(0, ::std::memory_order_relaxed);
+                s.bytes.store(0, ::std::memory_order_relaxed);
+                s.total_ns.store(0, ::std::memory_order_relaxed);
+                for (::std::atomic< ::std::uint64_t>& l : s.latency) {
+                    l.store(0, ::std::memory_order_relaxed);
+                }
+            }
+            for (::std::atomic< ::std::uint64_t>& e : errnos) {
+                e.store(0, ::std::memory_order_relaxed);
+            }
+        }
+
+        static void bump(::std::atomic< ::std::uint64_t>& counter, ::std::uint64_t n) noexcept {
+            counter.store(counter.load(::std::memory_order_relaxed) + n, ::std::memory_order_relaxed);
+        }
+
+        void record(::std::size_t index, ::std::uint64_t ns, int errnum, ::std::uint64_t bytes) noexcept {
+            slot& s = slots[index];
+            bump(s.calls, 1);
+            bump(s.total_ns, ns);
+            ::std::size_t bucket = 0;
+            while (bucket < ::ptracewrap::ptrace_latency_buckets - 1 && (ns >> bucket) != 0) {
+                ++bucket;
+            }
+            bump(s.latency[bucket], 1);
+            if (errnum != 0) {
+                bump(s.errors, 1);
+                bump(errnos[::std::min(errnum, instrumentation_errnos - 1)], 1);
+            } else {
+                bump(s.bytes, bytes);
+            }
+        }
+
+        void add_to(instrumentation_totals& totals) const noexcept {
+            for (::std::size_t i = 0; i < instrumentation_slots; ++i) {
+                ::ptracewrap::ptrace_call_stats& to = totals.slots[i];
+                const slot& from = slots[i];
+                to.calls += from.calls.load(::std::memory_order_relaxed);
+                to.errors += from.errors.load(::std::memory_order_relaxed);
+                to.bytes += from.bytes.load(::std::memory_order_relaxed);
+                to.total_ns += from.total_ns.load(::std::memory_order_relaxed);
+                for (::std::size_t b = 0; b < ::ptracewrap::ptrace_latency_buckets; ++b) {
+                    to.latency[b] += from.latency[b].load(::std::memory_order_relaxed);
+                }
+            }
+            for (int i = 0; i < instrumentation_errnos; ++i) {
+                totals.errnos[i] += errnos[i].load(::std::memory_order_relaxed);
+            }
+        }
+    };
+
+    struct instrumentation_registry {
+        ::std::mutex mutex;
+        ::std::vector<const instrumentation_counters*> threads;
+        // Counts of threads that have exited
+        instrumentation_totals exited;
+        // Subtracted from every snapshot (Set by `reset_instrumentation()`)
+        instrumentation_totals baseline;
+
+        // Never destroyed, so threads that outlive static destruction can still unregister
+        static instrumentation_registry& get() {
+            static instrumentation_registry* registry = new instrumentation_registry();
+            return *registry;
+        }
+
+        instrumentation_totals sum() {
+            instrumentation_totals totals = exited;
+            for (const instrumentation_counters* counters : threads) {
+                counters->add_to(totals);
+            }
+            return totals;
+        }
+    };
+
+    class instrumentation_thread {
+    public:
+        instrumentation_thread() : m_counters(new instrumentation_counters()) {
+            instrumentation_registry& registry = instrumentation_registry::get();
+            ::std::lock_guard< ::std::mutex> lock(registry.mutex);
+            registry.threads.push_back(m_counters.get());
+        }
+
+        ~instrumentation_thread() {
+            instrumentation_registry& registry = instrumentation_registry::get();
+            ::std::lock_guard< ::std::mutex> lock(registry.mutex);
+            m_counters->add_to(registry.exited);
+            registry.threads.erase(::std::find(registry.threads.begin(), registry.threads.end(), m_counters.get()));
+        }
+
+        instrumentation_thread(const instrumentation_thread&) = delete;
+        instrumentation_thread& operator=(const instrumentation_thread&) = delete;
+
+        static instrumentation_counters& counters() {
+            static thread_local instrumentation_thread thread;
+            return *thread.m_counters;
+        }
+    private:
+        ::std::unique_ptr<instrumentation_counters> m_counters;
+    };
+
+    inline ::std::uint64_t instrumentation_elapsed_ns(::std::chrono::steady_clock::time_point start) noexcept {
+        return static_cast< ::std::uint64_t>(::std::chrono::duration_cast< ::std::chrono::nanoseconds>(::std::chrono::steady_clock::now() - start).count());
+    }
+}
+
+#endif
+
+namespace detail {
+    // Every ptrace(2) call goes through here so it can be counted
+    inline long raw_ptrace(::__ptrace_request request, ::pid_t pid, void* addr, void* data) noexcept {
+#ifdef PTRACEWRAP_INSTRUMENTATION
+        ::std::chrono::steady_clock::time_point start = ::std::chrono::steady_clock::now();
+        long result = ::ptrace(request, pid, addr, data);
+        int errnum = errno;
+        ::std::uint64_t ns = ::ptracewrap::detail::instrumentation_elapsed_ns(start);
+        // glibc sets errno to 0 when a PTRACE_PEEK* succeeds, so -1 is only an error for those if errno is set
+        bool is_peek = request == PTRACE_PEEKTEXT || request == PTRACE_PEEKDATA || request == PTRACE_PEEKUSER;
+        bool failed = result == -1 && (!is_peek || errnum != 0);
+        bool transfers = is_peek || request == PTRACE_POKETEXT || request == PTRACE_POKEDATA;
+        try {
+            ::ptracewrap::detail::instrumentation_thread::counters().record(
+                ::ptracewrap::detail::instrumentation_slot(request), ns, failed ? errnum : 0, transfers ? sizeof(long) : 0);
+        } catch (...) {
+            // Not counted if this thread's counters can't be allocated
+        }
+        errno = errnum;
+        return result;
+#else
+        return ::ptrace(request, pid, addr, data);
+#endif
+    }
+
+    // Every process_vm_readv(2) / process_vm_writev(2) call goes through here so it can be counted
+    inline ::ssize_t raw_process_vm(bool is_write, ::pid_t pid, const ::iovec* local, unsigned long local_count, const ::iovec* remote, unsigned long remote_count) noexcept {
+#ifdef PTRACEWRAP_INSTRUMENTATION
+        ::std::chrono::steady_clock::time_point start = ::std::chrono::steady_clock::now();
+#endif
+        ::ssize_t result = is_write ?
+            ::process_vm_writev(pid, local, local_count, remote, remote_count, 0) :
+            ::process_vm_readv(pid, local, local_count, remote, remote_count, 0);
+#ifdef PTRACEWRAP_INSTRUMENTATION
+        int errnum = errno;
+        ::std::uint64_t ns = ::ptracewrap::detail::instrumentation_elapsed_ns(start);
+        try {
+            ::ptracewrap::detail::instrumentation_thread::counters().record(
+                is_write ? ::ptracewrap::detail::instrumentation_writev_slot : ::ptracewrap::detail::instrumentation_readv_slot,
+                ns, result < 0 ? errnum : 0, result < 0 ? 0 : static_cast< ::std::uint64_t>(result));
+        } catch (...) {
+            // Not counted if this thread's counters can't be allocated
+        }
+        errno = errnum;
+#endif
+        return result;
+    }
+}
+
+// Adds together the counts of every thread since the last `reset_instrumentation()`. Always empty unless
+// `PTRACEWRAP_INSTRUMENTATION` is defined
+inline ::ptracewrap::instrumentation_snapshot get_instrumentation_snapshot() {
+    ::ptracewrap::instrumentation_snapshot snapshot;
+#ifdef PTRACEWRAP_INSTRUMENTATION
+    ::ptracewrap::detail::instrumentation_registry& registry = ::ptracewrap::detail::instrumentation_registry::get();
+    ::std::lock_guard< ::std::mutex> lock(registry.mutex);
+    snapshot.m_totals = registry.sum();
+    for (::std::size_t i = 0; i < ::ptracewrap::detail::instrumentation_slots; ++i) {
+        ::ptracewrap::ptrace_call_stats& to = snapshot.m_totals.slots[i];
+        const ::ptracewrap::ptrace_call_stats& from = registry.baseline.slots[i];
+        to.calls -= from.calls;
+        to.errors -= from.errors;
+        to.bytes -= from.bytes;
+        to.total_ns -= from.total_ns;
+        for (::std::size_t b = 0; b < ::ptracewrap::ptrace_latency_buckets; ++b) {
+            to.latency[b] -= from.latency[b];
+        }
+    }
+    for (int i = 0; i < ::ptracewrap::detail::instrumentation_errnos; ++i) {
+        snapshot.m_totals.errnos[i] -= registry.baseline.errnos[i];
+    }
+#endif
+    return snapshot;
+}
+
+// Makes later snapshots only count calls made after this. The counters themselves are never cleared, since other
+// threads may be writing to them
+inline void reset_instrumentation() {
+#ifdef PTRACEWRAP_INSTRUMENTATION
+    ::ptracewrap::detail::instrumentation_registry& registry = ::ptracewrap::detail::instrumentation_registry::get();
+    ::std::lock_guard< ::std::mutex> lock(registry.mutex);
+    registry.baseline = registry.sum();
+#endif
+}
+
 namespace detail {
     inline void memcpy(void* to, const void* from, ::std::size_t n) noexcept {
         ::std::memcpy(to, from, n);
@@ -240,7 +774,7 @@ namespace detail {
     }
 
     inline long ptrace_noreset_errno(::__ptrace_request request, ::pid_t pid, void* addr = nullptr, void* data = nullptr) {
-        long result = ::ptrace(request, pid, addr, data);
+        long result = ::ptracewrap::detail::raw_ptrace(request, pid, addr, data);
         if (result == -1 && errno != 0) {
             throw ::ptracewrap::ptrace_error(request, pid, addr, data);
         }
@@ -251,6 +785,24 @@ namespace detail {
     struct void_t {
         typedef void type;
     };
+
+    inline ::std::size_t page_size() noexcept {
+        static const ::std::size_t size = static_cast< ::std::size_t>(::sysconf(_SC_PAGESIZE));
+        return size;
+    }
+
+    // Number of bytes from `address` to the end of the page it is on
+    inline ::std::size_t bytes_to_page_end(const volatile void* address) noexcept {
+        ::std::uintptr_t a = reinterpret_cast< ::std::uintptr_t>(address);
+        return page_size() - static_cast< ::std::size_t>(a % page_size());
+    }
+
+    inline void* offset(const volatile void* address, ::std::size_t n) noexcept {
+        return static_cast<void*>(static_cast<char*>(const_cast<void*>(address)) + n);
+    }
+
+    // Size of the stack buffers used to copy to / from volatile storage and iterators
+    constexpr ::std::size_t stream_buffer_size = 4096;
 }
 
 typedef ::pid_t pid_t;
@@ -260,199 +812,1388 @@ typedef ::__ptrace_request ptrace_request;
 // your arguments may not be the correct type
 // See ptrace(2) for usage
 inline long ptrace(::__ptrace_request request, ::pid_t pid, void* addr = nullptr, void* data = nullptr) noexcept {
-    return ::ptrace(request, pid, addr, data);
+    return ::ptracewrap::detail::raw_ptrace(request, pid, addr, data);
 }
 
 // Throws `ptrace_error` instead of needing to check errno
 inline long ptrace_w_error(::__ptrace_request request, ::pid_t pid, void* addr = nullptr, void* data = nullptr) {
     errno = 0;
-    long result = ::ptrace(request, pid, addr, data);
+    long result = ::ptracewrap::detail::raw_ptrace(request, pid, addr, data);
     if (result == -1 && errno != 0) {
         throw ::ptracewrap::ptrace_error(request, pid, addr, data);
     }
     return result;
 }
 
-// Like ptrace::read, but writes to `to` instead of returning (Works with arrays)
-template<class T>
-void read_to(::pid_t pid, void* address, T& to) {
-    static_assert(::std::is_trivially_copyable<T>::value, "Can only ptrace_read trivial types");
-    long data[static_cast< ::std::size_t>(sizeof(T) / sizeof(long)) + (sizeof(T) % sizeof(long) == 0 ? 0 : 1)];
-    errno = 0;
-    for (long& l : data) {
-        l = ::ptracewrap::detail::ptrace_noreset_errno(PTRACE_PEEKDATA, pid, address);
+// How `read_bytes` / `write_bytes` (and so every `read` / `write` function) move memory
+enum class transfer_backend {
+    // One PTRACE_PEEKDATA / PTRACE_POKEDATA per `long`
+    peek_poke,
+    // process_vm_readv(2) / process_vm_writev(2), falling back to `peek_poke` for any page
+    // they cannot access (unreadable pages, or read-only pages when writing)
+    process_vm
+};
+
+namespace detail {
+    inline ::std::atomic<transfer_backend>& default_backend() noexcept {
+        static ::std::atomic<transfer_backend> backend(transfer_backend::process_vm);
+        return backend;
     }
-    ::std::memcpy(::std::addressof(to), data, sizeof(T));
-}
 
-template<class T>
-void read_to(::pid_t pid, const volatile void* address, T& to) {
-    return ::ptracewrap::read_to(pid, const_cast<void*>(address), to);
-}
+    // Set when process_vm_readv / process_vm_writev are not implemented, so they are not retried
+    inline ::std::atomic<bool>& process_vm_unavailable() noexcept {
+        static ::std::atomic<bool> unavailable(false);
+        return unavailable;
+    }
 
-// Like ptrace::read_to, but read to contiguous storage of `n` `T`s pointed to by `to`
-template<class T>
-void read_to(::pid_t pid, void* address, T* to, ::std::size_t n) {
-    static_assert(::std::is_trivially_copyable<T>::value, "Can only ptrace_read trivial types");
-    static_assert(!::std::is_const<T>::value, "read_to argument 3 (T* to) must be non-const to write to");
-    typedef typename ::std::conditional< ::std::is_volatile<T>::value, volatile void*, void*>::type vp;
-    typedef typename ::std::conditional< ::std::is_volatile<T>::value, volatile char*, char*>::type cp;
-    ::std::size_t whole_longs = sizeof(T) * n / sizeof(long);
-    ::std::size_t remainder = (sizeof(T) * n) % sizeof(long);
-    bool has_remainder = remainder != 0;
-    errno = 0;
-    for (::std::size_t i = 0; i < whole_longs; ++i) {
-        long l = ::ptracewrap::detail::ptrace_noreset_errno(PTRACE_PEEKDATA, pid, address);
-        address = static_cast<void*>(static_cast<long*>(address) + 1);
-        ::ptracewrap::detail::memcpy<sizeof(long)>(static_cast<cp>(static_cast<vp>(to)) + i * sizeof(long), &l);
+    // Address of the `long` that holds the `n` (< sizeof(long)) bytes at `address`, so that
+    // reading it does not leave the page those bytes are on
+    inline void* partial_long_address(void* address, ::std::size_t n) noexcept {
+        if (::ptracewrap::detail::bytes_to_page_end(address) < sizeof(long)) {
+            return static_cast<void*>(static_cast<char*>(address) + n - sizeof(long));
+        }
+        return address;
+    }
+
+    inline ::ptracewrap::ptrace_status peek(::pid_t pid, void* address, long& out) noexcept {
+        errno = 0;
+        out = ::ptracewrap::ptrace(PTRACE_PEEKDATA, pid, address);
+        if (out == -1 && errno != 0) {
+            return ::ptracewrap::ptrace_status(errno, PTRACE_PEEKDATA, pid, address);
+        }
+        return ::ptracewrap::ptrace_status();
+    }
+
+    inline ::ptracewrap::ptrace_status poke(::pid_t pid, void* address, long value) noexcept {
+        void* data = reinterpret_cast<void*>(value);
+        if (::ptracewrap::ptrace(PTRACE_POKEDATA, pid, address, data) == -1) {
+            return ::ptracewrap::ptrace_status(errno, PTRACE_POKEDATA, pid, address, data);
+        }
+        return ::ptracewrap::ptrace_status();
+    }
+
+    inline ::ptracewrap::ptrace_status peek_read(::pid_t pid, void* address, char* to, ::std::size_t n) noexcept {
+        const ::std::size_t words = n / sizeof(long);
+        const ::std::size_t rest = n % sizeof(long);
+        long l;
+        for (::std::size_t i = 0; i < words; ++i) {
+            ::ptracewrap::ptrace_status status = ::ptracewrap::detail::peek(pid, address, l);
+            if (!status) {
+                return status;
+            }
+            ::std::memcpy(to + i * sizeof(long), &l, sizeof(long));
+            address = ::ptracewrap::detail::offset(address, sizeof(long));
+        }
+        if (rest == 0) {
+            return ::ptracewrap::ptrace_status();
+        }
+        void* long_address = ::ptracewrap::detail::partial_long_address(address, rest);
+        ::ptracewrap::ptrace_status status = ::ptracewrap::detail::peek(pid, long_address, l);
+        if (!status) {
+            return status;
+        }
+        // `address` is at most `sizeof(long) - rest` bytes after `long_address`, so this stays inside `l`
+        ::std::size_t skip = static_cast< ::std::size_t>(static_cast<char*>(address) - static_cast<char*>(long_address)) % sizeof(long);
+        ::std::memcpy(to + words * sizeof(long), reinterpret_cast<char*>(&l) + skip, rest);
+        return ::ptracewrap::ptrace_status();
+    }
+
+    inline ::ptracewrap::ptrace_status poke_write(::pid_t pid, void* address, const char* from, ::std::size_t n) noexcept {
+        ::std::size_t total = n;
+        long l;
+        while (n >= sizeof(long)) {
+            ::std::memcpy(&l, from, sizeof(long));
+            ::ptracewrap::ptrace_status status = ::ptracewrap::detail::poke(pid, address, l);
+            if (!status) {
+                return status;
+            }
+            address = ::ptracewrap::detail::offset(address, sizeof(long));
+            from += sizeof(long);
+            n -= sizeof(long);
+        }
+        if (n == 0) {
+            return ::ptracewrap::ptrace_status();
+        }
+        if (total >= sizeof(long)) {
+            // The last `long` of the range is made up entirely of bytes being written,
+            // so it can be rewritten without reading it first
+            address = static_cast<void*>(static_cast<char*>(address) + n - sizeof(long));
+            ::std::memcpy(&l, from + n - sizeof(long), sizeof(long));
+        } else {
+            // Read the surrounding `long` so unrelated bytes are not clobbered
+            void* long_address = ::ptracewrap::detail::partial_long_address(address, n);
+            ::ptracewrap::ptrace_status status = ::ptracewrap::detail::peek(pid, long_address, l);
+            if (!status) {
+                return status;
+            }
+            ::std::memcpy(reinterpret_cast<char*>(&l) + (static_cast<char*>(address) - static_cast<char*>(long_address)), from, n);
+            address = long_address;
+        }
+        return ::ptracewrap::detail::poke(pid, address, l);
+    }
+
+    // Returns the number of bytes transferred, which is only less than `n` if a page
+    // could not be accessed or process_vm_{readv,writev} is unusable (`errno` is set)
+    inline ::std::size_t process_vm_transfer(bool is_write, ::pid_t pid, void* address, char* local, ::std::size_t n) noexcept {
+        ::std::size_t done = 0;
+        while (done < n) {
+            ::iovec local_iov = { local + done, n - done };
+            ::iovec remote_iov = { ::ptracewrap::detail::offset(address, done), n - done };
+            ::ssize_t result = ::ptracewrap::detail::raw_process_vm(is_write, pid, &local_iov, 1, &remote_iov, 1);
+            if (result <= 0) {
+                if (result == 0) {
+                    errno = EFAULT;
+                } else if (errno == ENOSYS) {
+                    ::ptracewrap::detail::process_vm_unavailable().store(true, ::std::memory_order_relaxed);
+                }
+                break;
+            }
+            done += static_cast< ::std::size_t>(result);
+        }
+        return done;
     }
-    if (has_remainder) {
-        long l = ::ptracewrap::detail::ptrace_noreset_errno(PTRACE_PEEKDATA, pid, address);
-        ::ptracewrap::detail::memcpy(static_cast<cp>(static_cast<vp>(to)) + whole_longs * sizeof(long), &l, remainder);
+
+    inline ::ptracewrap::ptrace_status process_vm_rw(bool is_write, ::pid_t pid, void* address, char* local, ::std::size_t n) noexcept {
+        while (n != 0) {
+            ::std::size_t done = 0;
+            bool page_fault = false;
+            if (!::ptracewrap::detail::process_vm_unavailable().load(::std::memory_order_relaxed)) {
+                done = ::ptracewrap::detail::process_vm_transfer(is_write, pid, address, local, n);
+                page_fault = errno == EFAULT;
+            }
+            address = ::ptracewrap::detail::offset(address, done);
+            local += done;
+            n -= done;
+            if (n == 0) {
+                break;
+            }
+            // Only the page that failed goes through PTRACE_PEEKDATA / PTRACE_POKEDATA, which can also read pages
+            // without PROT_READ and write read-only pages (e.g. code), and report errors as a `ptrace_error`
+            ::std::size_t chunk = page_fault ? ::std::min(n, ::ptracewrap::detail::bytes_to_page_end(address)) : n;
+            ::ptracewrap::ptrace_status status = is_write ?
+                ::ptracewrap::detail::poke_write(pid, address, local, chunk) :
+                ::ptracewrap::detail::peek_read(pid, address, local, chunk);
+            if (!status) {
+                return status;
+            }
+            address = ::ptracewrap::detail::offset(address, chunk);
+            local += chunk;
+            n -= chunk;
+        }
+        return ::ptracewrap::ptrace_status();
     }
 }
 
-template<class T>
-void read_to(::pid_t pid, const volatile void* address, T* to, ::std::size_t n) {
-    return ::ptracewrap::read_to(pid, const_cast<void*>(address), to, n);
+// Sets the backend used by every `read` / `write` function that isn't given one explicitly
+inline void set_default_transfer_backend(::ptracewrap::transfer_backend backend) noexcept {
+    ::ptracewrap::detail::default_backend().store(backend, ::std::memory_order_relaxed);
 }
 
-// Reads a value of type `T` from `address` in the process with pid `pid`'s virtual address space
-template<class T>
-T read(::pid_t pid, void* address) {
-    static_assert(!::std::is_reference<T>::value, "Cannot ptrace_read with T as a reference");
-    T out;
-    ::ptracewrap::read_to(pid, address, out);
-    return out;
+inline ::ptracewrap::transfer_backend get_default_transfer_backend() noexcept {
+    return ::ptracewrap::detail::default_backend().load(::std::memory_order_relaxed);
 }
 
-template<class T>
-T read(::pid_t pid, const volatile void* address) {
-    return ::ptracewrap::read<T>(pid, const_cast<void*>(address));
+// Reads `n` bytes from `address` in the process with pid `pid`'s virtual address space to `to`
+inline ::ptracewrap::ptrace_status read_bytes(::pid_t pid, const volatile void* address, void* to, ::std::size_t n, ::ptracewrap::transfer_backend backend, const ::std::nothrow_t&) noexcept {
+    if (backend == ::ptracewrap::transfer_backend::peek_poke) {
+        return ::ptracewrap::detail::peek_read(pid, const_cast<void*>(address), static_cast<char*>(to), n);
+    }
+    return ::ptracewrap::detail::process_vm_rw(false, pid, const_cast<void*>(address), static_cast<char*>(to), n);
 }
 
-// Writes `data` to `address` in the process with pid `pid`'s virtual address space
-template<class T>
-void write(::pid_t pid, void* address, const T& data) {
-    static_assert(::std::is_trivially_copyable<T>::value, "Can only ptrace_write trivial types");
+inline ::ptracewrap::ptrace_status read_bytes(::pid_t pid, const volatile void* address, void* to, ::std::size_t n, const ::std::nothrow_t&) noexcept {
+    return ::ptracewrap::read_bytes(pid, address, to, n, ::ptracewrap::get_default_transfer_backend(), ::std::nothrow);
+}
 
-    constexpr ::std::size_t whole_longs = sizeof(T) / sizeof(long);
-    constexpr ::std::size_t remainder_bytes = sizeof(T) % sizeof(long);
-    constexpr bool has_remainder = remainder_bytes != 0;
-    long ldata[whole_longs + has_remainder];
+inline void read_bytes(::pid_t pid, const volatile void* address, void* to, ::std::size_t n, ::ptracewrap::transfer_backend backend) {
+    ::ptracewrap::read_bytes(pid, address, to, n, backend, ::std::nothrow).throw_if_error();
+}
 
-    ::ptracewrap::detail::memcpy<whole_longs * sizeof(long)>(static_cast<long*>(ldata), ::std::addressof(data));
+inline void read_bytes(::pid_t pid, const volatile void* address, void* to, ::std::size_t n) {
+    ::ptracewrap::read_bytes(pid, address, to, n, ::std::nothrow).throw_if_error();
+}
 
-    if (has_remainder) {
-        char last_long[sizeof(long)];
-        ::std::memcpy(last_long, static_cast<const char*>(static_cast<const void*>(::std::addressof(data))) + whole_longs * sizeof(long), remainder_bytes);
-        void* last_address = static_cast<void*>(static_cast<long*>(address) + whole_longs);
-        long rest = ::ptracewrap::ptrace_w_error(PTRACE_PEEKDATA, pid, last_address);
-        ::std::memcpy(last_long + remainder_bytes, static_cast<char*>(static_cast<void*>(&rest)) + remainder_bytes, sizeof(long) - remainder_bytes);
-        ::std::memcpy(ldata + whole_longs, last_long, sizeof(long));
+// Writes `n` bytes from `from` to `address` in the process with pid `pid`'s virtual address space
+inline ::ptracewrap::ptrace_status write_bytes(::pid_t pid, const volatile void* address, const void* from, ::std::size_t n, ::ptracewrap::transfer_backend backend, const ::std::nothrow_t&) noexcept {
+    char* local = const_cast<char*>(static_cast<const char*>(from));
+    if (backend == ::ptracewrap::transfer_backend::peek_poke) {
+        return ::ptracewrap::detail::poke_write(pid, const_cast<void*>(address), local, n);
     }
+    return ::ptracewrap::detail::process_vm_rw(true, pid, const_cast<void*>(address), local, n);
+}
 
-    for (long& l : ldata) {
-        ::ptracewrap::detail::ptrace_noreset_errno(PTRACE_POKEDATA, pid, address, reinterpret_cast<void*>(l));
-        address = static_cast<void*>(static_cast<long*>(address) + 1);
-    }
+inline ::ptracewrap::ptrace_status write_bytes(::pid_t pid, const volatile void* address, const void* from, ::std::size_t n, const ::std::nothrow_t&) noexcept {
+    return ::ptracewrap::write_bytes(pid, address, from, n, ::ptracewrap::get_default_transfer_backend(), ::std::nothrow);
 }
 
-template<class T>
-void write(::pid_t pid, const volatile void* address, const T& data) {
-    return ::ptracewrap::write(pid, const_cast<void*>(address), data);
+inline void write_bytes(::pid_t pid, const volatile void* address, const void* from, ::std::size_t n, ::ptracewrap::transfer_backend backend) {
+    ::ptracewrap::write_bytes(pid, address, from, n, backend, ::std::nothrow).throw_if_error();
 }
 
-template<class T>
-void write(::pid_t pid, void* address, const T* from, ::std::size_t n) {
-    static_assert(::std::is_trivially_copyable<T>::value, "Can only ptrace_write trivial types");
-    typedef typename ::std::conditional< ::std::is_volatile<T>::value, volatile void, void>::type v;
-    typedef typename ::std::conditional< ::std::is_volatile<T>::value, volatile char, char>::type c;
+inline void write_bytes(::pid_t pid, const volatile void* address, const void* from, ::std::size_t n) {
+    ::ptracewrap::write_bytes(pid, address, from, n, ::std::nothrow).throw_if_error();
+}
+
+// A mapping from `/proc/<pid>/maps`
+struct memory_region {
+    enum : unsigned {
+        read = 1,
+        write = 2,
+        execute = 4,
+        shared = 8
+    };
+
+    ::std::uintptr_t start;
+    ::std::uintptr_t end;
+    // Bitwise or of `read`, `write`, `execute` and `shared`
+    unsigned permissions;
+    ::std::uint64_t offset;
+    // Index into `memory_map::get_path`. 0 for mappings without a path
+    ::std::uint32_t path_id;
+
+    ::std::size_t size() const noexcept {
+        return static_cast< ::std::size_t>(end - start);
+    }
+
+    bool contains(::std::uintptr_t address) const noexcept {
+        return start <= address && address < end;
+    }
+};
+
+// The regions of `/proc/<pid>/maps`, sorted by address in a flat array, so looking up an address is a binary search.
+// Paths are interned, so a region is a small fixed size. After the tracee maps, unmaps or mprotects memory the table can
+// be updated in place with the `on_*` functions instead of parsing the whole file again
+class memory_map {
+public:
+    // Parses `/proc/<pid>/maps`. Throws `std::system_error` if it can't be read
+    explicit memory_map(::pid_t pid) : m_pid(pid) {
+        m_paths.push_back(::std::string());
+        refresh();
+    }
+
+    ::pid_t get_pid() const noexcept {
+        return m_pid;
+    }
+
+    // Parse `/proc/<pid>/maps` again
+    void refresh() {
+        read_maps();
+        m_regions.clear();
+        const char* it = m_text.data();
+        const char* end = it + m_text.size();
+        ::std::uint32_t last_path = 0;
+        const char* last_path_begin = nullptr;
+        ::std::size_t last_path_size = 0;
+        while (it < end) {
+            const char* line_end = static_cast<const char*>(::std::memchr(it, '\n', static_cast< ::std::size_t>(end - it)));
+            if (line_end == nullptr) {
+                line_end = end;
+            }
+            memory_region region;
+            region.start = static_cast< ::std::uintptr_t>(parse_hex(it, line_end));
+            ++it;  // '-'
+            region.end = static_cast< ::std::uintptr_t>(parse_hex(it, line_end));
+            ++it;  // ' '
+            region.permissions = 0;
+            if (line_end - it >= 4) {
+                region.permissions |= it[0] == 'r' ? memory_region::read : 0u;
+                region.permissions |= it[1] == 'w' ? memory_region::write : 0u;
+                region.permissions |= it[2] == 'x' ? memory_region::execute : 0u;
+                region.permissions |= it[3] == 's' ? memory_region::shared : 0u;
+                it += 4;
+            }
+            skip_spaces(it, line_end);
+            region.offset = parse_hex(it, line_end);
+            // Skip the device and inode
+            for (int field = 0; field < 2; ++field) {
+                skip_spaces(it, line_end);
+                while (it < line_end && *it != ' ') {
+                    ++it;
+                }
+            }
+            skip_spaces(it, line_end);
+
+            ::std::size_t path_size = static_cast< ::std::size_t>(line_end - it);
+            if (path_size == 0) {
+                region.path_id = 0;
+            } else if (last_path_begin != nullptr && path_size == last_path_size && ::std::memcmp(it, last_path_begin, path_size) == 0) {
+                // Consecutive regions are usually the same file
+                region.path_id = last_path;
+            } else {
+                region.path_id = intern(::std::string(it, path_size));
+                last_path = region.path_id;
+                last_path_begin = it;
+                last_path_size = path_size;
+            }
+            m_regions.push_back(region);
+            it = line_end + 1;
+        }
+    }
+
+    const ::std::vector< ::ptracewrap::memory_region>& get_regions() const noexcept {
+        return m_regions;
+    }
+
+    const ::std::string& get_path(::std::uint32_t path_id) const noexcept {
+        return m_paths[path_id];
+    }
+
+    // The `path_id` of `path`, which is added if it isn't known yet (e.g. for `on_mmap` of a file). 0 for ""
+    ::std::uint32_t intern(const ::std::string& path) {
+        if (path.empty()) {
+            return 0;
+        }
+        ::std::unordered_map< ::std::string, ::std::uint32_t>::const_iterator it = m_path_ids.find(path);
+        if (it != m_path_ids.end()) {
+            return it->second;
+        }
+        ::std::uint32_t id = static_cast< ::std::uint32_t>(m_paths.size());
+        m_paths.push_back(path);
+        m_path_ids.emplace(path, id);
+        return id;
+    }
+
+    // The region containing `address`, or nullptr if it isn't mapped
+    const ::ptracewrap::memory_region* find(const volatile void* address) const noexcept {
+        ::std::uintptr_t a = reinterpret_cast< ::std::uintptr_t>(address);
+        ::std::vector< ::ptracewrap::memory_region>::const_iterator it = first_ending_after(a);
+        if (it == m_regions.end() || !it->contains(a)) {
+            return nullptr;
+        }
+        return &*it;
+    }
+
+    // If all of `[address, address + n)` is mapped with (at least) `permissions`
+    bool contains(const volatile void* address, ::std::size_t n, unsigned permissions = 0) const noexcept {
+        ::std::uintptr_t a = reinterpret_cast< ::std::uintptr_t>(address);
+        ::std::uintptr_t end = a + n;
+        ::std::vector< ::ptracewrap::memory_region>::const_iterator it = first_ending_after(a);
+        while (a < end) {
+            if (it == m_regions.end() || !it->contains(a) || (it->permissions & permissions) != permissions) {
+                return false;
+            }
+            a = it->end;
+            ++it;
+        }
+        return true;
+    }
+
+    // The tracee mapped `[start, start + length)` (Replacing anything that was there). `path_id` is from `intern`
+    void on_mmap(const volatile void* start, ::std::size_t length, unsigned permissions, ::std::uint64_t offset = 0, ::std::uint32_t path_id = 0) {
+        ::std::uintptr_t a = reinterpret_cast< ::std::uintptr_t>(start);
+        on_munmap(start, length);
+        memory_region region = { a, a + round_up(length), permissions, offset, path_id };
+        m_regions.insert(first_ending_after(a), region);
+    }
+
+    void on_munmap(const volatile void* start, ::std::size_t length) {
+        ::std::uintptr_t a = reinterpret_cast< ::std::uintptr_t>(start);
+        ::std::uintptr_t b = a + round_up(length);
+        split(a);
+        ::std::vector< ::ptracewrap::memory_region>::iterator last = split(b);
+        m_regions.erase(first_ending_after(a), last);
+    }
+
+    // `permissions` replaces the read, write and execute permissions of `[start, start + length)`
+    void on_mprotect(const volatile void* start, ::std::size_t length, unsigned permissions) {
+        ::std::uintptr_t a = reinterpret_cast< ::std::uintptr_t>(start);
+        ::std::uintptr_t b = a + round_up(length);
+        split(a);
+        ::std::vector< ::ptracewrap::memory_region>::iterator last = split(b);
+        for (::std::vector< ::ptracewrap::memory_region>::iterator it = first_ending_after(a); it != last; ++it) {
+            it->permissions = (it->permissions & memory_region::shared) | (permissions & ~static_cast<unsigned>(memory_region::shared));
+        }
+    }
+
+    // The tracee called execve(2), so its whole address space was replaced
+    void on_exec() {
+        refresh();
+    }
+private:
+    static ::std::uintptr_t round_up(::std::size_t length) noexcept {
+        ::std::size_t size = ::ptracewrap::detail::page_size();
+        return static_cast< ::std::uintptr_t>((length + size - 1) / size * size);
+    }
+
+    static ::std::uint64_t parse_hex(const char*& it, const char* end) noexcept {
+        ::std::uint64_t value = 0;
+        for (; it < end; ++it) {
+            char c = *it;
+            unsigned digit;
+            if (c >= '0' && c <= '9') {
+                digit = static_cast<unsigned>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                digit = static_cast<unsigned>(c - 'a' + 10);
+            } else {
+                break;
+            }
+            value = value * 16 + digit;
+        }
+        return value;
+    }
+
+    static void skip_spaces(const char*& it, const char* end) noexcept {
+        while (it < end && *it == ' ') {
+            ++it;
+        }
+    }
+
+    ::std::vector< ::ptracewrap::memory_region>::const_iterator first_ending_after(::std::uintptr_t address) const noexcept {
+        return ::std::upper_bound(m_regions.begin(), m_regions.end(), address, [](::std::uintptr_t a, const memory_region& r) {
+            return a < r.end;
+        });
+    }
+
+    ::std::vector< ::ptracewrap::memory_region>::iterator first_ending_after(::std::uintptr_t address) noexcept {
+        return ::std::upper_bound(m_regions.begin(), m_regions.end(), address, [](::std::uintptr_t a, const memory_region& r) {
+            return a < r.end;
+        });
+    }
+
+    // Makes sure no region straddles `address`. Returns the first region starting at or after it
+    ::std::vector< ::ptracewrap::memory_region>::iterator split(::std::uintptr_t address) {
+        ::std::vector< ::ptracewrap::memory_region>::iterator it = first_ending_after(address);
+        if (it == m_regions.end() || it->start >= address) {
+            return it;
+        }
+        memory_region right = *it;
+        right.offset += address - right.start;
+        right.start = address;
+        it->end = address;
+        return m_regions.insert(it + 1, right);
+    }
+
+
+    void read_maps() {
+        char path[32];
+        ::std::snprintf(path, sizeof(path), "/proc/%ld/maps", static_cast<long>(m_pid));
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), path);
+        }
+        m_text.resize(::std::max(m_text.capacity(), static_cast< ::std::size_t>(65536)));
+        ::std::size_t size = 0;
+        for (;;) {
+            if (size == m_text.size()) {
+                m_text.resize(m_text.size() * 2);
+            }
+            ::ssize_t result = ::read(fd, &m_text[size], m_text.size() - size);
+            if (result == -1 && errno == EINTR) {
+                continue;
+            }
+            if (result == -1) {
+                int errnum = errno;
+                ::close(fd);
+                throw ::std::system_error(::std::error_code(errnum, ::std::generic_category()), path);
+            }
+            if (result == 0) {
+                break;
+            }
+            size += static_cast< ::std::size_t>(result);
+        }
+        ::close(fd);
+        m_text.resize(size);
+    }
+
+    ::pid_t m_pid;
+    ::std::vector< ::ptracewrap::memory_region> m_regions;
+    ::std::vector< ::std::string> m_paths;
+    ::std::unordered_map< ::std::string, ::std::uint32_t> m_path_ids;
+    ::std::string m_text;
+};
+
+// The tracee's registers, fetched with PTRACE_GETREGSET at most once per stop. Register sets that are modified are
+// marked dirty and only written back (With PTRACE_SETREGSET) by `flush()`, so any number of changes cost one syscall
+class register_cache {
+public:
+#if defined(__aarch64__)
+    typedef ::user_regs_struct regs_type;
+    typedef ::user_fpsimd_struct fpregs_type;
+#else
+    typedef ::user_regs_struct regs_type;
+    typedef ::user_fpregs_struct fpregs_type;
+#endif
+
+    explicit register_cache(::pid_t pid) noexcept : m_pid(pid), m_valid(0), m_dirty(0), m_regs_size(0), m_fpregs_size(0), m_fetches(0), m_flushes(0) {}
+
+    ::pid_t get_pid() const noexcept {
+        return m_pid;
+    }
+
+    // The general purpose registers (NT_PRSTATUS)
+    const regs_type& get_regs() {
+        fetch(general, &m_regs, sizeof(m_regs), m_regs_size);
+        return m_regs;
+    }
+
+    // Fetches the general purpose registers if needed and marks them as modified
+    regs_type& modify_regs() {
+        fetch(general, &m_regs, sizeof(m_regs), m_regs_size);
+        m_dirty |= general;
+        return m_regs;
+    }
+
+    // Replaces every general purpose register, so they don't need to be fetched
+    void set_regs(const regs_type& regs) noexcept {
+        m_regs = regs;
+        m_regs_size = sizeof(m_regs);
+        m_valid |= general;
+        m_dirty |= general;
+    }
+
+    // The floating point registers (NT_PRFPREG)
+    const fpregs_type& get_fpregs() {
+        fetch(floating_point, &m_fpregs, sizeof(m_fpregs), m_fpregs_size);
+        return m_fpregs;
+    }
+
+    fpregs_type& modify_fpregs() {
+        fetch(floating_point, &m_fpregs, sizeof(m_fpregs), m_fpregs_size);
+        m_dirty |= floating_point;
+        return m_fpregs;
+    }
+
+    void set_fpregs(const fpregs_type& fpregs) noexcept {
+        m_fpregs = fpregs;
+        m_fpregs_size = sizeof(m_fpregs);
+        m_valid |= floating_point;
+        m_dirty |= floating_point;
+    }
+
+    bool is_dirty() const noexcept {
+        return m_dirty != 0;
+    }
+
+    // Writes back the register sets that were modified. Must be called before the tracee is resumed
+    void flush() {
+        if (m_dirty & general) {
+            store(general, &m_regs, m_regs_size);
+        }
+        if (m_dirty & floating_point) {
+            store(floating_point, &m_fpregs, m_fpregs_size);
+        }
+    }
+
+    // Forgets the cached registers (Including unflushed modifications). Must be called after the tracee ran
+    void invalidate() noexcept {
+        m_valid = 0;
+        m_dirty = 0;
+    }
+
+    // Number of PTRACE_GETREGSET / PTRACE_SETREGSET calls made
+    ::std::size_t get_fetch_count() const noexcept {
+        return m_fetches;
+    }
+
+    ::std::size_t get_flush_count() const noexcept {
+        return m_flushes;
+    }
+private:
+    enum : unsigned {
+        general = 1,
+        floating_point = 2
+    };
+
+    static void* note_type(unsigned set) noexcept {
+        return reinterpret_cast<void*>(static_cast< ::std::uintptr_t>(set == general ? NT_PRSTATUS : NT_PRFPREG));
+    }
+
+    void fetch(unsigned set, void* to, ::std::size_t size, ::std::size_t& fetched_size) {
+        if (m_valid & set) {
+            return;
+        }
+        ::iovec iov = { to, size };
+        ::ptracewrap::ptrace_w_error(PTRACE_GETREGSET, m_pid, note_type(set), &iov);
+        ++m_fetches;
+        // A 32-bit tracee has a smaller register set, which has to be written back with the same size
+        fetched_size = iov.iov_len;
+        m_valid |= set;
+    }
+
+    void store(unsigned set, void* from, ::std::size_t size) {
+        ::iovec iov = { from, size };
+        ::ptracewrap::ptrace_w_error(PTRACE_SETREGSET, m_pid, note_type(set), &iov);
+        ++m_flushes;
+        m_dirty &= ~set;
+    }
+
+    ::pid_t m_pid;
+    unsigned m_valid;
+    unsigned m_dirty;
+    ::std::size_t m_regs_size;
+    ::std::size_t m_fpregs_size;
+    ::std::size_t m_fetches;
+    ::std::size_t m_flushes;
+    regs_type m_regs;
+    fpregs_type m_fpregs;
+};
+
+namespace detail {
+    // Copies of remote pages, valid until the tracee next runs. Pages live in one arena (Indexed by slot) that
+    // is kept when the cache is invalidated, so after the first few stops caching doesn't allocate
+    class page_cache {
+    public:
+        page_cache() noexcept : m_used(0), m_hits(0), m_misses(0) {}
+
+        // The cached copy of the page starting at `page`, or nullptr
+        char* find(::std::uintptr_t page) noexcept {
+            ::std::unordered_map< ::std::uintptr_t, ::std::size_t>::iterator it = m_index.find(page);
+            if (it == m_index.end()) {
+                return nullptr;
+            }
+            return m_arena.data() + it->second * ::ptracewrap::detail::page_size();
+        }
+
+        // Allocates `count` contiguous slots for the pages starting at `first_page`
+        char* insert(::std::uintptr_t first_page, ::std::size_t count) {
+            ::std::size_t size = ::ptracewrap::detail::page_size();
+            if ((m_used + count) * size > m_arena.size()) {
+                m_arena.resize(::std::max(m_arena.size() * 2, (m_used + count) * size));
+            }
+            for (::std::size_t i = 0; i < count; ++i) {
+                m_index[first_page + i * size] = m_used + i;
+            }
+            m_used += count;
+            return m_arena.data() + (m_used - count) * size;
+        }
+
+        // Undoes the last `insert`
+        void erase(::std::uintptr_t first_page, ::std::size_t count) noexcept {
+            for (::std::size_t i = 0; i < count; ++i) {
+                m_index.erase(first_page + i * ::ptracewrap::detail::page_size());
+            }
+            m_used -= count;
+        }
+
+        // Updates the cached pages overlapping a range that was just written
+        void update(::std::uintptr_t address, const char* from, ::std::size_t n) noexcept {
+            ::std::size_t size = ::ptracewrap::detail::page_size();
+            while (n != 0) {
+                ::std::uintptr_t page = address - address % size;
+                ::std::size_t chunk = ::std::min(n, static_cast< ::std::size_t>(page + size - address));
+                char* cached = find(page);
+                if (cached != nullptr) {
+                    ::std::memcpy(cached + (address - page), from, chunk);
+                }
+                address += chunk;
+                from += chunk;
+                n -= chunk;
+            }
+        }
+
+        void invalidate() noexcept {
+            m_index.clear();
+            m_used = 0;
+        }
+
+        ::std::size_t hits() const noexcept {
+            return m_hits;
+        }
+
+        ::std::size_t misses() const noexcept {
+            return m_misses;
+        }
+
+        void record(bool hit) noexcept {
+            ++(hit ? m_hits : m_misses);
+        }
+
+        void reset_counters() noexcept {
+            m_hits = 0;
+            m_misses = 0;
+        }
+    private:
+        ::std::unordered_map< ::std::uintptr_t, ::std::size_t> m_index;
+        ::std::vector<char> m_arena;
+        ::std::size_t m_used;
+        ::std::size_t m_hits;
+        ::std::size_t m_misses;
+    };
+}
+
+namespace detail {
+    struct local_mapping {
+        ::std::uintptr_t remote;
+        ::std::size_t size;
+        ::std::shared_ptr<char> local;
+    };
+}
+
+// Something that patches a tracee's memory (e.g. breakpoints) and wants reads and writes through a `tracee` to
+// see the memory as if it wasn't patched
+class memory_overlay {
+public:
+    virtual ~memory_overlay() = default;
+
+    // Whether anything in [address, address + n) is patched
+    virtual bool overlaps(::std::uintptr_t address, ::std::size_t n) const noexcept = 0;
+    // Replace the patched bytes in `data`, which was just read from `address`, with the original bytes
+    virtual void on_read(::std::uintptr_t address, char* data, ::std::size_t n) const noexcept = 0;
+    // `data` (A copy) is about to be written to `address`. Keep the new bytes as the originals, and put the patches
+    // back into `data`
+    virtual void on_write(::std::uintptr_t address, char* data, ::std::size_t n) noexcept = 0;
+};
+
+// A handle to a traced process which keeps `/proc/<pid>/mem` open, so memory is transferred with one
+// pread(2) / pwrite(2) per range instead of going through ptrace(2). Like PTRACE_POKEDATA, writing to
+// `/proc/<pid>/mem` works on read-only mappings, so this is also fast for breakpoints and code patches.
+// If `/proc/<pid>/mem` can't be opened, the default transfer backend is used instead
+class tracee {
+public:
+    explicit tracee(::pid_t pid) noexcept : m_pid(pid), m_mem_fd(open_mem(pid)), m_registers(pid), m_overlay(nullptr) {}
+
+    tracee(tracee&& other) noexcept :
+      m_pid(other.m_pid), m_mem_fd(other.m_mem_fd), m_page_cache(::std::move(other.m_page_cache)),
+      m_memory_map(::std::move(other.m_memory_map)), m_local_mappings(::std::move(other.m_local_mappings)),
+      m_registers(other.m_registers), m_overlay(other.m_overlay) {
+        other.m_mem_fd = -1;
+        other.m_overlay = nullptr;
+    }
+
+    tracee& operator=(tracee&& other) noexcept {
+        if (this != &other) {
+            close_mem();
+            m_pid = other.m_pid;
+            m_mem_fd = other.m_mem_fd;
+            m_page_cache = ::std::move(other.m_page_cache);
+            m_memory_map = ::std::move(other.m_memory_map);
+            m_local_mappings = ::std::move(other.m_local_mappings);
+            m_registers = other.m_registers;
+            m_overlay = other.m_overlay;
+            other.m_mem_fd = -1;
+            other.m_overlay = nullptr;
+        }
+        return *this;
+    }
+
+    tracee(const tracee&) = delete;
+    tracee& operator=(const tracee&) = delete;
+
+    ~tracee() {
+        close_mem();
+    }
+
+    ::pid_t get_pid() const noexcept {
+        return m_pid;
+    }
+
+    // -1 if `/proc/<pid>/mem` couldn't be opened
+    int get_mem_fd() const noexcept {
+        return m_mem_fd;
+    }
+
+    ::ptracewrap::ptrace_status read_bytes(const volatile void* address, void* to, ::std::size_t n, const ::std::nothrow_t&) noexcept {
+        ::std::uintptr_t start = reinterpret_cast< ::std::uintptr_t>(address);
+        ::ptracewrap::ptrace_status status = read_bytes_raw(address, to, n, ::std::nothrow);
+        if (status && m_overlay && m_overlay->overlaps(start, n)) {
+            m_overlay->on_read(start, static_cast<char*>(to), n);
+        }
+        return status;
+    }
+
+    void read_bytes(const volatile void* address, void* to, ::std::size_t n) {
+        read_bytes(address, to, n, ::std::nothrow).throw_if_error();
+    }
+
+    // Writes go straight to the tracee and also update any cached pages
+    ::ptracewrap::ptrace_status write_bytes(const volatile void* address, const void* from, ::std::size_t n, const ::std::nothrow_t&) noexcept {
+        ::std::uintptr_t start = reinterpret_cast< ::std::uintptr_t>(address);
+        ::std::unique_ptr<char[]> patched;
+        if (m_overlay && m_overlay->overlaps(start, n)) {
+            patched.reset(new (::std::nothrow) char[n]);
+            if (!patched) {
+                return ::ptracewrap::ptrace_status(ENOMEM, PTRACE_POKEDATA, m_pid, const_cast<void*>(address));
+            }
+            ::std::memcpy(patched.get(), from, n);
+            m_overlay->on_write(start, patched.get(), n);
+            from = patched.get();
+        }
+        return write_bytes_raw(address, from, n, ::std::nothrow);
+    }
+
+    void write_bytes(const volatile void* address, const void* from, ::std::size_t n) {
+        write_bytes(address, from, n, ::std::nothrow).throw_if_error();
+    }
+
+    // Like `read_bytes` / `write_bytes`, but bypassing the memory overlay, so patched bytes (e.g. breakpoints) are
+    // seen and overwritten as they are in the tracee. For code patches that have to run exactly as written, and for
+    // the overlay itself
+    ::ptracewrap::ptrace_status read_bytes_raw(const volatile void* address, void* to, ::std::size_t n, const ::std::nothrow_t&) noexcept {
+        if (const char* local = find_local(address, n)) {
+            ::std::memcpy(to, local, n);
+            return ::ptracewrap::ptrace_status();
+        }
+        return m_page_cache ?
+            cached_read(reinterpret_cast< ::std::uintptr_t>(address), static_cast<char*>(to), n) :
+            transfer(false, const_cast<void*>(address), static_cast<char*>(to), n);
+    }
+
+    void read_bytes_raw(const volatile void* address, void* to, ::std::size_t n) {
+        read_bytes_raw(address, to, n, ::std::nothrow).throw_if_error();
+    }
+
+    ::ptracewrap::ptrace_status write_bytes_raw(const volatile void* address, const void* from, ::std::size_t n, const ::std::nothrow_t&) noexcept {
+        if (char* local = find_local(address, n)) {
+            ::std::memcpy(local, from, n);
+            if (m_page_cache) {
+                m_page_cache->update(reinterpret_cast< ::std::uintptr_t>(address), static_cast<const char*>(from), n);
+            }
+            return ::ptracewrap::ptrace_status();
+        }
+        ::ptracewrap::ptrace_status status = transfer(true, const_cast<void*>(address), const_cast<char*>(static_cast<const char*>(from)), n);
+        if (!status) {
+            // Part of the range may have been written
+            invalidate_page_cache();
+        } else if (m_page_cache) {
+            m_page_cache->update(reinterpret_cast< ::std::uintptr_t>(address), static_cast<const char*>(from), n);
+        }
+        return status;
+    }
+
+    void write_bytes_raw(const volatile void* address, const void* from, ::std::size_t n) {
+        write_bytes_raw(address, from, n, ::std::nothrow).throw_if_error();
+    }
+
+    // While the tracee is stopped its memory can't change, so pages that have been read once can be served from
+    // a local copy. The cache is cleared whenever the tracee is resumed through this handle
+    void enable_page_cache(bool enable = true) {
+        if (!enable) {
+            m_page_cache.reset();
+        } else if (!m_page_cache) {
+            m_page_cache.reset(new ::ptracewrap::detail::page_cache());
+        }
+    }
+
+    bool page_cache_enabled() const noexcept {
+        return static_cast<bool>(m_page_cache);
+    }
+
+    // Must be called if the tracee is resumed or its memory changed other than through this handle
+    void invalidate_page_cache() noexcept {
+        if (m_page_cache) {
+            m_page_cache->invalidate();
+        }
+    }
+
+    // Number of pages read from the cache / fetched from the tracee since caching was enabled
+    ::std::size_t page_cache_hits() const noexcept {
+        return m_page_cache ? m_page_cache->hits() : 0;
+    }
+
+    ::std::size_t page_cache_misses() const noexcept {
+        return m_page_cache ? m_page_cache->misses() : 0;
+    }
+
+    void reset_page_cache_counters() noexcept {
+        if (m_page_cache) {
+            m_page_cache->reset_counters();
+        }
+    }
+
+    // With a memory map, transfers are checked against and split at the tracee's mappings. It must be kept up to
+    // date (With `get_memory_map()->on_mmap(...)` etc.) or valid addresses may be rejected
+    void enable_memory_map(bool enable = true) {
+        if (!enable) {
+            m_memory_map.reset();
+        } else if (!m_memory_map) {
+            m_memory_map.reset(new ::ptracewrap::memory_map(m_pid));
+        }
+    }
+
+    // nullptr unless the memory map is enabled
+    ::ptracewrap::memory_map* get_memory_map() noexcept {
+        return m_memory_map.get();
+    }
+
+    const ::ptracewrap::memory_map* get_memory_map() const noexcept {
+        return m_memory_map.get();
+    }
+
+    // `[remote, remote + n)` of the tracee is also mapped at `local` in this process (e.g. a `shared_mapping`), so reads
+    // and writes that fall inside it are plain copies, with no syscalls. `local` is kept alive while it is registered.
+    // The tracee must not unmap or remap the range until it is removed again
+    void add_local_mapping(::std::uintptr_t remote, ::std::size_t n, ::std::shared_ptr<char> local) {
+        m_local_mappings.push_back(::ptracewrap::detail::local_mapping { remote, n, ::std::move(local) });
+    }
+
+    // Returns whether there was a local mapping at `remote`
+    bool remove_local_mapping(::std::uintptr_t remote) noexcept {
+        for (::std::size_t i = 0; i < m_local_mappings.size(); ++i) {
+            if (m_local_mappings[i].remote == remote) {
+                m_local_mappings.erase(m_local_mappings.begin() + static_cast< ::std::ptrdiff_t>(i));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Reads and writes through this handle go through `overlay` (Which isn't owned), or nothing if it is nullptr.
+    // The page cache holds memory as it is in the tracee, with the patches
+    void set_memory_overlay(::ptracewrap::memory_overlay* overlay) noexcept {
+        m_overlay = overlay;
+    }
+
+    ::ptracewrap::memory_overlay* get_memory_overlay() const noexcept {
+        return m_overlay;
+    }
+
+    // The registers of the tracee at the current stop. Modified registers are written back when the
+    // tracee is resumed through this handle
+    ::ptracewrap::register_cache& registers() noexcept {
+        return m_registers;
+    }
+
+    // `ptracewrap::ptrace_w_error` for this tracee, which also keeps cached state correct: modified registers are
+    // written back before `request` lets the tracee run, and caches are invalidated when it runs or is changed
+    long ptrace_w_error(::__ptrace_request request, void* addr = nullptr, void* data = nullptr) {
+        bool resume = is_resume(request);
+        if (resume && request != PTRACE_KILL) {
+            m_registers.flush();
+        }
+        if (resume || request == PTRACE_POKEDATA || request == PTRACE_POKETEXT) {
+            invalidate_page_cache();
+        }
+        if (resume || request == PTRACE_POKEUSER || request == PTRACE_SETREGSET || is_setregs(request)) {
+            m_registers.invalidate();
+        }
+        return ::ptracewrap::ptrace_w_error(request, m_pid, addr, data);
+    }
+
+    // PTRACE_CONT / PTRACE_SYSCALL / PTRACE_SINGLESTEP / PTRACE_DETACH, delivering `signal` (If not 0)
+    void cont(int signal = 0) {
+        ptrace_w_error(PTRACE_CONT, nullptr, signal_data(signal));
+    }
+
+    void syscall(int signal = 0) {
+        ptrace_w_error(PTRACE_SYSCALL, nullptr, signal_data(signal));
+    }
+
+    void singlestep(int signal = 0) {
+        ptrace_w_error(PTRACE_SINGLESTEP, nullptr, signal_data(signal));
+    }
+
+    void detach(int signal = 0) {
+        ptrace_w_error(PTRACE_DETACH, nullptr, signal_data(signal));
+    }
+private:
+    static bool is_resume(::__ptrace_request request) noexcept {
+        switch (static_cast<int>(request)) {
+        case PTRACE_CONT:
+        case PTRACE_SYSCALL:
+        case PTRACE_SINGLESTEP:
+        case PTRACE_DETACH:
+        case PTRACE_KILL:
+#ifdef PTRACE_SYSEMU
+        case PTRACE_SYSEMU:
+        case PTRACE_SYSEMU_SINGLESTEP:
+#endif
+        case PTRACE_LISTEN:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool is_setregs(::__ptrace_request request) noexcept {
+#if defined(PTRACE_SETREGS) && defined(PTRACE_SETFPREGS)
+        return request == PTRACE_SETREGS || request == PTRACE_SETFPREGS;
+#else
+        static_cast<void>(request);
+        return false;
+#endif
+    }
+
+    static void* signal_data(int signal) noexcept {
+        return reinterpret_cast<void*>(static_cast< ::std::uintptr_t>(signal));
+    }
+
+    ::ptracewrap::ptrace_status cached_read(::std::uintptr_t address, char* to, ::std::size_t n) noexcept {
+        ::std::size_t size = ::ptracewrap::detail::page_size();
+        while (n != 0) {
+            ::std::uintptr_t page = address - address % size;
+            char* cached = m_page_cache->find(page);
+            if (cached != nullptr) {
+                m_page_cache->record(true);
+                ::std::size_t chunk = ::std::min(n, static_cast< ::std::size_t>(page + size - address));
+                ::std::memcpy(to, cached + (address - page), chunk);
+                address += chunk;
+                to += chunk;
+                n -= chunk;
+                continue;
+            }
+
+            // Fetch the run of pages that aren't cached yet with one transfer
+            ::std::uintptr_t end = page + size;
+            while (end - address < n && m_page_cache->find(end) == nullptr) {
+                end += size;
+            }
+            ::std::size_t count = static_cast< ::std::size_t>(end - page) / size;
+            ::std::size_t chunk = ::std::min(n, static_cast< ::std::size_t>(end - address));
+            char* pages = nullptr;
+            try {
+                pages = m_page_cache->insert(page, count);
+            } catch (const ::std::bad_alloc&) {
+            }
+            if (pages == nullptr || !transfer(false, reinterpret_cast<void*>(page), pages, count * size)) {
+                // Only part of the pages may be unreadable. Don't cache any of them and
+                // read what was asked for, which fails if that was the unreadable part
+                if (pages != nullptr) {
+                    m_page_cache->erase(page, count);
+                }
+                ::ptracewrap::ptrace_status status = transfer(false, reinterpret_cast<void*>(address), to, chunk);
+                if (!status) {
+                    return status;
+                }
+                address += chunk;
+                to += chunk;
+                n -= chunk;
+                continue;
+            }
+            for (::std::size_t i = 0; i < count; ++i) {
+                m_page_cache->record(false);
+            }
+            ::std::memcpy(to, pages + (address - page), chunk);
+            address += chunk;
+            to += chunk;
+            n -= chunk;
+        }
+        return ::ptracewrap::ptrace_status();
+    }
+
+    // The local address of [address, address + n) if it is all in one local mapping, or nullptr
+    char* find_local(const volatile void* address, ::std::size_t n) const noexcept {
+        ::std::uintptr_t start = reinterpret_cast< ::std::uintptr_t>(address);
+        for (const ::ptracewrap::detail::local_mapping& mapping : m_local_mappings) {
+            if (start >= mapping.remote && n <= mapping.size && start - mapping.remote <= mapping.size - n) {
+                return mapping.local.get() + (start - mapping.remote);
+            }
+        }
+        return nullptr;
+    }
+
+    static int open_mem(::pid_t pid) noexcept {
+        char path[32];
+        ::std::snprintf(path, sizeof(path), "/proc/%ld/mem", static_cast<long>(pid));
+        int saved_errno = errno;
+        int fd = ::open(path, O_RDWR | O_CLOEXEC);
+        errno = saved_errno;
+        return fd;
+    }
 
-    ::std::size_t whole_longs = sizeof(T) * n / sizeof(long);
-    ::std::size_t remainder_bytes = (sizeof(T) * n) % sizeof(long);
-    bool has_remainder = remainder_bytes != 0;
+    void close_mem() noexcept {
+        if (m_mem_fd != -1) {
+            ::close(m_mem_fd);
+            m_mem_fd = -1;
+        }
+    }
+
+    // Returns the number of bytes transferred before the first page that couldn't be accessed
+    ::std::size_t mem_transfer(bool is_write, void* address, char* local, ::std::size_t n) noexcept {
+        ::std::size_t done = 0;
+        while (m_mem_fd != -1 && done < n) {
+            ::off_t position = static_cast< ::off_t>(reinterpret_cast< ::std::uintptr_t>(address) + done);
+            ::ssize_t result = is_write ?
+                ::pwrite(m_mem_fd, local + done, n - done, position) :
+                ::pread(m_mem_fd, local + done, n - done, position);
+            if (result <= 0) {
+                if (result == -1 && errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            done += static_cast< ::std::size_t>(result);
+        }
+        return done;
+    }
 
-    for (::std::size_t i = 0; i < whole_longs; ++i) {
-        long to_write;
-        ::ptracewrap::detail::memcpy<sizeof(long)>(&to_write, static_cast<const c*>(static_cast<const v*>(from)) + i * sizeof(long));
-        ::ptracewrap::detail::ptrace_noreset_errno(PTRACE_POKEDATA, pid, address, reinterpret_cast<void*>(to_write));
-        address = static_cast<void*>(static_cast<long*>(address) + 1);
+    ::ptracewrap::ptrace_status transfer(bool is_write, void* address, char* local, ::std::size_t n) noexcept {
+        if (!m_memory_map) {
+            return fd_transfer(is_write, address, local, n);
+        }
+        // Split at region boundaries. Unmapped addresses fail without a syscall, and pages that
+        // process_vm_{readv,writev} can't access go straight to `/proc/<pid>/mem`
+        unsigned needed = is_write ? ::ptracewrap::memory_region::write : ::ptracewrap::memory_region::read;
+        while (n != 0) {
+            const ::ptracewrap::memory_region* region = m_memory_map->find(address);
+            if (region == nullptr) {
+                return ::ptracewrap::ptrace_status(EIO, is_write ? PTRACE_POKEDATA : PTRACE_PEEKDATA, m_pid, address);
+            }
+            ::std::size_t chunk = ::std::min(n, static_cast< ::std::size_t>(region->end - reinterpret_cast< ::std::uintptr_t>(address)));
+            ::ptracewrap::ptrace_status status = (region->permissions & needed) == 0 ?
+                fd_transfer(is_write, address, local, chunk) :
+                ::ptracewrap::detail::process_vm_rw(is_write, m_pid, address, local, chunk);
+            if (!status) {
+                return status;
+            }
+            address = ::ptracewrap::detail::offset(address, chunk);
+            local += chunk;
+            n -= chunk;
+        }
+        return ::ptracewrap::ptrace_status();
     }
 
-    if (has_remainder) {
-        char last_long[sizeof(long)];
-        ::ptracewrap::detail::memcpy(last_long, static_cast<const c*>(static_cast<const v*>(from)) + whole_longs * sizeof(long), remainder_bytes);
-        void* last_address = static_cast<void*>(static_cast<long*>(address) + whole_longs);
-        long rest = ptrace_w_error(PTRACE_PEEKDATA, pid, last_address);
-        ::ptracewrap::detail::memcpy(last_long + remainder_bytes, static_cast<char*>(static_cast<void*>(&rest)) + remainder_bytes, sizeof(long) - remainder_bytes);
-        long last_long_as_long;
-        ::ptracewrap::detail::memcpy<sizeof(long)>(&last_long_as_long, last_long);
-        ::ptracewrap::detail::ptrace_noreset_errno(PTRACE_POKEDATA, pid, address, reinterpret_cast<void*>(last_long_as_long));
+    ::ptracewrap::ptrace_status fd_transfer(bool is_write, void* address, char* local, ::std::size_t n) noexcept {
+        while (n != 0) {
+            ::std::size_t done = mem_transfer(is_write, address, local, n);
+            address = ::ptracewrap::detail::offset(address, done);
+            local += done;
+            n -= done;
+            if (n == 0) {
+                break;
+            }
+            // The page that failed is retried with ptrace(2) so the error is a `ptrace_error`
+            ::std::size_t chunk = n;
+            ::ptracewrap::transfer_backend backend = ::ptracewrap::get_default_transfer_backend();
+            if (m_mem_fd != -1) {
+                chunk = ::std::min(n, ::ptracewrap::detail::bytes_to_page_end(address));
+                backend = ::ptracewrap::transfer_backend::peek_poke;
+            }
+            ::ptracewrap::ptrace_status status = is_write ?
+                ::ptracewrap::write_bytes(m_pid, address, local, chunk, backend, ::std::nothrow) :
+                ::ptracewrap::read_bytes(m_pid, address, local, chunk, backend, ::std::nothrow);
+            if (!status) {
+                return status;
+            }
+            address = ::ptracewrap::detail::offset(address, chunk);
+            local += chunk;
+            n -= chunk;
+        }
+        return ::ptracewrap::ptrace_status();
     }
+
+    ::pid_t m_pid;
+    int m_mem_fd;
+    ::std::unique_ptr< ::ptracewrap::detail::page_cache> m_page_cache;
+    ::std::unique_ptr< ::ptracewrap::memory_map> m_memory_map;
+    ::std::vector< ::ptracewrap::detail::local_mapping> m_local_mappings;
+    ::ptracewrap::register_cache m_registers;
+    ::ptracewrap::memory_overlay* m_overlay;
+};
+
+inline ::ptracewrap::ptrace_status read_bytes(::ptracewrap::tracee& target, const volatile void* address, void* to, ::std::size_t n, const ::std::nothrow_t&) noexcept {
+    return target.read_bytes(address, to, n, ::std::nothrow);
 }
 
-template<class InputIt, class Sentinel = InputIt>
-typename ::ptracewrap::detail::void_t<typename ::std::iterator_traits<InputIt>::value_type>::type
-write(::pid_t pid, const volatile void* address, InputIt first, Sentinel last) {
-    typedef typename ::std::remove_reference<typename ::std::iterator_traits<InputIt>::value_type>::type cv_value_type;
-    typedef typename ::std::remove_cv<cv_value_type>::type value_type;
-    static_assert(::std::is_trivially_copyable<value_type>::value, "Can only ptrace_write trivial types");
+inline void read_bytes(::ptracewrap::tracee& target, const volatile void* address, void* to, ::std::size_t n) {
+    target.read_bytes(address, to, n);
+}
+
+inline ::ptracewrap::ptrace_status write_bytes(::ptracewrap::tracee& target, const volatile void* address, const void* from, ::std::size_t n, const ::std::nothrow_t&) noexcept {
+    return target.write_bytes(address, from, n, ::std::nothrow);
+}
 
-    void* write_address = const_cast<void*>(address);
-    char remainder[sizeof(long)];
-    ::std::size_t remainder_pos = 0;
+inline void write_bytes(::ptracewrap::tracee& target, const volatile void* address, const void* from, ::std::size_t n) {
+    target.write_bytes(address, from, n);
+}
 
-    typedef typename ::std::conditional< ::std::is_volatile<cv_value_type>::value, const volatile value_type&, const value_type&>::type reference;
-    typedef typename ::std::conditional< ::std::is_volatile<cv_value_type>::value, const volatile void*, const void*>::type vp;
-    typedef typename ::std::conditional< ::std::is_volatile<cv_value_type>::value, const volatile char*, const char*>::type cp;
+// The typed functions below are implemented once for both `pid_t` and `tracee&` targets
+namespace detail {
+    // If `Sentinel` can be the end of an iterator range (Rather than the `n` or `std::nothrow` of another overload)
+    template<class Sentinel>
+    struct is_sentinel : ::std::integral_constant<bool, !::std::is_integral<Sentinel>::value && !::std::is_same<Sentinel, ::std::nothrow_t>::value> {};
 
-    errno = 0;
-    for (; first != last; ++first) {
-        reference value = static_cast<reference>(*first);
-        ::std::size_t to_write = sizeof(value_type);
-        cp pointer = static_cast<cp>(static_cast<vp>(::std::addressof(value)));
-        if (remainder_pos) {
-            if (to_write >= sizeof(long) - remainder_pos) {
-                ::ptracewrap::detail::memcpy(static_cast<char*>(static_cast<void*>(remainder)) + remainder_pos, pointer, sizeof(long) - remainder_pos);
-                to_write -= sizeof(long) - remainder_pos;
-                pointer += sizeof(long) - remainder_pos;
-
-                long remainder_as_long;
-                ::std::memcpy(&remainder_as_long, remainder, sizeof(long));
-                ::ptracewrap::detail::ptrace_noreset_errno(PTRACE_POKEDATA, pid, write_address, reinterpret_cast<void*>(remainder_as_long));
-                write_address = static_cast<void*>(static_cast<char*>(write_address) + sizeof(long));
-            } else {
-                ::ptracewrap::detail::memcpy(static_cast<char*>(static_cast<void*>(remainder)) + remainder_pos, pointer, to_write);
-                remainder_pos += to_write;
-                to_write = 0;
+    template<class Target, class T>
+    ::ptracewrap::ptrace_status read_objects(Target& target, const volatile void* address, T* to, ::std::size_t n, ::std::false_type /* is_volatile */) noexcept {
+        return ::ptracewrap::read_bytes(target, address, static_cast<void*>(to), sizeof(T) * n, ::std::nothrow);
+    }
+
+    // Volatile storage can't be given to the kernel, so it goes through a buffer
+    template<class Target, class T>
+    ::ptracewrap::ptrace_status read_objects(Target& target, const volatile void* address, T* to, ::std::size_t n, ::std::true_type /* is_volatile */) noexcept {
+        char buffer[::ptracewrap::detail::stream_buffer_size];
+        volatile char* out = static_cast<volatile char*>(static_cast<volatile void*>(to));
+        ::std::size_t size = sizeof(T) * n;
+        while (size != 0) {
+            ::std::size_t chunk = ::std::min(size, sizeof(buffer));
+            ::ptracewrap::ptrace_status status = ::ptracewrap::read_bytes(target, address, buffer, chunk, ::std::nothrow);
+            if (!status) {
+                return status;
+            }
+            ::ptracewrap::detail::memcpy(out, static_cast<const char*>(buffer), chunk);
+            address = ::ptracewrap::detail::offset(address, chunk);
+            out += chunk;
+            size -= chunk;
+        }
+        return ::ptracewrap::ptrace_status();
+    }
+
+    template<class Target, class T>
+    ::ptracewrap::ptrace_status read_to(Target& target, const volatile void* address, T* to, ::std::size_t n) noexcept {
+        static_assert(::std::is_trivially_copyable<T>::value, "Can only ptrace_read trivial types");
+        static_assert(!::std::is_const<T>::value, "read_to argument 3 (T* to) must be non-const to write to");
+        return ::ptracewrap::detail::read_objects(target, address, to, n, ::std::is_volatile<T>());
+    }
+
+    template<class T, class Target>
+    ::ptracewrap::ptrace_result<T> read(Target& target, const volatile void* address) noexcept(::std::is_nothrow_default_constructible<T>::value) {
+        static_assert(!::std::is_reference<T>::value, "Cannot ptrace_read with T as a reference");
+        ::ptracewrap::ptrace_result<T> result(::ptracewrap::ptrace_status{});
+        ::ptracewrap::ptrace_status status = ::ptracewrap::detail::read_to(target, address, ::std::addressof(*result), 1u);
+        if (!status) {
+            return status;
+        }
+        return result;
+    }
+
+    template<class Target, class T>
+    ::ptracewrap::ptrace_status write_objects(Target& target, const volatile void* address, const T* from, ::std::size_t n, ::std::false_type /* is_volatile */) noexcept {
+        return ::ptracewrap::write_bytes(target, address, static_cast<const void*>(from), sizeof(T) * n, ::std::nothrow);
+    }
+
+    template<class Target, class T>
+    ::ptracewrap::ptrace_status write_objects(Target& target, const volatile void* address, const T* from, ::std::size_t n, ::std::true_type /* is_volatile */) noexcept {
+        char buffer[::ptracewrap::detail::stream_buffer_size];
+        const volatile char* in = static_cast<const volatile char*>(static_cast<const volatile void*>(from));
+        ::std::size_t size = sizeof(T) * n;
+        while (size != 0) {
+            ::std::size_t chunk = ::std::min(size, sizeof(buffer));
+            ::ptracewrap::detail::memcpy(static_cast<char*>(buffer), in, chunk);
+            ::ptracewrap::ptrace_status status = ::ptracewrap::write_bytes(target, address, buffer, chunk, ::std::nothrow);
+            if (!status) {
+                return status;
             }
+            address = ::ptracewrap::detail::offset(address, chunk);
+            in += chunk;
+            size -= chunk;
         }
+        return ::ptracewrap::ptrace_status();
+    }
+
+    template<class Target, class T>
+    ::ptracewrap::ptrace_status write(Target& target, const volatile void* address, const T* from, ::std::size_t n) noexcept {
+        static_assert(::std::is_trivially_copyable<T>::value, "Can only ptrace_write trivial types");
+        return ::ptracewrap::detail::write_objects(target, address, from, n, ::std::is_volatile<T>());
+    }
 
-        while (to_write >= sizeof(long)) {
-            char data[sizeof(long)];
-            ::ptracewrap::detail::memcpy(data, pointer, sizeof(long));
-            long data_as_long;
-            ::std::memcpy(&data_as_long, data, sizeof(long));
-            ::ptracewrap::detail::ptrace_noreset_errno(PTRACE_POKEDATA, pid, write_address, reinterpret_cast<void*>(data_as_long));
-            write_address = static_cast<void*>(static_cast<char*>(write_address) + sizeof(long));
-            to_write -= sizeof(long);
-            if (to_write) pointer += sizeof(long);
+    // Not noexcept since iterating may throw
+    template<class Target, class InputIt, class Sentinel>
+    ::ptracewrap::ptrace_status write_range(Target& target, const volatile void* address, InputIt first, Sentinel last) {
+        typedef typename ::std::remove_reference<typename ::std::iterator_traits<InputIt>::value_type>::type cv_value_type;
+        typedef typename ::std::remove_cv<cv_value_type>::type value_type;
+        static_assert(::std::is_trivially_copyable<value_type>::value, "Can only ptrace_write trivial types");
+
+        typedef typename ::std::conditional< ::std::is_volatile<cv_value_type>::value, const volatile value_type&, const value_type&>::type reference;
+        typedef typename ::std::conditional< ::std::is_volatile<cv_value_type>::value, const volatile void*, const void*>::type vp;
+        typedef typename ::std::conditional< ::std::is_volatile<cv_value_type>::value, const volatile char*, const char*>::type cp;
+
+        // Objects are gathered into a buffer which is written whenever it fills up
+        char buffer[::ptracewrap::detail::stream_buffer_size];
+        ::std::size_t buffer_pos = 0;
+        void* write_address = const_cast<void*>(address);
+
+        for (; first != last; ++first) {
+            reference value = static_cast<reference>(*first);
+            ::std::size_t to_write = sizeof(value_type);
+            cp pointer = static_cast<cp>(static_cast<vp>(::std::addressof(value)));
+            if (sizeof(buffer) - buffer_pos > sizeof(value_type)) {
+                // Common case: the whole object fits, so copy it with a fixed size
+                ::ptracewrap::detail::memcpy<sizeof(value_type)>(static_cast<char*>(buffer) + buffer_pos, pointer);
+                buffer_pos += sizeof(value_type);
+                continue;
+            }
+            while (to_write != 0) {
+                ::std::size_t chunk = ::std::min(to_write, sizeof(buffer) - buffer_pos);
+                ::ptracewrap::detail::memcpy(static_cast<char*>(buffer) + buffer_pos, pointer, chunk);
+                buffer_pos += chunk;
+                pointer += chunk;
+                to_write -= chunk;
+                if (buffer_pos == sizeof(buffer)) {
+                    ::ptracewrap::ptrace_status status = ::ptracewrap::write_bytes(target, write_address, buffer, buffer_pos, ::std::nothrow);
+                    if (!status) {
+                        return status;
+                    }
+                    write_address = ::ptracewrap::detail::offset(write_address, buffer_pos);
+                    buffer_pos = 0;
+                }
+            }
         }
 
-        if (to_write) {
-            remainder_pos = to_write;
-            ::ptracewrap::detail::memcpy(remainder, pointer, to_write);
+        if (buffer_pos != 0) {
+            return ::ptracewrap::write_bytes(target, write_address, buffer, buffer_pos, ::std::nothrow);
         }
+        return ::ptracewrap::ptrace_status();
     }
 
-    if (remainder_pos != 0) {
-        long last = ::ptracewrap::detail::ptrace_noreset_errno(PTRACE_PEEKDATA, pid, write_address);
-        ::std::memcpy(remainder, static_cast<char*>(static_cast<void*>(&last)) + remainder_pos, sizeof(long) - remainder_pos);
-        long remainder_as_long;
-        ::std::memcpy(&remainder_as_long, remainder, sizeof(long));
-        ::ptracewrap::detail::ptrace_noreset_errno(PTRACE_POKEDATA, pid, write_address, reinterpret_cast<void*>(remainder_as_long));
+    template<class Target, class T>
+    T read_non_trivial(Target& target, const volatile void* address) {
+        alignas(T) char out[sizeof(T)];
+        ::ptracewrap::detail::read_to(target, address, out, sizeof(out)).throw_if_error();
+        return static_cast<T&&>(*static_cast<T*>(static_cast<void*>(out)));
     }
+
+    template<class Target, class T>
+    void read_to_non_trivial(Target& target, const volatile void* address, T* to, ::std::size_t n) {
+        typedef typename ::std::conditional< ::std::is_volatile<T>::value, volatile void*, void*>::type vp;
+        typedef typename ::std::conditional< ::std::is_volatile<T>::value, volatile char, char>::type ct;
+        typedef ct* cp;
+        ::ptracewrap::detail::read_to(target, address, static_cast<cp>(static_cast<vp>(to)), sizeof(T) * n).throw_if_error();
+    }
+
+    template<class Target, class T>
+    void write_non_trivial(Target& target, const volatile void* address, const T* from, ::std::size_t n) {
+        typedef typename ::std::conditional< ::std::is_volatile<T>::value, const volatile void*, const void*>::type vp;
+        typedef typename ::std::conditional< ::std::is_volatile<T>::value, const volatile char, const char>::type ct;
+        typedef ct* cp;
+        ::ptracewrap::detail::write(target, address, static_cast<cp>(static_cast<vp>(from)), sizeof(T) * n).throw_if_error();
+    }
+}
+
+// Like ptrace::read, but writes to `to` instead of returning (Works with arrays)
+template<class T>
+void read_to(::pid_t pid, void* address, T& to) {
+    ::ptracewrap::detail::read_to(pid, address, ::std::addressof(to), 1u).throw_if_error();
+}
+
+template<class T>
+void read_to(::pid_t pid, const volatile void* address, T& to) {
+    return ::ptracewrap::read_to(pid, const_cast<void*>(address), to);
+}
+
+// Like ptrace::read_to, but read to contiguous storage of `n` `T`s pointed to by `to`
+template<class T>
+void read_to(::pid_t pid, void* address, T* to, ::std::size_t n) {
+    ::ptracewrap::detail::read_to(pid, address, to, n).throw_if_error();
+}
+
+template<class T>
+void read_to(::pid_t pid, const volatile void* address, T* to, ::std::size_t n) {
+    return ::ptracewrap::read_to(pid, const_cast<void*>(address), to, n);
+}
+
+// Reads a value of type `T` from `address` in the process with pid `pid`'s virtual address space
+template<class T>
+T read(::pid_t pid, void* address) {
+    static_assert(!::std::is_reference<T>::value, "Cannot ptrace_read with T as a reference");
+    T out;
+    ::ptracewrap::read_to(pid, address, out);
+    return out;
+}
+
+template<class T>
+T read(::pid_t pid, const volatile void* address) {
+    return ::ptracewrap::read<T>(pid, const_cast<void*>(address));
+}
+
+// Writes `data` to `address` in the process with pid `pid`'s virtual address space
+template<class T>
+void write(::pid_t pid, void* address, const T& data) {
+    ::ptracewrap::detail::write(pid, address, ::std::addressof(data), 1u).throw_if_error();
+}
+
+template<class T>
+void write(::pid_t pid, const volatile void* address, const T& data) {
+    return ::ptracewrap::write(pid, const_cast<void*>(address), data);
+}
+
+template<class T>
+void write(::pid_t pid, void* address, const T* from, ::std::size_t n) {
+    ::ptracewrap::detail::write(pid, address, from, n).throw_if_error();
+}
+
+template<class InputIt, class Sentinel = InputIt>
+typename ::std::enable_if< ::ptracewrap::detail::is_sentinel<Sentinel>::value, typename ::ptracewrap::detail::void_t<typename ::std::iterator_traits<InputIt>::value_type>::type>::type
+write(::pid_t pid, const volatile void* address, InputIt first, Sentinel last) {
+    ::ptracewrap::detail::write_range(pid, address, first, last).throw_if_error();
 }
 
 template<class T>
@@ -460,21 +2201,50 @@ void write(::pid_t pid, const volatile void* address, const T* from, ::std::size
     return ::ptracewrap::write(pid, const_cast<void*>(address), from, n);
 }
 
+// Non-throwing versions of the above, for when errors are expected (e.g. probing pointers that may be invalid).
+// Instead of throwing a `ptrace_error`, they return a `ptrace_status` (Or `ptrace_result`) that can create it
+
+template<class T>
+::ptracewrap::ptrace_status read_to(::pid_t pid, const volatile void* address, T& to, const ::std::nothrow_t&) noexcept {
+    return ::ptracewrap::detail::read_to(pid, address, ::std::addressof(to), 1u);
+}
+
+template<class T>
+::ptracewrap::ptrace_status read_to(::pid_t pid, const volatile void* address, T* to, ::std::size_t n, const ::std::nothrow_t&) noexcept {
+    return ::ptracewrap::detail::read_to(pid, address, to, n);
+}
+
+template<class T>
+::ptracewrap::ptrace_result<T> read(::pid_t pid, const volatile void* address, const ::std::nothrow_t&) noexcept(::std::is_nothrow_default_constructible<T>::value) {
+    return ::ptracewrap::detail::read<T>(pid, address);
+}
+
+template<class T>
+::ptracewrap::ptrace_status write(::pid_t pid, const volatile void* address, const T& data, const ::std::nothrow_t&) noexcept {
+    return ::ptracewrap::detail::write(pid, address, ::std::addressof(data), 1u);
+}
+
+template<class T>
+::ptracewrap::ptrace_status write(::pid_t pid, const volatile void* address, const T* from, ::std::size_t n, const ::std::nothrow_t&) noexcept {
+    return ::ptracewrap::detail::write(pid, address, from, n);
+}
+
+template<class InputIt, class Sentinel = InputIt>
+typename ::std::enable_if< ::ptracewrap::detail::is_sentinel<Sentinel>::value, ::ptracewrap::ptrace_status>::type
+write(::pid_t pid, const volatile void* address, InputIt first, Sentinel last, const ::std::nothrow_t&) {
+    return ::ptracewrap::detail::write_range(pid, address, first, last);
+}
+
 // Like ptrace_read, but relies on undefined behaviour for non trivial types (`memcpy`s non trivial types)
 template<class T>
 T read_non_trivial(::pid_t pid, const volatile void* address) {
-    alignas(T) char out[sizeof(T)];
-    ::ptracewrap::read_to<char>(pid, address, out, sizeof(out));
-    return static_cast<T&&>(*static_cast<T*>(static_cast<void*>(out)));
+    return ::ptracewrap::detail::read_non_trivial< ::pid_t, T>(pid, address);
 }
 
 // Like ptrace_read_to, but relies on undefined behaviour for non trivial types (`memcpy`s non trivial types)
 template<class T>
 void read_to_non_trivial(::pid_t pid, const volatile void* address, T* to, ::std::size_t n) {
-    typedef typename ::std::conditional< ::std::is_volatile<T>::value, volatile void*, void*>::type vp;
-    typedef typename ::std::conditional< ::std::is_volatile<T>::value, volatile char, char>::type ct;
-    typedef ct* cp;
-    ::ptracewrap::read_to<ct>(pid, address, static_cast<cp>(static_cast<vp>(to)), sizeof(T) * n);
+    ::ptracewrap::detail::read_to_non_trivial(pid, address, to, n);
 }
 
 // Like ptrace_read_to, but relies on undefined behaviour for non trivial types (`memcpy`s non trivial types)
@@ -485,10 +2255,7 @@ void read_to_non_trivial(::pid_t pid, const volatile void* address, T& to) {
 
 template<class T>
 void write_non_trivial(::pid_t pid, const volatile void* address, const T* from, ::std::size_t n) {
-    typedef typename ::std::conditional< ::std::is_volatile<T>::value, const volatile void*, const void*>::type vp;
-    typedef typename ::std::conditional< ::std::is_volatile<T>::value, const volatile char, const char>::type ct;
-    typedef ct* cp;
-    ::ptracewrap::write<ct>(pid, address, static_cast<cp>(static_cast<vp>(from)), sizeof(T) * n);
+    ::ptracewrap::detail::write_non_trivial(pid, address, from, n);
 }
 
 template<class T>
@@ -496,6 +2263,340 @@ void write_non_trivial(::pid_t pid, const volatile void* address, const T& data)
     ::ptracewrap::write_non_trivial(pid, address, ::std::addressof(data), 1u);
 }
 
+// The same functions, but through a `tracee` handle
+
+template<class T>
+void read_to(::ptracewrap::tracee& target, const volatile void* address, T& to) {
+    ::ptracewrap::detail::read_to(target, address, ::std::addressof(to), 1u).throw_if_error();
+}
+
+template<class T>
+void read_to(::ptracewrap::tracee& target, const volatile void* address, T* to, ::std::size_t n) {
+    ::ptracewrap::detail::read_to(target, address, to, n).throw_if_error();
+}
+
+template<class T>
+T read(::ptracewrap::tracee& target, const volatile void* address) {
+    static_assert(!::std::is_reference<T>::value, "Cannot ptrace_read with T as a reference");
+    T out;
+    ::ptracewrap::read_to(target, address, out);
+    return out;
+}
+
+template<class T>
+void write(::ptracewrap::tracee& target, const volatile void* address, const T& data) {
+    ::ptracewrap::detail::write(target, address, ::std::addressof(data), 1u).throw_if_error();
+}
+
+template<class T>
+void write(::ptracewrap::tracee& target, const volatile void* address, const T* from, ::std::size_t n) {
+    ::ptracewrap::detail::write(target, address, from, n).throw_if_error();
+}
+
+template<class InputIt, class Sentinel = InputIt>
+typename ::std::enable_if< ::ptracewrap::detail::is_sentinel<Sentinel>::value, typename ::ptracewrap::detail::void_t<typename ::std::iterator_traits<InputIt>::value_type>::type>::type
+write(::ptracewrap::tracee& target, const volatile void* address, InputIt first, Sentinel last) {
+    ::ptracewrap::detail::write_range(target, address, first, last).throw_if_error();
+}
+
+template<class T>
+::ptracewrap::ptrace_status read_to(::ptracewrap::tracee& target, const volatile void* address, T& to, const ::std::nothrow_t&) noexcept {
+    return ::ptracewrap::detail::read_to(target, address, ::std::addressof(to), 1u);
+}
+
+template<class T>
+::ptracewrap::ptrace_status read_to(::ptracewrap::tracee& target, const volatile void* address, T* to, ::std::size_t n, const ::std::nothrow_t&) noexcept {
+    return ::ptracewrap::detail::read_to(target, address, to, n);
+}
+
+template<class T>
+::ptracewrap::ptrace_result<T> read(::ptracewrap::tracee& target, const volatile void* address, const ::std::nothrow_t&) noexcept(::std::is_nothrow_default_constructible<T>::value) {
+    return ::ptracewrap::detail::read<T>(target, address);
+}
+
+template<class T>
+::ptracewrap::ptrace_status write(::ptracewrap::tracee& target, const volatile void* address, const T& data, const ::std::nothrow_t&) noexcept {
+    return ::ptracewrap::detail::write(target, address, ::std::addressof(data), 1u);
+}
+
+template<class T>
+::ptracewrap::ptrace_status write(::ptracewrap::tracee& target, const volatile void* address, const T* from, ::std::size_t n, const ::std::nothrow_t&) noexcept {
+    return ::ptracewrap::detail::write(target, address, from, n);
+}
+
+template<class InputIt, class Sentinel = InputIt>
+typename ::std::enable_if< ::ptracewrap::detail::is_sentinel<Sentinel>::value, ::ptracewrap::ptrace_status>::type
+write(::ptracewrap::tracee& target, const volatile void* address, InputIt first, Sentinel last, const ::std::nothrow_t&) {
+    return ::ptracewrap::detail::write_range(target, address, first, last);
+}
+
+template<class T>
+T read_non_trivial(::ptracewrap::tracee& target, const volatile void* address) {
+    return ::ptracewrap::detail::read_non_trivial< ::ptracewrap::tracee, T>(target, address);
+}
+
+template<class T>
+void read_to_non_trivial(::ptracewrap::tracee& target, const volatile void* address, T* to, ::std::size_t n) {
+    ::ptracewrap::detail::read_to_non_trivial(target, address, to, n);
+}
+
+template<class T>
+void read_to_non_trivial(::ptracewrap::tracee& target, const volatile void* address, T& to) {
+    ::ptracewrap::read_to_non_trivial(target, address, ::std::addressof(to), 1u);
+}
+
+template<class T>
+void write_non_trivial(::ptracewrap::tracee& target, const volatile void* address, const T* from, ::std::size_t n) {
+    ::ptracewrap::detail::write_non_trivial(target, address, from, n);
+}
+
+template<class T>
+void write_non_trivial(::ptracewrap::tracee& target, const volatile void* address, const T& data) {
+    ::ptracewrap::write_non_trivial(target, address, ::std::addressof(data), 1u);
+}
+
+
+namespace detail {
+    template<class Target>
+    bool read_string_into(Target& target, const volatile void* address, ::std::string& out, ::std::size_t max_length) {
+        out.clear();
+        char buffer[::ptracewrap::detail::stream_buffer_size];
+        // Start small since most strings are, but never read past the end of a page unless the string continues
+        // onto the next one, so a string right before an unmapped page can still be read
+        ::std::size_t chunk_size = 256;
+        while (out.size() < max_length) {
+            ::std::size_t chunk = ::std::min(::std::min(chunk_size, sizeof(buffer)), ::std::min(::ptracewrap::detail::bytes_to_page_end(address), max_length - out.size()));
+            ::ptracewrap::read_bytes(target, address, buffer, chunk);
+            const void* terminator = ::std::memchr(buffer, '\0', chunk);
+            if (terminator != nullptr) {
+                out.append(buffer, static_cast< ::std::size_t>(static_cast<const char*>(terminator) - buffer));
+                return true;
+            }
+            out.append(buffer, chunk);
+            address = ::ptracewrap::detail::offset(address, chunk);
+            chunk_size *= 2;
+        }
+        return false;
+    }
+}
+
+// Reads the NUL-terminated string at `address` (Without the terminator) into `out`, replacing its contents but keeping
+// its capacity, so a buffer can be reused for many strings. Reads at most `max_length` characters. Returns false if
+// the string was longer than that (`out` has the first `max_length` characters)
+inline bool read_string_into(::pid_t pid, const volatile void* address, ::std::string& out, ::std::size_t max_length = static_cast< ::std::size_t>(-1)) {
+    return ::ptracewrap::detail::read_string_into(pid, address, out, max_length);
+}
+
+inline bool read_string_into(::ptracewrap::tracee& target, const volatile void* address, ::std::string& out, ::std::size_t max_length = static_cast< ::std::size_t>(-1)) {
+    return ::ptracewrap::detail::read_string_into(target, address, out, max_length);
+}
+
+// Reads the NUL-terminated string at `address`, truncated to `max_length` characters
+inline ::std::string read_cstring(::pid_t pid, const volatile void* address, ::std::size_t max_length = static_cast< ::std::size_t>(-1)) {
+    ::std::string out;
+    ::ptracewrap::read_string_into(pid, address, out, max_length);
+    return out;
+}
+
+inline ::std::string read_cstring(::ptracewrap::tracee& target, const volatile void* address, ::std::size_t max_length = static_cast< ::std::size_t>(-1)) {
+    ::std::string out;
+    ::ptracewrap::read_string_into(target, address, out, max_length);
+    return out;
+}
+
+// Queues many small reads and performs them together. `execute()` merges entries that are next to or overlap each
+// other and reads all of them with as few process_vm_readv(2) calls as possible (One per `IOV_MAX` ranges).
+// An entry that can't be read doesn't stop the rest of the batch; its error is recorded instead
+class read_batch {
+public:
+    explicit read_batch(::pid_t pid) noexcept : m_pid(pid) {}
+
+    ::pid_t get_pid() const noexcept {
+        return m_pid;
+    }
+
+    // Queue reading `n` bytes from `address` to `to`. Returns the index of the entry
+    ::std::size_t add(const volatile void* address, void* to, ::std::size_t n) {
+        entry e;
+        e.address = reinterpret_cast< ::std::uintptr_t>(address);
+        e.to = static_cast<char*>(to);
+        e.n = n;
+        e.errnum = 0;
+        e.error_address = e.address;
+        m_entries.push_back(e);
+        return m_entries.size() - 1;
+    }
+
+    template<class T>
+    ::std::size_t add(const volatile void* address, T& to) {
+        return add(address, ::std::addressof(to), 1u);
+    }
+
+    template<class T>
+    ::std::size_t add(const volatile void* address, T* to, ::std::size_t n) {
+        static_assert(::std::is_trivially_copyable<T>::value, "Can only ptrace_read trivial types");
+        static_assert(!::std::is_const<T>::value && !::std::is_volatile<T>::value, "read_batch::add argument 2 (T* to) must be non-const and non-volatile");
+        return add(address, static_cast<void*>(to), sizeof(T) * n);
+    }
+
+    ::std::size_t size() const noexcept {
+        return m_entries.size();
+    }
+
+    // Remove every entry (Keeps allocated memory for the next batch)
+    void clear() noexcept {
+        m_entries.clear();
+    }
+
+    // Read every entry. Returns the number of entries that failed
+    ::std::size_t execute() {
+        for (entry& e : m_entries) {
+            e.errnum = 0;
+            e.error_address = e.address;
+        }
+        merge();
+
+        ::std::size_t first = 0;
+        while (first < m_ranges.size()) {
+            ::std::size_t count = ::std::min(m_ranges.size() - first, static_cast< ::std::size_t>(max_iovecs()));
+            m_local.resize(count);
+            m_remote.resize(count);
+            for (::std::size_t i = 0; i < count; ++i) {
+                const range& r = m_ranges[first + i];
+                m_local[i].iov_base = m_buffer.data() + r.buffer_offset;
+                m_local[i].iov_len = r.end - r.start;
+                m_remote[i].iov_base = reinterpret_cast<void*>(r.start);
+                m_remote[i].iov_len = r.end - r.start;
+            }
+            ::ssize_t result = ::ptracewrap::detail::raw_process_vm(false, m_pid, m_local.data(), static_cast<unsigned long>(count), m_remote.data(), static_cast<unsigned long>(count));
+            ::std::size_t read = result < 0 ? 0 : static_cast< ::std::size_t>(result);
+
+            // Every range before the one that failed (If any) was read completely
+            ::std::size_t i = 0;
+            while (i < count && read >= m_ranges[first + i].end - m_ranges[first + i].start) {
+                read -= m_ranges[first + i].end - m_ranges[first + i].start;
+                copy_out(m_ranges[first + i]);
+                ++i;
+            }
+            if (i < count) {
+                recover(m_ranges[first + i], read);
+                ++i;
+            }
+            first += i;
+        }
+
+        ::std::size_t failed = 0;
+        for (const entry& e : m_entries) {
+            failed += e.errnum != 0;
+        }
+        return failed;
+    }
+
+    bool succeeded(::std::size_t i) const noexcept {
+        return m_entries[i].errnum == 0;
+    }
+
+    // 0 if entry `i` was read successfully
+    int get_errno(::std::size_t i) const noexcept {
+        return m_entries[i].errnum;
+    }
+
+    // The error entry `i` failed with. Only valid if `!succeeded(i)`
+    ::ptracewrap::ptrace_error get_error(::std::size_t i) const {
+        return ::ptracewrap::ptrace_error(m_entries[i].errnum, PTRACE_PEEKDATA, m_pid, reinterpret_cast<void*>(m_entries[i].error_address));
+    }
+private:
+    struct entry {
+        ::std::uintptr_t address;
+        char* to;
+        ::std::size_t n;
+        int errnum;
+        ::std::uintptr_t error_address;
+    };
+
+    // A contiguous remote range covering `m_order[first_entry, last_entry)`
+    struct range {
+        ::std::uintptr_t start;
+        ::std::uintptr_t end;
+        ::std::size_t buffer_offset;
+        ::std::size_t first_entry;
+        ::std::size_t last_entry;
+    };
+
+    static long max_iovecs() noexcept {
+#ifdef IOV_MAX
+        return IOV_MAX;
+#else
+        return 1024;
+#endif
+    }
+
+    void merge() {
+        m_order.clear();
+        for (::std::size_t i = 0; i < m_entries.size(); ++i) {
+            if (m_entries[i].n != 0) {
+                m_order.push_back(i);
+            }
+        }
+        const ::std::vector<entry>& entries = m_entries;
+        ::std::sort(m_order.begin(), m_order.end(), [&entries](::std::size_t a, ::std::size_t b) {
+            return entries[a].address < entries[b].address;
+        });
+
+        m_ranges.clear();
+        ::std::size_t buffer_size = 0;
+        for (::std::size_t i = 0; i < m_order.size(); ++i) {
+            const entry& e = m_entries[m_order[i]];
+            if (!m_ranges.empty() && e.address <= m_ranges.back().end) {
+                m_ranges.back().end = ::std::max(m_ranges.back().end, e.address + e.n);
+                m_ranges.back().last_entry = i + 1;
+                continue;
+            }
+            if (!m_ranges.empty()) {
+                buffer_size += m_ranges.back().end - m_ranges.back().start;
+            }
+            range r = { e.address, e.address + e.n, buffer_size, i, i + 1 };
+            m_ranges.push_back(r);
+        }
+        if (!m_ranges.empty()) {
+            buffer_size += m_ranges.back().end - m_ranges.back().start;
+        }
+        m_buffer.resize(buffer_size);
+    }
+
+    void copy_out(const range& r) noexcept {
+        for (::std::size_t i = r.first_entry; i < r.last_entry; ++i) {
+            const entry& e = m_entries[m_order[i]];
+            ::std::memcpy(e.to, m_buffer.data() + r.buffer_offset + (e.address - r.start), e.n);
+        }
+    }
+
+    // Only the first `read` bytes of `r` were read. Entries that lie entirely within those are done,
+    // the rest are retried individually to find which of them are actually unreadable
+    void recover(const range& r, ::std::size_t read) {
+        for (::std::size_t i = r.first_entry; i < r.last_entry; ++i) {
+            entry& e = m_entries[m_order[i]];
+            if (e.address + e.n <= r.start + read) {
+                ::std::memcpy(e.to, m_buffer.data() + r.buffer_offset + (e.address - r.start), e.n);
+                continue;
+            }
+            ::ptracewrap::ptrace_status status = ::ptracewrap::read_bytes(m_pid, reinterpret_cast<void*>(e.address), e.to, e.n, ::std::nothrow);
+            if (!status) {
+                e.errnum = status.get_errno();
+                e.error_address = reinterpret_cast< ::std::uintptr_t>(status.get_addr());
+            }
+        }
+    }
+
+    ::pid_t m_pid;
+    ::std::vector<entry> m_entries;
+    ::std::vector< ::std::size_t> m_order;
+    ::std::vector<range> m_ranges;
+    ::std::vector<char> m_buffer;
+    ::std::vector< ::iovec> m_local;
+    ::std::vector< ::iovec> m_remote;
+};
+
 }
 
 #endif  // PTRACEWRAP_PTRACEWRAP_HPP_
@@ -0,0 +1,290 @@
+#ifndef PTRACEWRAP_BREAKPOINTS_HPP_
+#define PTRACEWRAP_BREAKPOINTS_HPP_
+
+#include "../ptracewrap.hpp"
+
+#if !defined(__x86_64__) && !defined(__i386__)
+#error "ptracewrap/breakpoints.hpp only supports x86 (int3 breakpoints)"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <vector>
+
+#include <sys/wait.h>
+
+namespace ptracewrap {
+
+// Software (int3) breakpoints in one tracee. Many breakpoints can be inserted or removed at once, with one read and one
+// write for each page they are on. The original bytes are kept in a sorted shadow table, and the manager is the
+// `tracee`'s memory overlay, so reads through the `tracee` see the original code and writes over a breakpoint
+// change what will run once it is removed.
+//
+// The tracee (And all of its threads) must be stopped while breakpoints are changed
+class breakpoint_manager : public ::ptracewrap::memory_overlay {
+public:
+    static constexpr unsigned char int3 = 0xcc;
+
+    explicit breakpoint_manager(::ptracewrap::tracee& t) noexcept : m_tracee(t), m_page_writes(0) {
+        m_tracee.set_memory_overlay(this);
+    }
+
+    breakpoint_manager(const breakpoint_manager&) = delete;
+    breakpoint_manager& operator=(const breakpoint_manager&) = delete;
+
+    // Stops being the overlay, but leaves the breakpoints in the tracee (Call `remove_all()` first to remove them)
+    ~breakpoint_manager() {
+        if (m_tracee.get_memory_overlay() == this) {
+            m_tracee.set_memory_overlay(nullptr);
+        }
+    }
+
+    // Inserts a breakpoint at each address that doesn't already have one. Returns the number inserted.
+    // Throws a `ptrace_error` if a page can't be patched (The pages before it keep their breakpoints)
+    ::std::size_t insert(::std::vector< ::std::uintptr_t> addresses) {
+        ::std::sort(addresses.begin(), addresses.end());
+        addresses.erase(::std::unique(addresses.begin(), addresses.end()), addresses.end());
+        addresses.erase(::std::remove_if(addresses.begin(), addresses.end(), [this](::std::uintptr_t address) {
+            return contains(address);
+        }), addresses.end());
+
+        ::std::vector<breakpoint> added;
+        added.reserve(addresses.size());
+        try {
+            patch_pages(addresses, [&added](::std::uintptr_t address, unsigned char& byte) {
+                added.push_back(breakpoint{ address, byte });
+                byte = int3;
+            }, [&added](::std::size_t count) {
+                added.resize(added.size() - count);
+            });
+        } catch (...) {
+            merge(added);
+            throw;
+        }
+        merge(added);
+        return added.size();
+    }
+
+    bool insert(::std::uintptr_t address) {
+        return insert(::std::vector< ::std::uintptr_t>(1, address)) == 1;
+    }
+
+    // Removes the breakpoints at each address that has one, restoring the original bytes. Returns the number removed
+    ::std::size_t remove(::std::vector< ::std::uintptr_t> addresses) {
+        ::std::sort(addresses.begin(), addresses.end());
+        addresses.erase(::std::unique(addresses.begin(), addresses.end()), addresses.end());
+        addresses.erase(::std::remove_if(addresses.begin(), addresses.end(), [this](::std::uintptr_t address) {
+            return !contains(address);
+        }), addresses.end());
+
+        ::std::vector< ::std::uintptr_t> removed;
+        removed.reserve(addresses.size());
+        try {
+            patch_pages(addresses, [this, &removed](::std::uintptr_t address, unsigned char& byte) {
+                byte = find(address)->original;
+                removed.push_back(address);
+            }, [&removed](::std::size_t count) {
+                removed.resize(removed.size() - count);
+            });
+        } catch (...) {
+            erase(removed);
+            throw;
+        }
+        erase(removed);
+        return removed.size();
+    }
+
+    bool remove(::std::uintptr_t address) {
+        return remove(::std::vector< ::std::uintptr_t>(1, address)) == 1;
+    }
+
+    void remove_all() {
+        ::std::vector< ::std::uintptr_t> addresses;
+        addresses.reserve(m_breakpoints.size());
+        for (const breakpoint& b : m_breakpoints) {
+            addresses.push_back(b.address);
+        }
+        remove(::std::move(addresses));
+    }
+
+    bool contains(::std::uintptr_t address) const noexcept {
+        return find(address) != m_breakpoints.end();
+    }
+
+    ::std::size_t size() const noexcept {
+        return m_breakpoints.size();
+    }
+
+    // The byte a breakpoint replaced, which must exist
+    unsigned char original(::std::uintptr_t address) const noexcept {
+        return find(address)->original;
+    }
+
+    // Number of page writes made to insert or remove breakpoints
+    ::std::size_t get_page_writes() const noexcept {
+        return m_page_writes;
+    }
+
+    // At a SIGTRAP stop: if the tracee just executed a breakpoint, moves the instruction pointer back to it and returns
+    // its address. Otherwise returns 0
+    ::std::uintptr_t hit() {
+        ::std::uintptr_t address = instruction_pointer(m_tracee.registers().get_regs()) - 1;
+        if (!contains(address)) {
+            return 0;
+        }
+        instruction_pointer(m_tracee.registers().modify_regs()) = address;
+        return address;
+    }
+
+    // Single steps the tracee. If it is at a breakpoint, the original instruction is run, and the breakpoint is put back
+    // afterwards. Returns the `waitpid(2)` status of the stop after the step (Which could be a signal-delivery-stop,
+    // in which case the instruction hasn't been run yet)
+    int step_over() {
+        ::std::uintptr_t address = instruction_pointer(m_tracee.registers().get_regs());
+        bool at_breakpoint = contains(address);
+        if (at_breakpoint) {
+            raw_write(address, find(address)->original);
+        }
+        m_tracee.singlestep();
+        int status;
+        ::pid_t result;
+        while ((result = ::waitpid(m_tracee.get_pid(), &status, __WALL)) == -1 && errno == EINTR) {}
+        if (result == -1) {
+            throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), "waitpid");
+        }
+        if (at_breakpoint) {
+            if (WIFSTOPPED(status)) {
+                raw_write(address, int3);
+            } else {
+                // Only this thread is gone if the memory is still there
+                unsigned char byte = int3;
+                m_tracee.write_bytes_raw(reinterpret_cast<void*>(address), &byte, 1, ::std::nothrow);
+            }
+        }
+        return status;
+    }
+
+    bool overlaps(::std::uintptr_t address, ::std::size_t n) const noexcept override {
+        ::std::vector<breakpoint>::const_iterator it = lower_bound(address);
+        return it != m_breakpoints.end() && it->address - address < n;
+    }
+
+    void on_read(::std::uintptr_t address, char* data, ::std::size_t n) const noexcept override {
+        for (::std::vector<breakpoint>::const_iterator it = lower_bound(address); it != m_breakpoints.end() && it->address - address < n; ++it) {
+            data[it->address - address] = static_cast<char>(it->original);
+        }
+    }
+
+    void on_write(::std::uintptr_t address, char* data, ::std::size_t n) noexcept override {
+        for (::std::vector<breakpoint>::iterator it = lower_bound(address); it != m_breakpoints.end() && it->address - address < n; ++it) {
+            it->original = static_cast<unsigned char>(data[it->address - address]);
+            data[it->address - address] = static_cast<char>(int3);
+        }
+    }
+private:
+    struct breakpoint {
+        ::std::uintptr_t address;
+        unsigned char original;
+    };
+
+#if defined(__x86_64__)
+    static unsigned long long& instruction_pointer(::ptracewrap::register_cache::regs_type& regs) noexcept {
+        return regs.rip;
+    }
+
+    static ::std::uintptr_t instruction_pointer(const ::ptracewrap::register_cache::regs_type& regs) noexcept {
+        return static_cast< ::std::uintptr_t>(regs.rip);
+    }
+#else
+    static long& instruction_pointer(::ptracewrap::register_cache::regs_type& regs) noexcept {
+        return regs.eip;
+    }
+
+    static ::std::uintptr_t instruction_pointer(const ::ptracewrap::register_cache::regs_type& regs) noexcept {
+        return static_cast< ::std::uintptr_t>(regs.eip);
+    }
+#endif
+
+    ::std::vector<breakpoint>::const_iterator lower_bound(::std::uintptr_t address) const noexcept {
+        return ::std::lower_bound(m_breakpoints.begin(), m_breakpoints.end(), address, [](const breakpoint& b, ::std::uintptr_t a) {
+            return b.address < a;
+        });
+    }
+
+    ::std::vector<breakpoint>::iterator lower_bound(::std::uintptr_t address) noexcept {
+        return ::std::lower_bound(m_breakpoints.begin(), m_breakpoints.end(), address, [](const breakpoint& b, ::std::uintptr_t a) {
+            return b.address < a;
+        });
+    }
+
+    ::std::vector<breakpoint>::const_iterator find(::std::uintptr_t address) const noexcept {
+        ::std::vector<breakpoint>::const_iterator it = lower_bound(address);
+        return it != m_breakpoints.end() && it->address == address ? it : m_breakpoints.end();
+    }
+
+    // Reads and writes made by the manager itself see the patched memory
+    void raw_write(::std::uintptr_t address, unsigned char byte) {
+        m_tracee.write_bytes_raw(reinterpret_cast<void*>(address), &byte, 1);
+    }
+
+    // For each page with some of the (Sorted) `addresses`, reads the span of bytes from the first to the last of them,
+    // calls `patch(address, byte)` for each address, and writes the span back. If a page fails, `undo(count)` is
+    // called with the number of `patch` calls for that page before throwing
+    template<class Patch, class Undo>
+    void patch_pages(const ::std::vector< ::std::uintptr_t>& addresses, Patch&& patch, Undo&& undo) {
+        const ::std::size_t page = ::ptracewrap::detail::page_size();
+        ::std::vector<unsigned char> buffer;
+        ::std::size_t i = 0;
+        while (i < addresses.size()) {
+            ::std::uintptr_t first = addresses[i];
+            ::std::uintptr_t page_end = first - first % page + page;
+            ::std::size_t j = i;
+            while (j < addresses.size() && addresses[j] < page_end) {
+                ++j;
+            }
+            ::std::uintptr_t last = addresses[j - 1];
+            buffer.resize(last - first + 1);
+            void* remote = reinterpret_cast<void*>(first);
+            m_tracee.read_bytes_raw(remote, buffer.data(), buffer.size());
+            for (::std::size_t k = i; k < j; ++k) {
+                patch(addresses[k], buffer[addresses[k] - first]);
+            }
+            ::ptracewrap::ptrace_status status = m_tracee.write_bytes_raw(remote, buffer.data(), buffer.size(), ::std::nothrow);
+            if (!status) {
+                undo(j - i);
+                status.throw_if_error();
+            }
+            ++m_page_writes;
+            i = j;
+        }
+    }
+
+    void merge(const ::std::vector<breakpoint>& added) {
+        ::std::size_t middle = m_breakpoints.size();
+        m_breakpoints.insert(m_breakpoints.end(), added.begin(), added.end());
+        ::std::inplace_merge(m_breakpoints.begin(), m_breakpoints.begin() + static_cast< ::std::ptrdiff_t>(middle), m_breakpoints.end(),
+            [](const breakpoint& a, const breakpoint& b) { return a.address < b.address; });
+    }
+
+    // `addresses` is sorted
+    void erase(const ::std::vector< ::std::uintptr_t>& addresses) {
+        ::std::vector< ::std::uintptr_t>::const_iterator next = addresses.begin();
+        m_breakpoints.erase(::std::remove_if(m_breakpoints.begin(), m_breakpoints.end(), [&](const breakpoint& b) {
+            while (next != addresses.end() && *next < b.address) {
+                ++next;
+            }
+            return next != addresses.end() && *next == b.address;
+        }), m_breakpoints.end());
+    }
+
+    ::ptracewrap::tracee& m_tracee;
+    ::std::vector<breakpoint> m_breakpoints;
+    ::std::size_t m_page_writes;
+};
+
+}
+
+#endif  // PTRACEWRAP_BREAKPOINTS_HPP_
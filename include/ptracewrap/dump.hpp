@@ -0,0 +1,410 @@
+#ifndef PTRACEWRAP_DUMP_HPP_
+#define PTRACEWRAP_DUMP_HPP_
+
+#include "../ptracewrap.hpp"
+#include "scanner.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ptracewrap {
+
+// The header at the start of a dump file, followed by `region_count` `dump_region`s and the path strings.
+// Everything is in the byte order of the machine that wrote it
+struct dump_file_header {
+    static constexpr ::std::uint32_t current_version = 1;
+
+    // "PTWDUMP\0"
+    char magic[8];
+    ::std::uint32_t version;
+    ::std::uint32_t page_size;
+    ::std::uint64_t region_count;
+    ::std::uint64_t strings_offset;
+    ::std::uint64_t strings_size;
+    // Page aligned. Where the contents of the first region start
+    ::std::uint64_t data_offset;
+    char reserved[16];
+};
+
+struct dump_region {
+    ::std::uint64_t start;
+    ::std::uint64_t end;
+    // Offset of the mapping in its file (From `/proc/<pid>/maps`)
+    ::std::uint64_t offset;
+    // Where the contents are in the dump file (Page aligned)
+    ::std::uint64_t file_offset;
+    // `memory_region` permissions
+    ::std::uint32_t permissions;
+    // Into the string table. Not NUL terminated
+    ::std::uint32_t path_offset;
+    ::std::uint32_t path_size;
+    ::std::uint32_t reserved;
+};
+
+static_assert(sizeof(::ptracewrap::dump_file_header) == 64, "dump_file_header is part of the dump file format");
+static_assert(sizeof(::ptracewrap::dump_region) == 48, "dump_region is part of the dump file format");
+
+struct dump_options {
+    // Worker threads, or 0 for `std::thread::hardware_concurrency()`
+    unsigned threads = 0;
+    ::std::size_t chunk_size = ::std::size_t(4) << 20;
+    // Only regions with all of these `memory_region` permissions are dumped
+    unsigned permissions = ::ptracewrap::memory_region::read;
+    // If set, only regions it returns true for are dumped
+    ::std::function<bool(const ::ptracewrap::memory_region&, const ::std::string& path)> filter;
+};
+
+struct dump_result {
+    ::std::size_t regions = 0;
+    // Bytes of memory written to the file
+    ::std::uint64_t bytes_written = 0;
+    // Bytes of zero pages left as holes
+    ::std::uint64_t bytes_zero = 0;
+    // Bytes that couldn't be read (Also left as holes)
+    ::std::uint64_t bytes_failed = 0;
+};
+
+namespace detail {
+
+    inline bool is_zero(const char* data, ::std::size_t n) noexcept {
+        ::std::size_t i = 0;
+        for (; i + sizeof(::std::uint64_t) <= n; i += sizeof(::std::uint64_t)) {
+            ::std::uint64_t word;
+            ::std::memcpy(&word, data + i, sizeof(word));
+            if (word != 0) {
+                return false;
+            }
+        }
+        for (; i < n; ++i) {
+            if (data[i] != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    inline bool pwrite_all(int fd, const char* data, ::std::size_t n, ::std::uint64_t offset) noexcept {
+        while (n != 0) {
+            ::ssize_t result = ::pwrite(fd, data, n, static_cast< ::off_t>(offset));
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += result;
+            n -= static_cast< ::std::size_t>(result);
+            offset += static_cast< ::std::uint64_t>(result);
+        }
+        return true;
+    }
+
+}
+
+// Writes the memory of `pid` (Which should be stopped) to a new file at `path`: a `dump_file_header`, a table with a
+// `dump_region` for each region, the region paths, and then the contents of each region at a page aligned offset.
+// Regions are split into `chunk_size` chunks which are copied on `threads` threads. Pages that are all zeros or
+// can't be read are left as holes, so the file is sparse.
+// Throws `std::system_error` if the memory map can't be read or the file can't be written. Exceptions from
+// `options.filter` and from the copying threads (e.g. `std::bad_alloc`) are rethrown once every thread has finished
+inline ::ptracewrap::dump_result dump_memory(::pid_t pid, const ::std::string& path, const ::ptracewrap::dump_options& options = ::ptracewrap::dump_options()) {
+    const ::std::size_t page = ::ptracewrap::detail::page_size();
+    ::ptracewrap::memory_map map(pid);
+
+    ::std::vector< ::ptracewrap::dump_region> table;
+    ::std::string strings;
+    for (const ::ptracewrap::memory_region& region : map.get_regions()) {
+        if ((region.permissions & options.permissions) != options.permissions) {
+            continue;
+        }
+        const ::std::string& region_path = map.get_path(region.path_id);
+        // [vsyscall] isn't a real mapping of the process, so process_vm_readv(2) can't read it
+        if (region_path == "[vsyscall]") {
+            continue;
+        }
+        if (options.filter && !options.filter(region, region_path)) {
+            continue;
+        }
+        ::ptracewrap::dump_region r;
+        ::std::memset(&r, 0, sizeof(r));
+        r.start = region.start;
+        r.end = region.end;
+        r.offset = region.offset;
+        r.permissions = region.permissions;
+        r.path_offset = static_cast< ::std::uint32_t>(strings.size());
+        r.path_size = static_cast< ::std::uint32_t>(region_path.size());
+        strings += region_path;
+        table.push_back(r);
+    }
+
+    ::ptracewrap::dump_file_header header;
+    ::std::memset(&header, 0, sizeof(header));
+    ::std::memcpy(header.magic, "PTWDUMP", 8);
+    header.version = ::ptracewrap::dump_file_header::current_version;
+    header.page_size = static_cast< ::std::uint32_t>(page);
+    header.region_count = table.size();
+    header.strings_offset = sizeof(header) + table.size() * sizeof(::ptracewrap::dump_region);
+    header.strings_size = strings.size();
+    header.data_offset = (header.strings_offset + strings.size() + page - 1) / page * page;
+    ::std::uint64_t file_size = header.data_offset;
+    for (::ptracewrap::dump_region& r : table) {
+        r.file_offset = file_size;
+        file_size += r.end - r.start;
+    }
+
+    struct chunk {
+        ::std::uintptr_t start;
+        ::std::size_t n;
+        ::std::uint64_t file_offset;
+    };
+    ::std::size_t chunk_size = ::std::max(options.chunk_size / page * page, page);
+    ::std::vector<chunk> chunks;
+    for (const ::ptracewrap::dump_region& r : table) {
+        for (::std::uintptr_t start = r.start; start < r.end; start += chunk_size) {
+            ::std::size_t n = static_cast< ::std::size_t>(::std::min< ::std::uint64_t>(chunk_size, r.end - start));
+            chunks.push_back(chunk{ start, n, r.file_offset + (start - r.start) });
+        }
+    }
+
+    // Everything that allocates is done before the file is opened, so it can't be left open by an exception
+    ::std::vector<char> index(static_cast< ::std::size_t>(header.data_offset));
+    ::std::memcpy(index.data(), &header, sizeof(header));
+    if (!table.empty()) {
+        ::std::memcpy(index.data() + sizeof(header), table.data(), table.size() * sizeof(::ptracewrap::dump_region));
+    }
+    ::std::memcpy(index.data() + header.strings_offset, strings.data(), strings.size());
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), path);
+    }
+    if (::ftruncate(fd, static_cast< ::off_t>(file_size)) == -1 || !::ptracewrap::detail::pwrite_all(fd, index.data(), index.size(), 0)) {
+        int errnum = errno;
+        ::close(fd);
+        throw ::std::system_error(::std::error_code(errnum, ::std::generic_category()), path);
+    }
+
+    unsigned threads = options.threads != 0 ? options.threads : ::std::thread::hardware_concurrency();
+    if (threads == 0) {
+        threads = 1;
+    }
+    if (threads > chunks.size()) {
+        threads = chunks.size() == 0 ? 1 : static_cast<unsigned>(chunks.size());
+    }
+
+    ::std::atomic< ::std::size_t> next(0);
+    ::std::atomic< ::std::uint64_t> zero(0);
+    ::std::atomic< ::std::uint64_t> failed(0);
+    ::std::atomic<int> write_error(0);
+    ::std::atomic<bool> stop(false);
+    ::std::mutex error_mutex;
+    ::std::exception_ptr error;
+    // Called in a catch block
+    auto fail = [&]() {
+        ::std::lock_guard< ::std::mutex> lock(error_mutex);
+        if (!error) {
+            error = ::std::current_exception();
+        }
+        stop.store(true, ::std::memory_order_relaxed);
+    };
+    auto copy_chunks = [&]() {
+        ::std::unique_ptr<char[]> buffer(new char[chunk_size]);
+        for (;;) {
+            ::std::size_t i = next.fetch_add(1, ::std::memory_order_relaxed);
+            if (i >= chunks.size() || write_error.load(::std::memory_order_relaxed) != 0 || stop.load(::std::memory_order_relaxed)) {
+                return;
+            }
+            const chunk& c = chunks[i];
+            ::std::size_t readable = 0;
+            ::ptracewrap::detail::scan_read(pid, c.start, buffer.get(), c.n, [&](::std::size_t offset, ::std::size_t length) {
+                readable += length;
+                // Write each run of non-zero pages
+                ::std::size_t run = offset;
+                for (::std::size_t p = offset; p < offset + length; p += page) {
+                    ::std::size_t n = ::std::min(page, offset + length - p);
+                    if (::ptracewrap::detail::is_zero(buffer.get() + p, n)) {
+                        if (run != p && !::ptracewrap::detail::pwrite_all(fd, buffer.get() + run, p - run, c.file_offset + run)) {
+                            write_error.store(errno, ::std::memory_order_relaxed);
+                        }
+                        zero.fetch_add(n, ::std::memory_order_relaxed);
+                        run = p + n;
+                    }
+                }
+                if (run != offset + length && !::ptracewrap::detail::pwrite_all(fd, buffer.get() + run, offset + length - run, c.file_offset + run)) {
+                    write_error.store(errno, ::std::memory_order_relaxed);
+                }
+            });
+            failed.fetch_add(c.n - readable, ::std::memory_order_relaxed);
+        }
+    };
+    auto work = [&]() {
+        try {
+            copy_chunks();
+        } catch (...) {
+            fail();
+        }
+    };
+
+    ::std::vector< ::std::thread> pool;
+    try {
+        for (unsigned t = 1; t < threads; ++t) {
+            pool.emplace_back(work);
+        }
+    } catch (...) {
+        fail();
+    }
+    work();
+    for (::std::thread& t : pool) {
+        t.join();
+    }
+    int errnum = write_error.load();
+    if (::close(fd) == -1 && errnum == 0) {
+        errnum = errno;
+    }
+    if (error) {
+        ::std::rethrow_exception(error);
+    }
+    if (errnum != 0) {
+        throw ::std::system_error(::std::error_code(errnum, ::std::generic_category()), path);
+    }
+
+    ::ptracewrap::dump_result result;
+    result.regions = table.size();
+    result.bytes_zero = zero.load();
+    result.bytes_failed = failed.load();
+    for (const ::ptracewrap::dump_region& r : table) {
+        result.bytes_written += r.end - r.start;
+    }
+    result.bytes_written -= result.bytes_zero + result.bytes_failed;
+    return result;
+}
+
+// Maps a dump file written by `dump_memory` read only. Throws `std::system_error` if it can't be opened or isn't a dump
+class dump_reader {
+public:
+    explicit dump_reader(const ::std::string& path) : m_map(nullptr), m_length(0) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), path);
+        }
+        struct ::stat st;
+        int errnum = 0;
+        if (::fstat(fd, &st) == -1) {
+            errnum = errno;
+        } else if (static_cast< ::std::size_t>(st.st_size) < sizeof(::ptracewrap::dump_file_header)) {
+            errnum = EINVAL;
+        } else {
+            m_length = static_cast< ::std::size_t>(st.st_size);
+            void* map = ::mmap(nullptr, m_length, PROT_READ, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED) {
+                errnum = errno;
+            } else {
+                m_map = static_cast<const char*>(map);
+            }
+        }
+        ::close(fd);
+        if (errnum == 0 && !valid()) {
+            errnum = EINVAL;
+        }
+        if (errnum != 0) {
+            if (m_map) {
+                ::munmap(const_cast<char*>(m_map), m_length);
+            }
+            throw ::std::system_error(::std::error_code(errnum, ::std::generic_category()), path);
+        }
+    }
+
+    dump_reader(const dump_reader&) = delete;
+    dump_reader& operator=(const dump_reader&) = delete;
+
+    ~dump_reader() {
+        ::munmap(const_cast<char*>(m_map), m_length);
+    }
+
+    const ::ptracewrap::dump_file_header& header() const noexcept {
+        return *reinterpret_cast<const ::ptracewrap::dump_file_header*>(m_map);
+    }
+
+    ::std::size_t size() const noexcept {
+        return static_cast< ::std::size_t>(header().region_count);
+    }
+
+    const ::ptracewrap::dump_region& region(::std::size_t i) const noexcept {
+        return reinterpret_cast<const ::ptracewrap::dump_region*>(m_map + sizeof(::ptracewrap::dump_file_header))[i];
+    }
+
+    ::std::string path(::std::size_t i) const {
+        const ::ptracewrap::dump_region& r = region(i);
+        return ::std::string(m_map + header().strings_offset + r.path_offset, r.path_size);
+    }
+
+    // The contents of region `i`
+    const char* data(::std::size_t i) const noexcept {
+        return m_map + region(i).file_offset;
+    }
+
+    // Where the byte at `address` in the dumped process is, or nullptr if it wasn't dumped
+    const char* find(::std::uintptr_t address) const noexcept {
+        ::std::size_t lo = 0;
+        ::std::size_t hi = size();
+        while (lo < hi) {
+            ::std::size_t mid = lo + (hi - lo) / 2;
+            const ::ptracewrap::dump_region& r = region(mid);
+            if (address < r.start) {
+                hi = mid;
+            } else if (address >= r.end) {
+                lo = mid + 1;
+            } else {
+                return data(mid) + (address - r.start);
+            }
+        }
+        return nullptr;
+    }
+private:
+    bool valid() const noexcept {
+        const ::ptracewrap::dump_file_header& h = header();
+        if (::std::memcmp(h.magic, "PTWDUMP", 8) != 0 || h.version != ::ptracewrap::dump_file_header::current_version) {
+            return false;
+        }
+        // Bounded before anything is multiplied by it or indexed with it, so a corrupt count can't overflow
+        if (h.region_count > (m_length - sizeof(h)) / sizeof(::ptracewrap::dump_region)) {
+            return false;
+        }
+        if (h.strings_offset != sizeof(h) + h.region_count * sizeof(::ptracewrap::dump_region) ||
+            h.strings_size > m_length - h.strings_offset) {
+            return false;
+        }
+        for (::std::size_t i = 0; i < size(); ++i) {
+            const ::ptracewrap::dump_region& r = region(i);
+            if (r.end < r.start || r.file_offset > m_length || r.end - r.start > m_length - r.file_offset ||
+                r.path_offset + static_cast< ::std::uint64_t>(r.path_size) > h.strings_size) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const char* m_map;
+    ::std::size_t m_length;
+};
+
+}
+
+#endif  // PTRACEWRAP_DUMP_HPP_
@@ -0,0 +1,326 @@
+#ifndef PTRACEWRAP_INJECT_HPP_
+#define PTRACEWRAP_INJECT_HPP_
+
+#include "../ptracewrap.hpp"
+
+#if !defined(__x86_64__) || defined(__ILP32__)
+#error "ptracewrap/inject.hpp only supports x86_64"
+#endif
+
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace ptracewrap {
+
+namespace detail {
+
+    // Times `remote_syscall` single steps the syscall instruction before giving up, if signal stops keep getting in the
+    // way of it running
+    constexpr int max_syscall_attempts = 64;
+
+    // The thread group (Process) of thread `tid`, from the `Tgid:` line of `/proc/<tid>/status`
+    inline ::pid_t thread_group_id(::pid_t tid) {
+        char path[40];
+        ::std::snprintf(path, sizeof(path), "/proc/%ld/status", static_cast<long>(tid));
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), path);
+        }
+        // Tgid is one of the first few lines
+        char text[1024];
+        ::ssize_t size;
+        while ((size = ::read(fd, text, sizeof(text) - 1)) == -1 && errno == EINTR) {}
+        int errnum = errno;
+        ::close(fd);
+        if (size == -1) {
+            throw ::std::system_error(::std::error_code(errnum, ::std::generic_category()), path);
+        }
+        text[size] = '\0';
+        const char* line = ::std::strstr(text, "\nTgid:");
+        if (!line) {
+            throw ::std::system_error(::std::error_code(EINVAL, ::std::generic_category()), path);
+        }
+        return static_cast< ::pid_t>(::std::strtol(line + 6, nullptr, 10));
+    }
+
+    // Single steps the tracee over the `syscall` instruction at `regs.rip`, with `regs`, and returns the result. Signals
+    // that arrive in the meantime are suppressed (And the step tried again if the instruction didn't run) and collected
+    // in `pending` to be sent again afterwards
+    inline long step_syscall(::ptracewrap::tracee& t, const ::ptracewrap::register_cache::regs_type& regs, ::std::vector<int>& pending) {
+        ::ptracewrap::register_cache& registers = t.registers();
+        for (int attempt = 0; attempt < ::ptracewrap::detail::max_syscall_attempts; ++attempt) {
+            registers.set_regs(regs);
+            t.singlestep();
+            int status;
+            ::pid_t result;
+            while ((result = ::waitpid(t.get_pid(), &status, __WALL)) == -1 && errno == EINTR) {}
+            if (result == -1) {
+                throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), "waitpid");
+            }
+            if (!WIFSTOPPED(status)) {
+                throw ::std::system_error(::std::error_code(ESRCH, ::std::generic_category()), "remote_syscall");
+            }
+            int signal = WSTOPSIG(status);
+            // A signal-delivery-stop, unless it is a ptrace event. Only the SIGTRAP of a finished step isn't a real signal
+            bool delivery = (status >> 16) == 0;
+            const ::ptracewrap::register_cache::regs_type& after = registers.get_regs();
+            if (after.rip == regs.rip + 2) {
+                if (delivery && signal != SIGTRAP) {
+                    pending.push_back(signal);
+                }
+                return static_cast<long>(after.rax);
+            }
+            if (delivery) {
+                pending.push_back(signal);
+            }
+        }
+        throw ::std::system_error(::std::error_code(EAGAIN, ::std::generic_category()), "remote_syscall: the syscall instruction never ran");
+    }
+
+}
+
+// Makes the stopped tracee run syscall `nr` with `args`, and returns its raw result (A negative errno on failure).
+// The syscall instruction is written over the code at the current instruction pointer and single stepped, and then
+// the code and every general purpose register are restored. Signals that arrive while stepping are sent again
+// afterwards. The tracee must not be at a syscall-stop, and must be the same architecture (x86_64) as the tracer
+inline long remote_syscall(::ptracewrap::tracee& t, long nr, long a0 = 0, long a1 = 0, long a2 = 0, long a3 = 0, long a4 = 0, long a5 = 0) {
+    ::ptracewrap::register_cache& registers = t.registers();
+    const ::ptracewrap::register_cache::regs_type saved = registers.get_regs();
+    void* pc = reinterpret_cast<void*>(saved.rip);
+
+    // `syscall`. The code is read and written past any memory overlay, so breakpoints at or after `pc` don't patch the
+    // instruction and are put back as they were
+    static const unsigned char syscall_instruction[2] = { 0x0f, 0x05 };
+    unsigned char code[sizeof(syscall_instruction)];
+    t.read_bytes_raw(pc, code, sizeof(code));
+    t.write_bytes_raw(pc, syscall_instruction, sizeof(code));
+
+    ::ptracewrap::register_cache::regs_type regs = saved;
+    regs.rax = static_cast<unsigned long long>(nr);
+    regs.rdi = static_cast<unsigned long long>(a0);
+    regs.rsi = static_cast<unsigned long long>(a1);
+    regs.rdx = static_cast<unsigned long long>(a2);
+    regs.r10 = static_cast<unsigned long long>(a3);
+    regs.r8 = static_cast<unsigned long long>(a4);
+    regs.r9 = static_cast<unsigned long long>(a5);
+    // Not in a syscall, so the kernel doesn't try to restart an interrupted one when the tracee is resumed
+    regs.orig_rax = static_cast<unsigned long long>(-1);
+
+    ::std::vector<int> pending;
+    long result;
+    try {
+        result = ::ptracewrap::detail::step_syscall(t, regs, pending);
+    } catch (...) {
+        t.write_bytes_raw(pc, code, sizeof(code), ::std::nothrow);
+        registers.set_regs(saved);
+        throw;
+    }
+    t.write_bytes_raw(pc, code, sizeof(code));
+    registers.set_regs(saved);
+    registers.flush();
+    if (!pending.empty()) {
+        // The tracee may be any thread of its process
+        ::pid_t tgid = ::ptracewrap::detail::thread_group_id(t.get_pid());
+        for (int signal : pending) {
+            if (::syscall(SYS_tgkill, tgid, t.get_pid(), signal) == -1) {
+                throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), "tgkill");
+            }
+        }
+    }
+    return result;
+}
+
+namespace detail {
+
+    inline long check_remote(long result, const char* what) {
+        if (result < 0 && result >= -4095) {
+            throw ::std::system_error(::std::error_code(static_cast<int>(-result), ::std::generic_category()), what);
+        }
+        return result;
+    }
+
+    // Restores bytes of the tracee's memory that were saved when it was constructed, with `restore()` or (Ignoring
+    // errors) when it is destroyed
+    class saved_remote_bytes {
+    public:
+        saved_remote_bytes(::ptracewrap::tracee& t, ::std::uintptr_t address, ::std::size_t n) :
+          m_tracee(t), m_address(reinterpret_cast<void*>(address)), m_saved(n), m_restored(false) {
+            m_tracee.read_bytes(m_address, m_saved.data(), n);
+        }
+
+        saved_remote_bytes(const saved_remote_bytes&) = delete;
+        saved_remote_bytes& operator=(const saved_remote_bytes&) = delete;
+
+        ~saved_remote_bytes() {
+            if (!m_restored) {
+                m_tracee.write_bytes(m_address, m_saved.data(), m_saved.size(), ::std::nothrow);
+            }
+        }
+
+        void restore() {
+            m_tracee.write_bytes(m_address, m_saved.data(), m_saved.size());
+            m_restored = true;
+        }
+    private:
+        ::ptracewrap::tracee& m_tracee;
+        void* m_address;
+        ::std::vector<char> m_saved;
+        bool m_restored;
+    };
+
+    // Closes a file descriptor in the tracee when it is destroyed, unless it was released
+    class remote_fd_closer {
+    public:
+        remote_fd_closer(::ptracewrap::tracee& t, long fd) noexcept : m_tracee(t), m_fd(fd) {}
+
+        remote_fd_closer(const remote_fd_closer&) = delete;
+        remote_fd_closer& operator=(const remote_fd_closer&) = delete;
+
+        ~remote_fd_closer() {
+            if (m_fd != -1) {
+                try {
+                    ::ptracewrap::remote_syscall(m_tracee, SYS_close, m_fd);
+                } catch (...) {}
+            }
+        }
+
+        long release() noexcept {
+            long fd = m_fd;
+            m_fd = -1;
+            return fd;
+        }
+    private:
+        ::ptracewrap::tracee& m_tracee;
+        long m_fd;
+    };
+
+}
+
+// A memfd mapped both in a tracee and in this process. Created by injecting memfd_create, ftruncate, mmap and close
+// into the (stopped) tracee. It is registered as a local mapping of the `tracee` it was created with, so `read` /
+// `write` through that handle inside the mapping are plain loads and stores, with no syscalls.
+// Destroying it doesn't unmap anything from the tracee, and the local mapping stays while the `tracee` still holds
+// it. Use `unmap(tracee&)` to remove it from both
+class shared_mapping {
+public:
+    static shared_mapping create(::ptracewrap::tracee& t, ::std::size_t size, const char* name = "ptracewrap") {
+        const ::std::size_t page = ::ptracewrap::detail::page_size();
+        size = (size + page - 1) / page * page;
+
+        // The name goes on the tracee's stack, below the red zone
+        ::std::size_t name_size = ::std::strlen(name) + 1;
+        ::std::uintptr_t sp = static_cast< ::std::uintptr_t>(t.registers().get_regs().rsp);
+        ::std::uintptr_t name_address = (sp - 128 - name_size) & ~::std::uintptr_t(15);
+        ::ptracewrap::detail::saved_remote_bytes saved_stack(t, name_address, name_size);
+        t.write_bytes(reinterpret_cast<void*>(name_address), name, name_size);
+        long fd = ::ptracewrap::detail::check_remote(::ptracewrap::remote_syscall(t, SYS_memfd_create, static_cast<long>(name_address), MFD_CLOEXEC), "remote memfd_create");
+        // Closed if anything after this fails
+        ::ptracewrap::detail::remote_fd_closer closer(t, fd);
+        saved_stack.restore();
+
+        shared_mapping mapping;
+        mapping.m_size = size;
+        ::ptracewrap::detail::check_remote(::ptracewrap::remote_syscall(t, SYS_ftruncate, fd, static_cast<long>(size)), "remote ftruncate");
+
+        ::std::string path = "/proc/" + ::std::to_string(t.get_pid()) + "/fd/" + ::std::to_string(fd);
+        int local_fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (local_fd == -1) {
+            throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), path);
+        }
+        void* local = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, local_fd, 0);
+        int errnum = errno;
+        ::close(local_fd);
+        if (local == MAP_FAILED) {
+            throw ::std::system_error(::std::error_code(errnum, ::std::generic_category()), path);
+        }
+        mapping.m_local.reset(static_cast<char*>(local), [size](char* p) { ::munmap(p, size); });
+
+        long remote = ::ptracewrap::remote_syscall(t, SYS_mmap, 0, static_cast<long>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        mapping.m_remote = static_cast< ::std::uintptr_t>(::ptracewrap::detail::check_remote(remote, "remote mmap"));
+        ::ptracewrap::remote_syscall(t, SYS_close, closer.release());
+        if (::ptracewrap::memory_map* map = t.get_memory_map()) {
+            map->on_mmap(reinterpret_cast<void*>(mapping.m_remote), size, ::ptracewrap::memory_region::read | ::ptracewrap::memory_region::write | ::ptracewrap::memory_region::shared);
+        }
+        t.add_local_mapping(mapping.m_remote, size, mapping.m_local);
+        return mapping;
+    }
+
+    shared_mapping() noexcept : m_remote(0), m_size(0) {}
+
+    shared_mapping(shared_mapping&& other) noexcept : m_local(::std::move(other.m_local)), m_remote(other.m_remote), m_size(other.m_size) {
+        other.m_remote = 0;
+        other.m_size = 0;
+    }
+
+    shared_mapping& operator=(shared_mapping&& other) noexcept {
+        if (this != &other) {
+            m_local = ::std::move(other.m_local);
+            m_remote = other.m_remote;
+            m_size = other.m_size;
+            other.m_remote = 0;
+            other.m_size = 0;
+        }
+        return *this;
+    }
+
+    ::std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    // The mapping in this process
+    void* get_local() const noexcept {
+        return m_local.get();
+    }
+
+    // The address of the mapping in the tracee
+    ::std::uintptr_t get_remote() const noexcept {
+        return m_remote;
+    }
+
+    bool contains(const volatile void* remote, ::std::size_t n = 1) const noexcept {
+        ::std::uintptr_t address = reinterpret_cast< ::std::uintptr_t>(remote);
+        return m_local && address >= m_remote && n <= m_size && address - m_remote <= m_size - n;
+    }
+
+    // The local address of `remote`, which must be in the mapping
+    void* local(const volatile void* remote) const noexcept {
+        return m_local.get() + (reinterpret_cast< ::std::uintptr_t>(remote) - m_remote);
+    }
+
+    // Unmaps the memory in the tracee (Which must be stopped) and here, and removes it from `t`'s local mappings
+    void unmap(::ptracewrap::tracee& t) {
+        if (!m_local) {
+            return;
+        }
+        t.remove_local_mapping(m_remote);
+        ::ptracewrap::detail::check_remote(::ptracewrap::remote_syscall(t, SYS_munmap, static_cast<long>(m_remote), static_cast<long>(m_size)), "remote munmap");
+        if (::ptracewrap::memory_map* map = t.get_memory_map()) {
+            map->on_munmap(reinterpret_cast<void*>(m_remote), m_size);
+        }
+        m_local.reset();
+        m_remote = 0;
+        m_size = 0;
+    }
+private:
+    ::std::shared_ptr<char> m_local;
+    ::std::uintptr_t m_remote;
+    ::std::size_t m_size;
+};
+}
+
+#endif  // PTRACEWRAP_INJECT_HPP_
@@ -0,0 +1,494 @@
+#ifndef PTRACEWRAP_PROFILER_HPP_
+#define PTRACEWRAP_PROFILER_HPP_
+
+#include "../ptracewrap.hpp"
+
+#if !defined(__x86_64__) && !defined(__aarch64__)
+#error "ptracewrap/profiler.hpp only supports x86_64 and aarch64"
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+
+namespace ptracewrap {
+
+struct profiler_options {
+    // Samples per second of each thread
+    unsigned frequency = 99;
+    // Return addresses to follow through frame pointers after the PC (0 for only the PC)
+    ::std::size_t max_depth = 32;
+    // Bytes of stack read at once for the frame pointer walk
+    ::std::size_t stack_window = 16 * 1024;
+    // Distinct stacks kept per thread (Rounded up to a power of 2). Samples of more stacks are counted as dropped
+    ::std::size_t histogram_capacity = 4096;
+};
+
+// Counts of distinct stacks for one thread. Only one thread adds samples, but `for_each` can be called from any
+// thread at the same time without locking
+class sample_histogram {
+public:
+    sample_histogram(::std::size_t capacity, ::std::size_t max_frames) :
+      m_mask(round_up(capacity) - 1), m_max_frames(max_frames), m_slots(new slot[m_mask + 1]),
+      m_frames(new ::std::uintptr_t[(m_mask + 1) * max_frames]), m_used(0), m_dropped(0) {}
+
+    // Adds one sample of `frames` (Innermost first). Returns false if the histogram is full
+    bool add(const ::std::uintptr_t* frames, ::std::size_t depth) noexcept {
+        if (depth > m_max_frames) {
+            depth = m_max_frames;
+        }
+        ::std::uint64_t hash = hash_frames(frames, depth);
+        for (::std::size_t i = static_cast< ::std::size_t>(hash) & m_mask;; i = (i + 1) & m_mask) {
+            slot& s = m_slots[i];
+            ::std::uint64_t key = s.hash.load(::std::memory_order_relaxed);
+            if (key == hash && s.depth == depth && ::std::memcmp(frames_of(i), frames, depth * sizeof(*frames)) == 0) {
+                s.count.fetch_add(1, ::std::memory_order_relaxed);
+                return true;
+            }
+            if (key == 0) {
+                // Keep a quarter of the slots free so probes stay short
+                if (m_used >= (m_mask + 1) - (m_mask + 1) / 4) {
+                    m_dropped.fetch_add(1, ::std::memory_order_relaxed);
+                    return false;
+                }
+                ::std::memcpy(frames_of(i), frames, depth * sizeof(*frames));
+                s.depth = depth;
+                s.count.store(1, ::std::memory_order_relaxed);
+                s.hash.store(hash, ::std::memory_order_release);
+                ++m_used;
+                return true;
+            }
+        }
+    }
+
+    // Calls `f(const std::uintptr_t* frames, std::size_t depth, std::uint64_t count)` for each stack
+    template<class F>
+    void for_each(F&& f) const {
+        for (::std::size_t i = 0; i <= m_mask; ++i) {
+            const slot& s = m_slots[i];
+            if (s.hash.load(::std::memory_order_acquire) != 0) {
+                f(static_cast<const ::std::uintptr_t*>(frames_of(i)), s.depth, s.count.load(::std::memory_order_relaxed));
+            }
+        }
+    }
+
+    ::std::uint64_t get_dropped() const noexcept {
+        return m_dropped.load(::std::memory_order_relaxed);
+    }
+private:
+    struct slot {
+        slot() noexcept : hash(0), count(0), depth(0) {}
+
+        // 0 for an empty slot
+        ::std::atomic< ::std::uint64_t> hash;
+        ::std::atomic< ::std::uint64_t> count;
+        ::std::size_t depth;
+    };
+
+    static ::std::size_t round_up(::std::size_t n) noexcept {
+        ::std::size_t result = 16;
+        while (result < n) {
+            result *= 2;
+        }
+        return result;
+    }
+
+    static ::std::uint64_t hash_frames(const ::std::uintptr_t* frames, ::std::size_t depth) noexcept {
+        ::std::uint64_t h = 0xcbf29ce484222325u ^ depth;
+        for (::std::size_t i = 0; i < depth; ++i) {
+            h = (h ^ frames[i]) * 0x9e3779b97f4a7c15u;
+            h ^= h >> 31;
+        }
+        return h == 0 ? 1 : h;
+    }
+
+    ::std::uintptr_t* frames_of(::std::size_t i) const noexcept {
+        return m_frames.get() + i * m_max_frames;
+    }
+
+    const ::std::size_t m_mask;
+    const ::std::size_t m_max_frames;
+    ::std::unique_ptr<slot[]> m_slots;
+    ::std::unique_ptr< ::std::uintptr_t[]> m_frames;
+    ::std::size_t m_used;
+    ::std::atomic< ::std::uint64_t> m_dropped;
+};
+
+// A sampling profiler that doesn't need perf events. Every thread of a process is seized (New threads are followed
+// through PTRACE_O_TRACECLONE), and `frequency` times a second all of them are PTRACE_INTERRUPTed, their PC (And with
+// `max_depth`, return addresses from walking the frame pointers) recorded and resumed straight away.
+//
+// `run` must be called on the thread that will be the tracer. Profiles can be read while it is running
+class sampling_profiler {
+public:
+    explicit sampling_profiler(::pid_t pid, const ::ptracewrap::profiler_options& options = ::ptracewrap::profiler_options()) :
+      m_pid(pid), m_options(options), m_stop(false), m_samples(0) {
+        if (m_options.frequency == 0) {
+            m_options.frequency = 1;
+        }
+        m_frames.resize(m_options.max_depth + 1);
+    }
+
+    sampling_profiler(const sampling_profiler&) = delete;
+    sampling_profiler& operator=(const sampling_profiler&) = delete;
+
+    ::pid_t get_pid() const noexcept {
+        return m_pid;
+    }
+
+    // Seizes every thread and samples them until `duration` has passed, `stop()` is called or the process exits.
+    // The threads are detached afterwards. Throws a `ptrace_error` if the process can't be seized
+    void run(::std::chrono::nanoseconds duration) {
+        ::sigset_t chld;
+        ::sigset_t previous;
+        sigemptyset(&chld);
+        sigaddset(&chld, SIGCHLD);
+        ::pthread_sigmask(SIG_BLOCK, &chld, &previous);
+        try {
+            seize_all();
+            loop(duration);
+        } catch (...) {
+            detach_all();
+            ::pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+            throw;
+        }
+        detach_all();
+        ::pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    }
+
+    // Makes `run` return at the next sample. Can be called from any thread
+    void stop() noexcept {
+        m_stop.store(true, ::std::memory_order_relaxed);
+    }
+
+    ::std::uint64_t get_sample_count() const noexcept {
+        return m_samples.load(::std::memory_order_relaxed);
+    }
+
+    // Calls `f(pid_t tid, const sample_histogram&)` for every thread that has been sampled
+    template<class F>
+    void for_each_thread(F&& f) const {
+        ::std::lock_guard< ::std::mutex> lock(m_histograms_mutex);
+        for (const ::std::pair< ::pid_t, ::std::unique_ptr< ::ptracewrap::sample_histogram> >& h : m_histograms) {
+            f(h.first, static_cast<const ::ptracewrap::sample_histogram&>(*h.second));
+        }
+    }
+
+    // The profile in the "folded stacks" format used by flame graph tools: a line per stack with its frames as hex
+    // addresses from the outermost in, separated by `;`, then a space and the count. With `per_thread`, each stack
+    // starts with a `tid-<tid>` frame, and otherwise the same stacks of different threads are added together
+    ::std::string folded(bool per_thread = false) const {
+        ::std::unordered_map< ::std::string, ::std::uint64_t> totals;
+        ::std::vector< ::std::string> order;
+        for_each_thread([&](::pid_t tid, const ::ptracewrap::sample_histogram& histogram) {
+            histogram.for_each([&](const ::std::uintptr_t* frames, ::std::size_t depth, ::std::uint64_t count) {
+                ::std::string line;
+                if (per_thread) {
+                    line = "tid-" + ::std::to_string(tid);
+                }
+                char buffer[2 + sizeof(::std::uintptr_t) * 2 + 1];
+                for (::std::size_t i = depth; i-- != 0;) {
+                    ::std::snprintf(buffer, sizeof(buffer), "0x%llx", static_cast<unsigned long long>(frames[i]));
+                    if (!line.empty()) {
+                        line += ';';
+                    }
+                    line += buffer;
+                }
+                ::std::uint64_t& total = totals[line];
+                if (total == 0) {
+                    order.push_back(line);
+                }
+                total += count;
+            });
+        });
+        ::std::string result;
+        for (const ::std::string& line : order) {
+            result += line;
+            result += ' ';
+            result += ::std::to_string(totals[line]);
+            result += '\n';
+        }
+        return result;
+    }
+private:
+    struct thread_state {
+        bool interrupted;
+        ::ptracewrap::sample_histogram* histogram;
+    };
+
+    void seize_all() {
+        const unsigned long options = PTRACE_O_TRACECLONE;
+        // Threads can be created while the list is being read, so read it until no new threads are found
+        bool found = true;
+        while (found) {
+            found = false;
+            ::std::string path = "/proc/" + ::std::to_string(m_pid) + "/task";
+            ::DIR* dir = ::opendir(path.c_str());
+            if (dir == nullptr) {
+                throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), path);
+            }
+            while (::dirent* entry = ::readdir(dir)) {
+                char* end;
+                long tid = ::std::strtol(entry->d_name, &end, 10);
+                if (*end != '\0' || tid <= 0 || m_threads.count(static_cast< ::pid_t>(tid)) != 0) {
+                    continue;
+                }
+                errno = 0;
+                if (::ptracewrap::ptrace(PTRACE_SEIZE, static_cast< ::pid_t>(tid), nullptr, reinterpret_cast<void*>(options)) == -1 && errno != 0) {
+                    // The thread already exited
+                    if (errno == ESRCH) {
+                        continue;
+                    }
+                    int errnum = errno;
+                    ::closedir(dir);
+                    throw ::ptracewrap::ptrace_error(errnum, PTRACE_SEIZE, static_cast< ::pid_t>(tid), nullptr, reinterpret_cast<void*>(options));
+                }
+                add_thread(static_cast< ::pid_t>(tid));
+                found = true;
+            }
+            ::closedir(dir);
+        }
+    }
+
+    thread_state& add_thread(::pid_t tid) {
+        thread_state& state = m_threads[tid];
+        if (state.histogram == nullptr) {
+            ::std::lock_guard< ::std::mutex> lock(m_histograms_mutex);
+            for (::std::pair< ::pid_t, ::std::unique_ptr< ::ptracewrap::sample_histogram> >& h : m_histograms) {
+                if (h.first == tid) {
+                    state.histogram = h.second.get();
+                }
+            }
+            if (state.histogram == nullptr) {
+                m_histograms.emplace_back(tid, ::std::unique_ptr< ::ptracewrap::sample_histogram>(
+                    new ::ptracewrap::sample_histogram(m_options.histogram_capacity, m_options.max_depth + 1)));
+                state.histogram = m_histograms.back().second.get();
+            }
+        }
+        return state;
+    }
+
+    // Each thread has to be stopped to be detached. Threads that don't stop within a second are left to be detached
+    // when this thread exits
+    void detach_all() noexcept {
+        ::std::size_t pending = 0;
+        for (::std::pair<const ::pid_t, thread_state>& t : m_threads) {
+            t.second.interrupted = ::ptracewrap::ptrace(PTRACE_INTERRUPT, t.first, nullptr, nullptr) == 0;
+            pending += t.second.interrupted;
+        }
+        ::std::chrono::steady_clock::time_point deadline = ::std::chrono::steady_clock::now() + ::std::chrono::seconds(1);
+        while (pending != 0) {
+            int status;
+            ::pid_t tid = wait(&status);
+            if (tid > 0) {
+                // Includes new threads that haven't been seen yet
+                if (WIFSTOPPED(status)) {
+                    int signal = (status >> 16) == 0 ? WSTOPSIG(status) : 0;
+                    ::ptracewrap::ptrace(PTRACE_DETACH, tid, nullptr, reinterpret_cast<void*>(static_cast<long>(signal)));
+                }
+                ::std::unordered_map< ::pid_t, thread_state>::iterator it = m_threads.find(tid);
+                if (it != m_threads.end()) {
+                    pending -= it->second.interrupted;
+                    m_threads.erase(it);
+                }
+                continue;
+            }
+            if (tid == -1 || !wait_for_child(deadline)) {
+                break;
+            }
+        }
+        m_threads.clear();
+    }
+
+    void loop(::std::chrono::nanoseconds duration) {
+        ::std::chrono::steady_clock::time_point next = ::std::chrono::steady_clock::now();
+        ::std::chrono::steady_clock::time_point deadline = next + duration;
+        while (!m_threads.empty() && !m_stop.load(::std::memory_order_relaxed) && next < deadline) {
+            next += period();
+            // Handle events (New threads, signals) while waiting for the next sample
+            do {
+                handle_events();
+            } while (wait_for_child(next));
+            sample();
+        }
+    }
+
+    // Interrupts every thread, and records each one as it stops. Threads that haven't stopped within a period (e.g.
+    // an exited thread group leader) are recorded whenever they do stop
+    void sample() {
+        ::std::size_t pending = 0;
+        for (::std::pair<const ::pid_t, thread_state>& t : m_threads) {
+            if (!t.second.interrupted && ::ptracewrap::ptrace(PTRACE_INTERRUPT, t.first, nullptr, nullptr) == 0) {
+                t.second.interrupted = true;
+                ++pending;
+            }
+        }
+        ::std::chrono::steady_clock::time_point deadline = ::std::chrono::steady_clock::now() + period();
+        while (pending != 0) {
+            int status;
+            ::pid_t tid = wait(&status);
+            if (tid > 0) {
+                if (handle(tid, status)) {
+                    --pending;
+                }
+                continue;
+            }
+            if (tid == -1 || !wait_for_child(deadline)) {
+                return;
+            }
+        }
+    }
+
+    void handle_events() {
+        int status;
+        ::pid_t tid;
+        while ((tid = wait(&status)) > 0) {
+            handle(tid, status);
+        }
+    }
+
+    // Only this thread's tracees, without blocking
+    static ::pid_t wait(int* status) noexcept {
+        ::pid_t tid;
+        while ((tid = ::waitpid(-1, status, __WALL | __WNOTHREAD | WNOHANG)) == -1 && errno == EINTR) {}
+        return tid;
+    }
+
+    // Waits for a SIGCHLD (Which is blocked). Returns false if `deadline` passed first
+    static bool wait_for_child(::std::chrono::steady_clock::time_point deadline) noexcept {
+        ::std::chrono::steady_clock::duration remaining = deadline - ::std::chrono::steady_clock::now();
+        if (remaining <= ::std::chrono::steady_clock::duration::zero()) {
+            return false;
+        }
+        long long ns = ::std::chrono::duration_cast< ::std::chrono::nanoseconds>(remaining).count();
+        ::sigset_t chld;
+        sigemptyset(&chld);
+        sigaddset(&chld, SIGCHLD);
+        ::timespec timeout = { static_cast< ::time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000) };
+        ::sigtimedwait(&chld, nullptr, &timeout);
+        return true;
+    }
+
+    ::std::chrono::nanoseconds period() const noexcept {
+        return ::std::chrono::nanoseconds(1000000000L / static_cast<long>(m_options.frequency));
+    }
+
+    // Returns true if this was the stop for a pending interrupt (Or the thread is gone)
+    bool handle(::pid_t tid, int status) {
+        ::std::unordered_map< ::pid_t, thread_state>::iterator it = m_threads.find(tid);
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            bool was_pending = it != m_threads.end() && it->second.interrupted;
+            if (it != m_threads.end()) {
+                m_threads.erase(it);
+            }
+            return was_pending;
+        }
+        thread_state& state = it != m_threads.end() ? it->second : add_thread(tid);
+        int signal = WSTOPSIG(status);
+        int event = (status >> 16) & 0xff;
+        void* resume_signal = nullptr;
+        ::__ptrace_request resume = PTRACE_CONT;
+        bool answered = false;
+        if (event == PTRACE_EVENT_STOP) {
+            if (signal == SIGSTOP || signal == SIGTSTP || signal == SIGTTIN || signal == SIGTTOU) {
+                // Group-stop: stays stopped until SIGCONT
+                resume = PTRACE_LISTEN;
+            } else if (state.interrupted) {
+                record(tid, state);
+            }
+            answered = state.interrupted;
+            state.interrupted = false;
+        } else if (event == 0) {
+            resume_signal = reinterpret_cast<void*>(static_cast<long>(signal));
+        }
+        ::ptracewrap::ptrace(resume, tid, nullptr, resume_signal);
+        return answered;
+    }
+
+    void record(::pid_t tid, thread_state& state) {
+        ::ptracewrap::register_cache registers(tid);
+        ::ptracewrap::register_cache::regs_type regs;
+        try {
+            regs = registers.get_regs();
+        } catch (const ::ptracewrap::ptrace_error&) {
+            return;
+        }
+#if defined(__x86_64__)
+        ::std::uintptr_t pc = regs.rip;
+        ::std::uintptr_t sp = regs.rsp;
+        ::std::uintptr_t fp = regs.rbp;
+#else
+        ::std::uintptr_t pc = regs.pc;
+        ::std::uintptr_t sp = regs.sp;
+        ::std::uintptr_t fp = regs.regs[29];
+#endif
+        m_frames[0] = pc;
+        ::std::size_t depth = 1 + walk(tid, sp, fp, m_frames.data() + 1, m_options.max_depth);
+        state.histogram->add(m_frames.data(), depth);
+        m_samples.fetch_add(1, ::std::memory_order_relaxed);
+    }
+
+    // Follows the frame pointer chain (Each frame starts with the caller's frame pointer and the return address),
+    // reading `stack_window` bytes of stack at a time. Returns the number of return addresses found
+    ::std::size_t walk(::pid_t tid, ::std::uintptr_t sp, ::std::uintptr_t fp, ::std::uintptr_t* out, ::std::size_t max_depth) {
+        const ::std::size_t window = m_options.stack_window < 2 * sizeof(::std::uintptr_t) ? 2 * sizeof(::std::uintptr_t) : m_options.stack_window;
+        m_stack.resize(window);
+        ::std::uintptr_t base = 0;
+        ::std::size_t valid = 0;
+        ::std::size_t depth = 0;
+        while (depth < max_depth && fp >= sp && fp % sizeof(::std::uintptr_t) == 0) {
+            if (fp < base || fp + 2 * sizeof(::std::uintptr_t) > base + valid) {
+                base = fp;
+                valid = ::ptracewrap::detail::process_vm_transfer(false, tid, reinterpret_cast<void*>(base), m_stack.data(), window);
+                if (valid < 2 * sizeof(::std::uintptr_t)) {
+                    break;
+                }
+            }
+            ::std::uintptr_t frame[2];
+            ::std::memcpy(frame, m_stack.data() + (fp - base), sizeof(frame));
+            if (frame[1] == 0) {
+                break;
+            }
+            out[depth++] = frame[1];
+            // The stack grows down, so callers' frames are at higher addresses
+            if (frame[0] <= fp) {
+                break;
+            }
+            fp = frame[0];
+        }
+        return depth;
+    }
+
+    ::pid_t m_pid;
+    ::ptracewrap::profiler_options m_options;
+    ::std::atomic<bool> m_stop;
+    ::std::atomic< ::std::uint64_t> m_samples;
+    // Only used by the thread in `run`
+    ::std::unordered_map< ::pid_t, thread_state> m_threads;
+    ::std::vector< ::std::uintptr_t> m_frames;
+    ::std::vector<char> m_stack;
+    // Kept after threads exit. Only changed when a new thread is found
+    mutable ::std::mutex m_histograms_mutex;
+    ::std::vector< ::std::pair< ::pid_t, ::std::unique_ptr< ::ptracewrap::sample_histogram> > > m_histograms;
+};
+
+}
+
+#endif  // PTRACEWRAP_PROFILER_HPP_
@@ -0,0 +1,334 @@
+#ifndef PTRACEWRAP_REMOTE_STRUCT_HPP_
+#define PTRACEWRAP_REMOTE_STRUCT_HPP_
+
+#include "../ptracewrap.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ptracewrap {
+
+// Specialise for each local type `T` that mirrors a struct in the tracee:
+//
+//     template<> struct ptracewrap::remote_layout<my_node> {
+//         static constexpr std::size_t size = 24;  // sizeof the struct in the tracee
+//         typedef ptracewrap::remote_fields<
+//             PTRACEWRAP_REMOTE_FIELD(my_node, value, 0),
+//             PTRACEWRAP_REMOTE_POINTER(my_node, next, 8, my_node)
+//         > fields;
+//     };
+template<class T>
+struct remote_layout;
+
+// Copies `sizeof(M)` bytes at `Offset` in the remote struct to `member`
+template< ::std::size_t Offset, class T, class M, M T::*Member>
+struct remote_field {
+    static_assert(::std::is_trivially_copyable<M>::value, "remote_field members must be trivially copyable");
+
+    static constexpr ::std::size_t end = Offset + sizeof(M);
+
+    static void extract(const char* raw, T& to) noexcept {
+        ::std::memcpy(::std::addressof(to.*Member), raw + Offset, sizeof(M));
+    }
+
+    template<class Visitor>
+    static void visit(const T&, Visitor&) noexcept {}
+};
+
+// A pointer to a `Target` (Which also has a `remote_layout`), kept in `member` (A `std::uintptr_t` or any other pointer
+// sized type) as the address in the tracee
+template< ::std::size_t Offset, class T, class M, M T::*Member, class Target>
+struct remote_pointer {
+    static_assert(sizeof(M) == sizeof(::std::uintptr_t) && ::std::is_trivially_copyable<M>::value, "remote_pointer members must be pointer sized");
+
+    static constexpr ::std::size_t end = Offset + sizeof(M);
+
+    static void extract(const char* raw, T& to) noexcept {
+        ::std::memcpy(::std::addressof(to.*Member), raw + Offset, sizeof(M));
+    }
+
+    template<class Visitor>
+    static void visit(const T& from, Visitor& visitor) {
+        ::std::uintptr_t address;
+        ::std::memcpy(&address, ::std::addressof(from.*Member), sizeof(address));
+        visitor.template follow<Target>(address);
+    }
+};
+
+// A fixed size array of pointers to `Target`s (e.g. the buckets of a hash table), kept in `member` (An array of
+// `std::uintptr_t`, or of any other pointer sized type)
+template< ::std::size_t Offset, class T, class M, M T::*Member, class Target>
+struct remote_pointer_array {
+    static_assert(::std::is_array<M>::value && sizeof(typename ::std::remove_extent<M>::type) == sizeof(::std::uintptr_t), "remote_pointer_array members must be arrays of pointer sized elements");
+
+    static constexpr ::std::size_t end = Offset + sizeof(M);
+
+    static void extract(const char* raw, T& to) noexcept {
+        ::std::memcpy(::std::addressof(to.*Member), raw + Offset, sizeof(M));
+    }
+
+    template<class Visitor>
+    static void visit(const T& from, Visitor& visitor) {
+        const char* elements = reinterpret_cast<const char*>(::std::addressof(from.*Member));
+        for (::std::size_t i = 0; i < ::std::extent<M>::value; ++i) {
+            ::std::uintptr_t address;
+            ::std::memcpy(&address, elements + i * sizeof(address), sizeof(address));
+            visitor.template follow<Target>(address);
+        }
+    }
+};
+
+#define PTRACEWRAP_REMOTE_FIELD(type, member, offset) \
+    ::ptracewrap::remote_field<(offset), type, decltype(type::member), &type::member>
+#define PTRACEWRAP_REMOTE_POINTER(type, member, offset, target) \
+    ::ptracewrap::remote_pointer<(offset), type, decltype(type::member), &type::member, target>
+#define PTRACEWRAP_REMOTE_POINTER_ARRAY(type, member, offset, target) \
+    ::ptracewrap::remote_pointer_array<(offset), type, decltype(type::member), &type::member, target>
+
+template<class... Fields>
+struct remote_fields;
+
+template<>
+struct remote_fields<> {
+    static constexpr ::std::size_t end = 0;
+
+    template<class T>
+    static void extract(const char*, T&) noexcept {}
+
+    template<class T, class Visitor>
+    static void visit(const T&, Visitor&) {}
+};
+
+// Every field is extracted and visited with its offset as a constant, so this compiles to a fixed sequence of copies
+template<class Field, class... Rest>
+struct remote_fields<Field, Rest...> {
+    static constexpr ::std::size_t end = Field::end > remote_fields<Rest...>::end ? Field::end : remote_fields<Rest...>::end;
+
+    template<class T>
+    static void extract(const char* raw, T& to) noexcept {
+        Field::extract(raw, to);
+        remote_fields<Rest...>::extract(raw, to);
+    }
+
+    template<class T, class Visitor>
+    static void visit(const T& from, Visitor& visitor) {
+        Field::visit(from, visitor);
+        remote_fields<Rest...>::visit(from, visitor);
+    }
+};
+
+namespace detail {
+
+    struct remote_table_base {
+        virtual ~remote_table_base() = default;
+    };
+
+    template<class T>
+    struct remote_table : remote_table_base {
+        ::std::unordered_map< ::std::uintptr_t, T> nodes;
+    };
+
+    // A distinct address for each type, to key the tables by
+    template<class T>
+    struct remote_type_id {
+        static const char id;
+    };
+
+    template<class T>
+    const char remote_type_id<T>::id = 0;
+
+}
+
+class remote_graph;
+
+namespace detail {
+
+    struct remote_visitor;
+
+}
+
+template<class Root>
+::ptracewrap::remote_graph read_graph(::pid_t pid, ::std::uintptr_t root, ::std::size_t max_nodes = ::std::size_t(1) << 20);
+
+// The nodes read by `read_graph`, by type and remote address
+class remote_graph {
+public:
+    // nullptr if no `T` at `address` was read
+    template<class T>
+    const T* get(::std::uintptr_t address) const {
+        const ::ptracewrap::detail::remote_table<T>* t = table<T>();
+        if (t == nullptr) {
+            return nullptr;
+        }
+        typename ::std::unordered_map< ::std::uintptr_t, T>::const_iterator it = t->nodes.find(address);
+        return it == t->nodes.end() ? nullptr : &it->second;
+    }
+
+    template<class T>
+    ::std::size_t count() const {
+        const ::ptracewrap::detail::remote_table<T>* t = table<T>();
+        return t == nullptr ? 0 : t->nodes.size();
+    }
+
+    // Calls `f(std::uintptr_t address, const T& node)` for every `T` that was read
+    template<class T, class F>
+    void for_each(F&& f) const {
+        if (const ::ptracewrap::detail::remote_table<T>* t = table<T>()) {
+            for (const ::std::pair<const ::std::uintptr_t, T>& node : t->nodes) {
+                f(node.first, node.second);
+            }
+        }
+    }
+
+    ::std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    // Addresses that were pointed to but couldn't be read
+    const ::std::vector< ::std::uintptr_t>& get_failed() const noexcept {
+        return m_failed;
+    }
+
+    // Number of levels of pointers that were followed (Each read with one `read_batch`)
+    ::std::size_t get_levels() const noexcept {
+        return m_levels;
+    }
+private:
+    template<class Root>
+    friend ::ptracewrap::remote_graph read_graph(::pid_t pid, ::std::uintptr_t root, ::std::size_t max_nodes);
+    friend struct ::ptracewrap::detail::remote_visitor;
+
+    template<class T>
+    const ::ptracewrap::detail::remote_table<T>* table() const {
+        ::std::unordered_map<const void*, ::std::unique_ptr< ::ptracewrap::detail::remote_table_base> >::const_iterator it =
+            m_tables.find(&::ptracewrap::detail::remote_type_id<T>::id);
+        return it == m_tables.end() ? nullptr : static_cast<const ::ptracewrap::detail::remote_table<T>*>(it->second.get());
+    }
+
+    template<class T>
+    ::ptracewrap::detail::remote_table<T>& table() {
+        ::std::unique_ptr< ::ptracewrap::detail::remote_table_base>& t = m_tables[&::ptracewrap::detail::remote_type_id<T>::id];
+        if (!t) {
+            t.reset(new ::ptracewrap::detail::remote_table<T>());
+        }
+        return static_cast< ::ptracewrap::detail::remote_table<T>&>(*t);
+    }
+
+    ::std::unordered_map<const void*, ::std::unique_ptr< ::ptracewrap::detail::remote_table_base> > m_tables;
+    ::std::vector< ::std::uintptr_t> m_failed;
+    ::std::size_t m_size = 0;
+    ::std::size_t m_levels = 0;
+};
+
+namespace detail {
+
+    // One node to read at the next level
+    struct remote_pending {
+        ::std::uintptr_t address;
+        ::std::size_t size;
+        ::std::size_t buffer_offset;
+        // Extracts the fields and queues the nodes it points to
+        void (*decode)(::ptracewrap::remote_graph&, ::std::uintptr_t, const char*, void*);
+        // Removes the slot of a node that couldn't be read
+        void (*discard)(::ptracewrap::remote_graph&, ::std::uintptr_t);
+    };
+
+    struct remote_level {
+        ::std::vector<remote_pending> pending;
+        ::std::size_t buffer_size = 0;
+    };
+
+    // Queues the nodes a node points to for the next level
+    struct remote_visitor {
+        ::ptracewrap::remote_graph& graph;
+        remote_level& next;
+        ::std::size_t& budget;
+
+        template<class T>
+        void follow(::std::uintptr_t address) {
+            typedef ::ptracewrap::remote_layout<T> layout;
+            static_assert(layout::fields::end <= layout::size, "remote_layout fields must be inside its size");
+            if (address == 0 || budget == 0) {
+                return;
+            }
+            // The slot is kept from now on so the node isn't queued twice
+            if (!graph.template table<T>().nodes.insert(::std::make_pair(address, T())).second) {
+                return;
+            }
+            --budget;
+            remote_pending p;
+            p.address = address;
+            p.size = layout::size;
+            p.buffer_offset = next.buffer_size;
+            p.decode = &decode<T>;
+            p.discard = &discard<T>;
+            next.pending.push_back(p);
+            constexpr ::std::size_t align = alignof(::std::max_align_t);
+            next.buffer_size += (layout::size + align - 1) / align * align;
+        }
+
+        template<class T>
+        static void decode(::ptracewrap::remote_graph& graph, ::std::uintptr_t address, const char* raw, void* self) {
+            T& node = graph.template table<T>().nodes[address];
+            ::ptracewrap::remote_layout<T>::fields::extract(raw, node);
+            ::ptracewrap::remote_layout<T>::fields::visit(static_cast<const T&>(node), *static_cast<remote_visitor*>(self));
+        }
+
+        template<class T>
+        static void discard(::ptracewrap::remote_graph& graph, ::std::uintptr_t address) {
+            graph.template table<T>().nodes.erase(address);
+        }
+    };
+
+}
+
+// Reads the graph of structs reachable from a `Root` at `root` in the tracee. Each level of the graph (The nodes
+// pointed to by the previous level) is read with one `read_batch`, so adjacent nodes are read together and every
+// level costs one process_vm_readv(2) per `IOV_MAX` nodes. Null pointers and nodes that were already read aren't
+// followed, and at most `max_nodes` nodes are read. Nodes that can't be read are listed in `get_failed()`
+template<class Root>
+::ptracewrap::remote_graph read_graph(::pid_t pid, ::std::uintptr_t root, ::std::size_t max_nodes) {
+    ::ptracewrap::remote_graph graph;
+    ::std::size_t budget = max_nodes;
+    ::ptracewrap::detail::remote_level current;
+    {
+        ::ptracewrap::detail::remote_visitor v{ graph, current, budget };
+        v.follow<Root>(root);
+    }
+    ::std::vector<char> buffer;
+    ::ptracewrap::read_batch batch(pid);
+    while (!current.pending.empty()) {
+        ++graph.m_levels;
+        buffer.resize(current.buffer_size);
+        batch.clear();
+        for (const ::ptracewrap::detail::remote_pending& p : current.pending) {
+            batch.add(reinterpret_cast<const void*>(p.address), buffer.data() + p.buffer_offset, p.size);
+        }
+        batch.execute();
+
+        ::ptracewrap::detail::remote_level next;
+        ::ptracewrap::detail::remote_visitor v{ graph, next, budget };
+        for (::std::size_t i = 0; i < current.pending.size(); ++i) {
+            const ::ptracewrap::detail::remote_pending& p = current.pending[i];
+            if (batch.succeeded(i)) {
+                p.decode(graph, p.address, buffer.data() + p.buffer_offset, &v);
+                ++graph.m_size;
+            } else {
+                p.discard(graph, p.address);
+                graph.m_failed.push_back(p.address);
+            }
+        }
+        current = ::std::move(next);
+    }
+    return graph;
+}
+
+}
+
+#endif  // PTRACEWRAP_REMOTE_STRUCT_HPP_
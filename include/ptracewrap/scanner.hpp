@@ -0,0 +1,319 @@
+#ifndef PTRACEWRAP_SCANNER_HPP_
+#define PTRACEWRAP_SCANNER_HPP_
+
+#include "../ptracewrap.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace ptracewrap {
+
+struct scan_options {
+    // Worker threads, or 0 for `std::thread::hardware_concurrency()`
+    unsigned threads = 0;
+    // Bytes read with each process_vm_readv(2)
+    ::std::size_t chunk_size = ::std::size_t(1) << 20;
+    // Only regions with all of these `memory_region` permissions are scanned
+    unsigned permissions = ::ptracewrap::memory_region::read;
+};
+
+namespace detail {
+
+    struct scan_span {
+        ::std::uintptr_t start;
+        ::std::uintptr_t end;
+    };
+
+    // Regions with `permissions`, with adjacent ones joined so that matches can cross between them
+    inline ::std::vector<scan_span> scan_spans(const ::ptracewrap::memory_map& map, unsigned permissions) {
+        ::std::vector<scan_span> spans;
+        for (const ::ptracewrap::memory_region& region : map.get_regions()) {
+            if ((region.permissions & permissions) != permissions) {
+                continue;
+            }
+            if (!spans.empty() && spans.back().end == region.start) {
+                spans.back().end = region.end;
+            } else {
+                spans.push_back(scan_span{ region.start, region.end });
+            }
+        }
+        return spans;
+    }
+
+    // Reads [address, address + n) into `buffer` and calls `f(offset, length)` for each readable run.
+    // Pages that can't be read are skipped. Any other error (e.g. ESRCH or EPERM) would fail the same way for every
+    // page, so it ends the read
+    template<class F>
+    void scan_read(::pid_t pid, ::std::uintptr_t address, char* buffer, ::std::size_t n, F&& f) {
+        ::std::size_t done = 0;
+        while (done < n) {
+            void* remote = reinterpret_cast<void*>(address + done);
+            ::std::size_t got;
+            int error = 0;
+            if (::ptracewrap::detail::process_vm_unavailable().load(::std::memory_order_relaxed)) {
+                got = ::std::min(n - done, ::ptracewrap::detail::bytes_to_page_end(remote));
+                ::ptracewrap::ptrace_status status = ::ptracewrap::read_bytes(pid, remote, buffer + done, got, ::ptracewrap::transfer_backend::peek_poke, ::std::nothrow);
+                if (!status) {
+                    got = 0;
+                    error = status.get_errno();
+                }
+            } else {
+                got = ::ptracewrap::detail::process_vm_transfer(false, pid, remote, buffer + done, n - done);
+                if (got != n - done) {
+                    error = errno;
+                }
+            }
+            if (got != 0) {
+                f(done, got);
+                done += got;
+            }
+            if (done < n) {
+                if (error == ENOSYS) {
+                    // Try again with PTRACE_PEEKDATA
+                    continue;
+                }
+                // process_vm_readv(2) fails with EFAULT and PTRACE_PEEKDATA with EIO or EFAULT for an unreadable page
+                if (error != EFAULT && error != EIO) {
+                    return;
+                }
+                done += ::std::min(n - done, ::ptracewrap::detail::bytes_to_page_end(reinterpret_cast<void*>(address + done)));
+            }
+        }
+    }
+
+    // Splits the spans into chunks, and on each of `options.threads` threads reads chunks (Plus `overlap` bytes
+    // after them) and calls `match(data, length, address, limit, matches)`, which should append the address of every
+    // match starting before `limit` to `matches`. `on_match` is called with the matches of each chunk, one thread at
+    // a time, and scanning stops once it returns false. If a thread throws (Including from `on_match`), scanning
+    // stops and the first exception is rethrown once every thread has finished
+    template<class Match, class F>
+    ::std::size_t parallel_scan(::pid_t pid, const ::ptracewrap::scan_options& options, ::std::size_t overlap, const Match& match, F& on_match) {
+        ::ptracewrap::memory_map map(pid);
+        ::std::vector<scan_span> spans = scan_spans(map, options.permissions);
+        ::std::size_t chunk_size = ::std::max(options.chunk_size, ::ptracewrap::detail::page_size());
+
+        struct chunk {
+            ::std::uintptr_t start;
+            ::std::uintptr_t end;
+            ::std::uintptr_t span_end;
+        };
+        ::std::vector<chunk> chunks;
+        for (const scan_span& span : spans) {
+            for (::std::uintptr_t start = span.start; start < span.end; start += chunk_size) {
+                ::std::uintptr_t end = span.end - start < chunk_size ? span.end : start + chunk_size;
+                chunks.push_back(chunk{ start, end, span.end });
+            }
+        }
+
+        unsigned threads = options.threads != 0 ? options.threads : ::std::thread::hardware_concurrency();
+        if (threads == 0) {
+            threads = 1;
+        }
+        if (threads > chunks.size()) {
+            threads = chunks.size() == 0 ? 1 : static_cast<unsigned>(chunks.size());
+        }
+
+        ::std::atomic< ::std::size_t> next(0);
+        ::std::atomic<bool> stop(false);
+        ::std::size_t count = 0;
+        ::std::mutex mutex;
+        ::std::exception_ptr error;
+        // Called in a catch block
+        auto fail = [&]() {
+            ::std::lock_guard< ::std::mutex> lock(mutex);
+            if (!error) {
+                error = ::std::current_exception();
+            }
+            stop.store(true, ::std::memory_order_relaxed);
+        };
+        auto scan_chunks = [&]() {
+            ::std::unique_ptr<char[]> buffer(new char[chunk_size + overlap]);
+            ::std::vector< ::std::uintptr_t> matches;
+            for (;;) {
+                ::std::size_t i = next.fetch_add(1, ::std::memory_order_relaxed);
+                if (i >= chunks.size() || stop.load(::std::memory_order_relaxed)) {
+                    return;
+                }
+                const chunk& c = chunks[i];
+                ::std::size_t extra = ::std::min< ::std::uintptr_t>(overlap, c.span_end - c.end);
+                matches.clear();
+                ::ptracewrap::detail::scan_read(pid, c.start, buffer.get(), (c.end - c.start) + extra,
+                    [&](::std::size_t offset, ::std::size_t length) {
+                        ::std::uintptr_t address = c.start + offset;
+                        if (address < c.end) {
+                            match(static_cast<const char*>(buffer.get() + offset), length, address, c.end, matches);
+                        }
+                    });
+                if (!matches.empty()) {
+                    ::std::lock_guard< ::std::mutex> lock(mutex);
+                    for (::std::uintptr_t address : matches) {
+                        if (stop.load(::std::memory_order_relaxed)) {
+                            break;
+                        }
+                        ++count;
+                        if (!on_match(address)) {
+                            stop.store(true, ::std::memory_order_relaxed);
+                        }
+                    }
+                }
+            }
+        };
+        auto work = [&]() {
+            try {
+                scan_chunks();
+            } catch (...) {
+                fail();
+            }
+        };
+
+        ::std::vector< ::std::thread> pool;
+        try {
+            for (unsigned t = 1; t < threads; ++t) {
+                pool.emplace_back(work);
+            }
+        } catch (...) {
+            fail();
+        }
+        work();
+        for (::std::thread& t : pool) {
+            t.join();
+        }
+        if (error) {
+            ::std::rethrow_exception(error);
+        }
+        return count;
+    }
+
+    // Finds `pattern` (Where each byte only has to match in the bits set in `mask`, if there is one) in `data`.
+    // Candidates are found with memchr(3) for the first byte with a full mask, which is vectorised by the C library
+    class pattern_matcher {
+    public:
+        pattern_matcher(const void* pattern, const unsigned char* mask, ::std::size_t n) :
+          m_pattern(static_cast<const unsigned char*>(pattern), static_cast<const unsigned char*>(pattern) + n),
+          m_mask(mask ? ::std::vector<unsigned char>(mask, mask + n) : ::std::vector<unsigned char>()),
+          m_anchor(n) {
+            for (::std::size_t i = 0; i < n; ++i) {
+                if (m_mask.empty() || m_mask[i] == 0xff) {
+                    m_anchor = i;
+                    break;
+                }
+            }
+            for (::std::size_t i = 0; i < m_mask.size(); ++i) {
+                m_pattern[i] &= m_mask[i];
+            }
+        }
+
+        ::std::size_t size() const noexcept {
+            return m_pattern.size();
+        }
+
+        void operator()(const char* data, ::std::size_t length, ::std::uintptr_t address, ::std::uintptr_t limit, ::std::vector< ::std::uintptr_t>& matches) const {
+            const ::std::size_t n = m_pattern.size();
+            if (n == 0 || length < n) {
+                return;
+            }
+            const unsigned char* begin = reinterpret_cast<const unsigned char*>(data);
+            // Last possible start
+            ::std::size_t last = length - n;
+            if (limit - address <= last) {
+                last = limit - address - 1;
+            }
+            if (m_anchor == n) {
+                for (::std::size_t i = 0; i <= last; ++i) {
+                    if (equal(begin + i)) {
+                        matches.push_back(address + i);
+                    }
+                }
+                return;
+            }
+            const unsigned char anchor = m_pattern[m_anchor];
+            const unsigned char* p = begin + m_anchor;
+            const unsigned char* end = begin + last + m_anchor + 1;
+            while (p < end) {
+                p = static_cast<const unsigned char*>(::std::memchr(p, anchor, static_cast< ::std::size_t>(end - p)));
+                if (!p) {
+                    break;
+                }
+                const unsigned char* start = p - m_anchor;
+                if (equal(start)) {
+                    matches.push_back(address + static_cast< ::std::size_t>(start - begin));
+                }
+                ++p;
+            }
+        }
+    private:
+        bool equal(const unsigned char* data) const noexcept {
+            if (m_mask.empty()) {
+                return ::std::memcmp(data, m_pattern.data(), m_pattern.size()) == 0;
+            }
+            for (::std::size_t i = 0; i < m_pattern.size(); ++i) {
+                if ((data[i] & m_mask[i]) != m_pattern[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        ::std::vector<unsigned char> m_pattern;
+        ::std::vector<unsigned char> m_mask;
+        // Index of the first byte that must match exactly, or `size()` if there isn't one
+        ::std::size_t m_anchor;
+    };
+
+}
+
+// Searches the readable memory of `pid` for `pattern` on several threads, calling `on_match(std::uintptr_t address)`
+// for each match as it is found (Not in address order, and one call at a time). If `mask` isn't null, a byte matches
+// if it is equal to the pattern in the bits set in its mask (So a mask byte of 0 is a wildcard).
+// Scanning stops early if `on_match` returns false. Returns the number of matches reported.
+// `pid` doesn't have to be a tracee of the calling thread (process_vm_readv(2) only needs PTRACE_MODE_ATTACH)
+template<class F>
+::std::size_t scan_memory(::pid_t pid, const void* pattern, ::std::size_t n, const unsigned char* mask, F&& on_match,
+                          const ::ptracewrap::scan_options& options = ::ptracewrap::scan_options()) {
+    ::ptracewrap::detail::pattern_matcher matcher(pattern, mask, n);
+    return ::ptracewrap::detail::parallel_scan(pid, options, n == 0 ? 0 : n - 1, matcher, on_match);
+}
+
+template<class F>
+::std::size_t scan_memory(::pid_t pid, const void* pattern, ::std::size_t n, F&& on_match,
+                          const ::ptracewrap::scan_options& options = ::ptracewrap::scan_options()) {
+    return ::ptracewrap::scan_memory(pid, pattern, n, nullptr, on_match, options);
+}
+
+// Calls `on_match(address)` for every `alignment` aligned `T` in the readable memory of `pid` for which
+// `predicate(const T&)` is true
+template<class T, class Predicate, class F>
+::std::size_t scan_values(::pid_t pid, Predicate&& predicate, F&& on_match,
+                          const ::ptracewrap::scan_options& options = ::ptracewrap::scan_options(),
+                          ::std::size_t alignment = alignof(T)) {
+    static_assert(::std::is_trivially_copyable<T>::value, "scan_values can only read trivially copyable types");
+    if (alignment == 0) {
+        alignment = 1;
+    }
+    auto match = [&predicate, alignment](const char* data, ::std::size_t length, ::std::uintptr_t address, ::std::uintptr_t limit, ::std::vector< ::std::uintptr_t>& matches) {
+        ::std::uintptr_t first = (address + alignment - 1) / alignment * alignment;
+        for (::std::uintptr_t a = first; a < limit && a - address + sizeof(T) <= length; a += alignment) {
+            T value;
+            ::std::memcpy(&value, data + (a - address), sizeof(T));
+            if (predicate(static_cast<const T&>(value))) {
+                matches.push_back(a);
+            }
+        }
+    };
+    return ::ptracewrap::detail::parallel_scan(pid, options, sizeof(T) - 1, match, on_match);
+}
+
+}
+
+#endif  // PTRACEWRAP_SCANNER_HPP_
@@ -0,0 +1,347 @@
+#ifndef PTRACEWRAP_SECCOMP_HPP_
+#define PTRACEWRAP_SECCOMP_HPP_
+
+#include "../ptracewrap.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace ptracewrap {
+
+// A decoded PTRACE_GET_SYSCALL_INFO
+struct syscall_info {
+    enum op_type {
+        none = 0,
+        entry = 1,
+        exit = 2,
+        seccomp = 3
+    };
+
+    op_type op;
+    // AUDIT_ARCH_*
+    ::std::uint32_t arch;
+    ::std::uint64_t instruction_pointer;
+    ::std::uint64_t stack_pointer;
+    // `entry` and `seccomp`
+    long nr;
+    ::std::uint64_t args[6];
+    // `seccomp`: the SECCOMP_RET_DATA of the filter's return value
+    ::std::uint32_t ret_data;
+    // `exit`
+    ::std::int64_t rval;
+    bool is_error;
+};
+
+namespace detail {
+
+// Same layout as the kernel's `struct ptrace_syscall_info`, which older C libraries don't have
+struct raw_syscall_info {
+    ::std::uint8_t op;
+    ::std::uint32_t arch __attribute__((aligned(4)));
+    ::std::uint64_t instruction_pointer;
+    ::std::uint64_t stack_pointer;
+    union {
+        struct {
+            ::std::uint64_t nr;
+            ::std::uint64_t args[6];
+        } entry;
+        struct {
+            ::std::int64_t rval;
+            ::std::uint8_t is_error;
+        } exit;
+        struct {
+            ::std::uint64_t nr;
+            ::std::uint64_t args[6];
+            ::std::uint32_t ret_data;
+        } seccomp;
+    };
+};
+
+constexpr ::__ptrace_request get_syscall_info_request = static_cast< ::__ptrace_request>(0x420e);
+
+inline ::ptracewrap::syscall_info decode_syscall_info(const raw_syscall_info& raw) noexcept {
+    ::ptracewrap::syscall_info info;
+    ::std::memset(&info, 0, sizeof(info));
+    info.op = static_cast< ::ptracewrap::syscall_info::op_type>(raw.op);
+    info.arch = raw.arch;
+    info.instruction_pointer = raw.instruction_pointer;
+    info.stack_pointer = raw.stack_pointer;
+    switch (raw.op) {
+    case ::ptracewrap::syscall_info::entry:
+        info.nr = static_cast<long>(raw.entry.nr);
+        ::std::memcpy(info.args, raw.entry.args, sizeof(info.args));
+        break;
+    case ::ptracewrap::syscall_info::exit:
+        info.rval = raw.exit.rval;
+        info.is_error = raw.exit.is_error != 0;
+        break;
+    case ::ptracewrap::syscall_info::seccomp:
+        info.nr = static_cast<long>(raw.seccomp.nr);
+        ::std::memcpy(info.args, raw.seccomp.args, sizeof(info.args));
+        info.ret_data = raw.seccomp.ret_data;
+        break;
+    default:
+        break;
+    }
+    return info;
+}
+
+#if defined(__x86_64__) && !defined(__ILP32__)
+constexpr ::std::uint32_t audit_arch = AUDIT_ARCH_X86_64;
+#elif defined(__i386__)
+constexpr ::std::uint32_t audit_arch = AUDIT_ARCH_I386;
+#elif defined(__aarch64__)
+constexpr ::std::uint32_t audit_arch = AUDIT_ARCH_AARCH64;
+#elif defined(__arm__)
+constexpr ::std::uint32_t audit_arch = AUDIT_ARCH_ARM;
+#else
+// No architecture check
+constexpr ::std::uint32_t audit_arch = 0;
+#endif
+
+}
+
+// The syscall the tracee is stopped in (At a syscall-stop or a seccomp stop)
+inline ::ptracewrap::ptrace_result< ::ptracewrap::syscall_info> get_syscall_info(::pid_t pid, const ::std::nothrow_t&) noexcept {
+    ::ptracewrap::detail::raw_syscall_info raw;
+    ::std::memset(&raw, 0, sizeof(raw));
+    void* size = reinterpret_cast<void*>(sizeof(raw));
+    errno = 0;
+    if (::ptracewrap::ptrace(::ptracewrap::detail::get_syscall_info_request, pid, size, &raw) == -1 && errno != 0) {
+        return ::ptracewrap::ptrace_status(errno, ::ptracewrap::detail::get_syscall_info_request, pid, size, &raw);
+    }
+    return ::ptracewrap::detail::decode_syscall_info(raw);
+}
+
+inline ::ptracewrap::syscall_info get_syscall_info(::pid_t pid) {
+    return ::ptracewrap::get_syscall_info(pid, ::std::nothrow).value();
+}
+
+// A seccomp BPF program that returns SECCOMP_RET_TRACE for a set of syscall numbers and allows everything else,
+// so a tracer with PTRACE_O_TRACESECCOMP only stops on those syscalls.
+// Syscalls made with a different ABI than the one this was compiled for (e.g. `int 0x80` on x86_64) are allowed.
+class seccomp_filter {
+public:
+    // Throws `std::system_error` with EINVAL if the program would be longer than the kernel allows (BPF_MAXINSNS, two
+    // instructions per syscall)
+    explicit seccomp_filter(const ::std::vector<long>& syscalls, ::std::uint16_t ret_data = 0) {
+        ::std::size_t length = (::ptracewrap::detail::audit_arch != 0 ? 3 : 0) + 2;
+        if (syscalls.size() > (BPF_MAXINSNS - length) / 2) {
+            throw ::std::system_error(::std::error_code(EINVAL, ::std::generic_category()), "seccomp_filter: more than BPF_MAXINSNS instructions");
+        }
+        m_program.reserve(length + 2 * syscalls.size());
+        const ::std::uint32_t trace = SECCOMP_RET_TRACE | ret_data;
+        if (::ptracewrap::detail::audit_arch != 0) {
+            add(BPF_LD | BPF_W | BPF_ABS, 0, 0, offsetof(::seccomp_data, arch));
+            add(BPF_JMP | BPF_JEQ | BPF_K, 1, 0, ::ptracewrap::detail::audit_arch);
+            add(BPF_RET | BPF_K, 0, 0, SECCOMP_RET_ALLOW);
+        }
+        add(BPF_LD | BPF_W | BPF_ABS, 0, 0, offsetof(::seccomp_data, nr));
+        for (long nr : syscalls) {
+            add(BPF_JMP | BPF_JEQ | BPF_K, 0, 1, static_cast< ::std::uint32_t>(nr));
+            add(BPF_RET | BPF_K, 0, 0, trace);
+        }
+        add(BPF_RET | BPF_K, 0, 0, SECCOMP_RET_ALLOW);
+    }
+
+    const ::std::vector< ::sock_filter>& get_program() const noexcept {
+        return m_program;
+    }
+
+    // Installs the filter on the calling thread (Setting PR_SET_NO_NEW_PRIVS first). Async-signal-safe, so it can be
+    // called between fork(2) and execve(2). Returns -1 and sets errno on failure
+    int install() const noexcept {
+        ::sock_fprog prog;
+        prog.len = static_cast<unsigned short>(m_program.size());
+        prog.filter = const_cast< ::sock_filter*>(m_program.data());
+        if (::prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1) {
+            return -1;
+        }
+        return ::prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog);
+    }
+private:
+    void add(::std::uint16_t code, ::std::uint8_t jt, ::std::uint8_t jf, ::std::uint32_t k) {
+        ::sock_filter f;
+        f.code = code;
+        f.jt = jt;
+        f.jf = jf;
+        f.k = k;
+        m_program.push_back(f);
+    }
+
+    ::std::vector< ::sock_filter> m_program;
+};
+
+// Traces a process (And the processes and threads it creates) stopping only at the syscalls matched by a
+// `seccomp_filter`. A traced syscall costs one stop instead of the two of PTRACE_SYSCALL, and untraced syscalls
+// don't stop at all.
+//
+// `next()` waits with `waitpid(-1, __WALL)`, so the calling thread shouldn't have other children it waits for.
+// Tracees are killed if the tracing thread exits (PTRACE_O_EXITKILL)
+class seccomp_session {
+public:
+    // Always set: the seccomp stops themselves, PTRACE_EVENT_EXEC instead of a SIGTRAP after execve(2), and following
+    // children, which inherit the filter and would otherwise fail the traced syscalls with ENOSYS
+    static constexpr unsigned long required_options =
+        PTRACE_O_TRACESECCOMP | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL |
+        PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE;
+
+    // Forks and runs `execvp(file, argv)` with `filter` installed. The returned session is stopped before the execve.
+    // If the child can't be set up (e.g. the filter can't be installed), the errno it got is thrown as a
+    // `std::system_error`. The filter is installed before the child stops itself with `raise(SIGSTOP)`, so a filter
+    // that traces the syscalls `raise` makes fails with ENOSYS
+    static seccomp_session launch(const char* file, char* const argv[], const ::ptracewrap::seccomp_filter& filter, unsigned long options = 0) {
+        // The child writes its errno here if setting up fails
+        int error_pipe[2];
+        if (::pipe2(error_pipe, O_CLOEXEC) == -1) {
+            throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), "pipe2");
+        }
+        ::pid_t pid = ::fork();
+        if (pid == -1) {
+            int errnum = errno;
+            ::close(error_pipe[0]);
+            ::close(error_pipe[1]);
+            throw ::std::system_error(::std::error_code(errnum, ::std::generic_category()), "fork");
+        }
+        if (pid == 0) {
+            ::close(error_pipe[0]);
+            if (::ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) == -1 || filter.install() == -1 || ::raise(SIGSTOP) != 0) {
+                int errnum = errno;
+                while (::write(error_pipe[1], &errnum, sizeof(errnum)) == -1 && errno == EINTR) {}
+                ::_exit(127);
+            }
+            ::execvp(file, argv);
+            ::_exit(127);
+        }
+        ::close(error_pipe[1]);
+        int status;
+        ::pid_t result;
+        while ((result = ::waitpid(pid, &status, __WALL)) == -1 && errno == EINTR) {}
+        if (result == -1) {
+            int errnum = errno;
+            ::close(error_pipe[0]);
+            ::kill(pid, SIGKILL);
+            throw ::std::system_error(::std::error_code(errnum, ::std::generic_category()), "waitpid");
+        }
+        if (!WIFSTOPPED(status)) {
+            // It has exited, so the pipe is closed and the read doesn't block
+            int errnum = ECHILD;
+            ::ssize_t size;
+            while ((size = ::read(error_pipe[0], &errnum, sizeof(errnum))) == -1 && errno == EINTR) {}
+            if (size != static_cast< ::ssize_t>(sizeof(errnum))) {
+                errnum = ECHILD;
+            }
+            ::close(error_pipe[0]);
+            throw ::std::system_error(::std::error_code(errnum, ::std::generic_category()), "seccomp_session::launch");
+        }
+        ::close(error_pipe[0]);
+        return seccomp_session(pid, options);
+    }
+
+    // For a tracee (Attached and stopped) that already has a filter returning SECCOMP_RET_TRACE
+    static seccomp_session attach(::pid_t pid, unsigned long options = 0) {
+        return seccomp_session(pid, options);
+    }
+
+    seccomp_session(seccomp_session&&) = default;
+    seccomp_session& operator=(seccomp_session&&) = default;
+
+    // The first tracee
+    ::pid_t get_pid() const noexcept {
+        return m_pid;
+    }
+
+    // The `waitpid(2)` status of the first tracee once it has terminated
+    int get_exit_status() const noexcept {
+        return m_exit_status;
+    }
+
+    // Resumes the stopped tracees and waits for the next traced syscall, which is left stopped at its seccomp stop
+    // (So its arguments and memory can be inspected or changed). Signals are passed on to the tracees.
+    // Returns false once every tracee has terminated
+    bool next(::pid_t& pid, ::ptracewrap::syscall_info& info) {
+        for (;;) {
+            if (m_stopped != 0) {
+                ::ptracewrap::ptrace(PTRACE_CONT, m_stopped, nullptr, reinterpret_cast<void*>(static_cast<long>(m_signal)));
+                m_stopped = 0;
+                m_signal = 0;
+            }
+            if (m_live.empty()) {
+                return false;
+            }
+            int status;
+            ::pid_t p = ::waitpid(-1, &status, __WALL);
+            if (p == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == ECHILD) {
+                    m_live.clear();
+                    return false;
+                }
+                throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), "waitpid");
+            }
+            if (WIFEXITED(status) || WIFSIGNALED(status)) {
+                if (p == m_pid) {
+                    m_exit_status = status;
+                }
+                m_live.erase(p);
+                continue;
+            }
+            m_stopped = p;
+            int event = (status >> 16) & 0xff;
+            int signal = WSTOPSIG(status);
+            if (m_live.insert(p).second && signal == SIGSTOP && event == 0) {
+                // The initial stop of an automatically attached child
+                continue;
+            }
+            if (event == PTRACE_EVENT_SECCOMP) {
+                ::ptracewrap::ptrace_result< ::ptracewrap::syscall_info> result = ::ptracewrap::get_syscall_info(p, ::std::nothrow);
+                if (!result) {
+                    if (result.status().get_errno() == ESRCH) {
+                        m_stopped = 0;
+                        continue;
+                    }
+                    result.status().throw_if_error();
+                }
+                pid = p;
+                info = *result;
+                return true;
+            }
+            if (event == 0) {
+                m_signal = signal;
+            }
+        }
+    }
+private:
+    seccomp_session(::pid_t pid, unsigned long options) : m_pid(pid), m_exit_status(0), m_stopped(pid), m_signal(0) {
+        ::ptracewrap::ptrace_w_error(PTRACE_SETOPTIONS, pid, nullptr, reinterpret_cast<void*>(options | required_options));
+        m_live.insert(pid);
+    }
+
+    ::pid_t m_pid;
+    int m_exit_status;
+    // The tracee to resume on the next call to `next()`, and the signal to resume it with
+    ::pid_t m_stopped;
+    int m_signal;
+    ::std::unordered_set< ::pid_t> m_live;
+};
+
+}
+
+#endif  // PTRACEWRAP_SECCOMP_HPP_
@@ -0,0 +1,269 @@
+#ifndef PTRACEWRAP_SNAPSHOT_HPP_
+#define PTRACEWRAP_SNAPSHOT_HPP_
+
+#include "../ptracewrap.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace ptracewrap {
+
+// The pages that changed between two points, with their new contents
+struct memory_delta {
+    // Page aligned addresses, in increasing order
+    ::std::vector< ::std::uintptr_t> pages;
+    // `pages.size()` pages, one after the other
+    ::std::vector<char> data;
+    // Pages that were looked at (Dirty pages, or every page if soft-dirty bits aren't supported)
+    ::std::size_t pages_checked = 0;
+    // Pages that were looked at but couldn't be read
+    ::std::size_t pages_failed = 0;
+
+    ::std::size_t size() const noexcept {
+        return pages.size();
+    }
+
+    const char* page(::std::size_t i) const noexcept {
+        return data.data() + i * ::ptracewrap::detail::page_size();
+    }
+};
+
+namespace detail {
+
+    constexpr ::std::uint64_t pagemap_present = ::std::uint64_t(1) << 63;
+    constexpr ::std::uint64_t pagemap_swapped = ::std::uint64_t(1) << 62;
+    constexpr ::std::uint64_t pagemap_soft_dirty = ::std::uint64_t(1) << 55;
+
+    [[noreturn]] inline void throw_proc_error(const ::std::string& path) {
+        throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), path);
+    }
+
+    inline void clear_soft_dirty(const ::std::string& path) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd == -1) {
+            ::ptracewrap::detail::throw_proc_error(path);
+        }
+        ::ssize_t result = ::write(fd, "4", 1);
+        int errnum = errno;
+        ::close(fd);
+        if (result != 1) {
+            errno = errnum;
+            ::ptracewrap::detail::throw_proc_error(path);
+        }
+    }
+
+    // Whether the kernel tracks soft-dirty bits (CONFIG_MEM_SOFT_DIRTY), checked once. A page written to in a new
+    // mapping is always soft-dirty when they are tracked (And never is when they aren't), so this only reads
+    // `/proc/self/pagemap` and doesn't clear the soft-dirty bits of this process
+    inline bool check_soft_dirty() noexcept {
+        ::std::size_t page = ::ptracewrap::detail::page_size();
+        void* map = ::mmap(nullptr, page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+        static_cast<volatile char*>(map)[0] = 1;
+        bool supported = false;
+        int fd = ::open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+        if (fd != -1) {
+            ::std::uint64_t entry = 0;
+            ::off_t offset = static_cast< ::off_t>(reinterpret_cast< ::std::uintptr_t>(map) / page * sizeof(entry));
+            supported = ::pread(fd, &entry, sizeof(entry), offset) == static_cast< ::ssize_t>(sizeof(entry)) &&
+                (entry & ::ptracewrap::detail::pagemap_soft_dirty) != 0;
+            ::close(fd);
+        }
+        ::munmap(map, page);
+        return supported;
+    }
+
+    inline bool soft_dirty_supported() noexcept {
+        static const bool supported = ::ptracewrap::detail::check_soft_dirty();
+        return supported;
+    }
+
+    // Not cryptographic, only to tell if a page has changed
+    inline ::std::uint64_t hash_page(const char* data, ::std::size_t n) noexcept {
+        ::std::uint64_t h = 0xcbf29ce484222325u;
+        for (::std::size_t i = 0; i + sizeof(::std::uint64_t) <= n; i += sizeof(::std::uint64_t)) {
+            ::std::uint64_t word;
+            ::std::memcpy(&word, data + i, sizeof(word));
+            h = (h ^ word) * 0x9e3779b97f4a7c15u;
+            h ^= h >> 29;
+        }
+        return h;
+    }
+
+}
+
+// Finds the pages of a process that changed between checkpoints. After `capture()` reads every page,
+// `update()` only reads the pages whose soft-dirty bit (In `/proc/<pid>/pagemap`) was set since the last call, and then
+// clears the bits with `/proc/<pid>/clear_refs`. With `hash_pages`, pages that were written to but still have the
+// same contents aren't part of the delta.
+//
+// If the kernel doesn't track soft-dirty bits, every present page is read and compared by hash instead, so
+// `hash_pages` must be true (The constructor throws a `std::system_error` with `EOPNOTSUPP` otherwise, since every
+// page would be in every delta). Only writable regions are tracked. The tracee should be stopped during `capture()`
+// and `update()`. Throws `std::system_error` if the `/proc` files can't be used
+class memory_snapshot {
+public:
+    explicit memory_snapshot(::pid_t pid, bool hash_pages = true) :
+      m_pid(pid), m_hash_pages(hash_pages), m_map(pid), m_pagemap(-1) {
+        if (!hash_pages && !soft_dirty_supported()) {
+            throw ::std::system_error(::std::error_code(EOPNOTSUPP, ::std::generic_category()),
+                "memory_snapshot: soft-dirty bits aren't supported, so changed pages can only be found with hash_pages");
+        }
+    }
+
+    memory_snapshot(const memory_snapshot&) = delete;
+    memory_snapshot& operator=(const memory_snapshot&) = delete;
+
+    ~memory_snapshot() {
+        if (m_pagemap != -1) {
+            ::close(m_pagemap);
+        }
+    }
+
+    ::pid_t get_pid() const noexcept {
+        return m_pid;
+    }
+
+    static bool soft_dirty_supported() noexcept {
+        return ::ptracewrap::detail::soft_dirty_supported();
+    }
+
+    // Every present page of the writable regions
+    ::ptracewrap::memory_delta capture() {
+        m_hashes.clear();
+        return collect(false);
+    }
+
+    // The pages that changed since the last `capture()` or `update()`
+    ::ptracewrap::memory_delta update() {
+        return collect(soft_dirty_supported());
+    }
+private:
+    static constexpr ::std::size_t batch_pages = 1024;
+
+    ::std::string proc_path(const char* file) const {
+        return "/proc/" + ::std::to_string(m_pid) + "/" + file;
+    }
+
+    void open_pagemap() {
+        if (m_pagemap == -1) {
+            ::std::string path = proc_path("pagemap");
+            m_pagemap = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (m_pagemap == -1) {
+                ::ptracewrap::detail::throw_proc_error(path);
+            }
+        }
+    }
+
+    // Appends the pages in [start, end) that are present (And soft-dirty if `dirty_only`) to `m_candidates`
+    void scan_pagemap(::std::uintptr_t start, ::std::uintptr_t end, bool dirty_only) {
+        const ::std::size_t page = ::ptracewrap::detail::page_size();
+        ::std::uint64_t entries[512];
+        for (::std::uintptr_t address = start; address < end;) {
+            ::std::size_t count = ::std::min< ::std::size_t>((end - address) / page, sizeof(entries) / sizeof(entries[0]));
+            ::off_t offset = static_cast< ::off_t>(address / page * sizeof(entries[0]));
+            ::ssize_t result = ::pread(m_pagemap, entries, count * sizeof(entries[0]), offset);
+            if (result <= 0) {
+                // The region was unmapped
+                return;
+            }
+            count = static_cast< ::std::size_t>(result) / sizeof(entries[0]);
+            for (::std::size_t i = 0; i < count; ++i) {
+                ::std::uint64_t e = entries[i];
+                if ((e & (::ptracewrap::detail::pagemap_present | ::ptracewrap::detail::pagemap_swapped)) == 0) {
+                    continue;
+                }
+                if (dirty_only && (e & ::ptracewrap::detail::pagemap_soft_dirty) == 0) {
+                    continue;
+                }
+                m_candidates.push_back(address + i * page);
+            }
+            address += count * page;
+        }
+    }
+
+    ::ptracewrap::memory_delta collect(bool dirty_only) {
+        const ::std::size_t page = ::ptracewrap::detail::page_size();
+        open_pagemap();
+        m_map.refresh();
+        m_candidates.clear();
+        for (const ::ptracewrap::memory_region& region : m_map.get_regions()) {
+            if ((region.permissions & ::ptracewrap::memory_region::write) != 0) {
+                scan_pagemap(region.start, region.end, dirty_only);
+            }
+        }
+        if (soft_dirty_supported()) {
+            ::ptracewrap::detail::clear_soft_dirty(proc_path("clear_refs"));
+        }
+
+        // Forget pages that are no longer mapped
+        for (::std::unordered_map< ::std::uintptr_t, ::std::uint64_t>::iterator it = m_hashes.begin(); it != m_hashes.end();) {
+            const ::ptracewrap::memory_region* region = m_map.find(reinterpret_cast<const void*>(it->first));
+            if (!region || (region->permissions & ::ptracewrap::memory_region::write) == 0) {
+                it = m_hashes.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        ::ptracewrap::memory_delta delta;
+        delta.pages_checked = m_candidates.size();
+        ::ptracewrap::read_batch batch(m_pid);
+        for (::std::size_t first = 0; first < m_candidates.size(); first += batch_pages) {
+            ::std::size_t count = ::std::min(batch_pages, m_candidates.size() - first);
+            m_buffer.resize(count * page);
+            batch.clear();
+            for (::std::size_t i = 0; i < count; ++i) {
+                batch.add(reinterpret_cast<const void*>(m_candidates[first + i]), m_buffer.data() + i * page, page);
+            }
+            batch.execute();
+            for (::std::size_t i = 0; i < count; ++i) {
+                if (!batch.succeeded(i)) {
+                    ++delta.pages_failed;
+                    continue;
+                }
+                const char* data = m_buffer.data() + i * page;
+                if (m_hash_pages) {
+                    ::std::uint64_t hash = ::ptracewrap::detail::hash_page(data, page);
+                    ::std::pair< ::std::unordered_map< ::std::uintptr_t, ::std::uint64_t>::iterator, bool> inserted =
+                        m_hashes.insert(::std::make_pair(m_candidates[first + i], hash));
+                    if (!inserted.second) {
+                        if (inserted.first->second == hash) {
+                            continue;
+                        }
+                        inserted.first->second = hash;
+                    }
+                }
+                delta.pages.push_back(m_candidates[first + i]);
+                delta.data.insert(delta.data.end(), data, data + page);
+            }
+        }
+        return delta;
+    }
+
+    ::pid_t m_pid;
+    bool m_hash_pages;
+    ::ptracewrap::memory_map m_map;
+    int m_pagemap;
+    // Hash of the contents of every page at the last checkpoint (With `hash_pages`)
+    ::std::unordered_map< ::std::uintptr_t, ::std::uint64_t> m_hashes;
+    ::std::vector< ::std::uintptr_t> m_candidates;
+    ::std::vector<char> m_buffer;
+};
+
+}
+
+#endif  // PTRACEWRAP_SNAPSHOT_HPP_
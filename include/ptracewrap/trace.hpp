@@ -0,0 +1,414 @@
+#ifndef PTRACEWRAP_TRACE_HPP_
+#define PTRACEWRAP_TRACE_HPP_
+
+#include "../ptracewrap.hpp"
+#include "seccomp.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace ptracewrap {
+
+// One traced syscall, in a fixed size format that can be copied around without allocating
+struct syscall_record {
+    static constexpr ::std::size_t payload_capacity = 64;
+
+    // CLOCK_MONOTONIC nanoseconds
+    ::std::uint64_t enter_ns;
+    ::std::uint64_t exit_ns;
+    ::std::int32_t pid;
+    ::std::int32_t tid;
+    ::std::int64_t nr;
+    ::std::uint64_t args[6];
+    ::std::int64_t ret;
+    // Number of bytes used in `payload`
+    ::std::uint16_t payload_size;
+    // The argument `payload` was read from, or 0xffff for none
+    ::std::uint16_t payload_arg;
+    ::std::uint32_t reserved;
+    unsigned char payload[payload_capacity];
+
+    static ::std::uint64_t now_ns() noexcept {
+        ::timespec ts;
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast< ::std::uint64_t>(ts.tv_sec) * 1000000000u + static_cast< ::std::uint64_t>(ts.tv_nsec);
+    }
+
+    void clear() noexcept {
+        ::std::memset(this, 0, sizeof(*this));
+        payload_arg = 0xffff;
+    }
+
+    // Fills in `nr` and `args` from a syscall-entry or seccomp stop, or `ret` from a syscall-exit stop
+    void set(const ::ptracewrap::syscall_info& info) noexcept {
+        if (info.op == ::ptracewrap::syscall_info::exit) {
+            ret = info.rval;
+        } else {
+            nr = info.nr;
+            ::std::memcpy(args, info.args, sizeof(args));
+        }
+    }
+
+    // Reads up to `payload_capacity` bytes at `address` in the tracee into `payload`, and if that fails, as many as
+    // are before the end of the page. Returns the number of bytes captured
+    template<class Target>
+    ::std::size_t capture(Target&& target, const volatile void* address, ::std::size_t n, ::std::uint16_t arg = 0xffff) noexcept {
+        if (n > payload_capacity) {
+            n = payload_capacity;
+        }
+        if (!::ptracewrap::read_bytes(target, address, payload, n, ::std::nothrow)) {
+            ::std::size_t to_end = ::ptracewrap::detail::bytes_to_page_end(address);
+            if (to_end >= n || !::ptracewrap::read_bytes(target, address, payload, to_end, ::std::nothrow)) {
+                n = 0;
+            } else {
+                n = to_end;
+            }
+        }
+        payload_size = static_cast< ::std::uint16_t>(n);
+        payload_arg = n == 0 ? 0xffff : arg;
+        return n;
+    }
+};
+
+static_assert(::std::is_trivially_copyable< ::ptracewrap::syscall_record>::value, "syscall_record must be trivially copyable");
+static_assert(sizeof(::ptracewrap::syscall_record) == 160, "syscall_record is part of the trace file format");
+
+// A bounded single-producer single-consumer queue. All storage is allocated by the constructor; `try_push` and
+// `try_pop` never allocate or block. The capacity is rounded up to a power of 2
+template<class T>
+class spsc_ring {
+    static_assert(::std::is_trivially_copyable<T>::value, "spsc_ring elements must be trivially copyable");
+public:
+    explicit spsc_ring(::std::size_t capacity) : m_mask(round_up(capacity) - 1), m_slots(new T[m_mask + 1]),
+      m_head(0), m_cached_tail(0), m_tail(0), m_cached_head(0) {}
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+    ::std::size_t capacity() const noexcept {
+        return m_mask + 1;
+    }
+
+    // Producer only. Returns false if the ring is full
+    bool try_push(const T& value) noexcept {
+        ::std::size_t head = m_head.load(::std::memory_order_relaxed);
+        if (head - m_cached_tail > m_mask) {
+            m_cached_tail = m_tail.load(::std::memory_order_acquire);
+            if (head - m_cached_tail > m_mask) {
+                return false;
+            }
+        }
+        m_slots[head & m_mask] = value;
+        m_head.store(head + 1, ::std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false if the ring is empty
+    bool try_pop(T& value) noexcept {
+        ::std::size_t tail = m_tail.load(::std::memory_order_relaxed);
+        if (tail == m_cached_head) {
+            m_cached_head = m_head.load(::std::memory_order_acquire);
+            if (tail == m_cached_head) {
+                return false;
+            }
+        }
+        value = m_slots[tail & m_mask];
+        m_tail.store(tail + 1, ::std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Calls `f(const T* data, std::size_t n)` with the contiguous runs of queued elements (At most two)
+    // and removes them. Returns the number of elements consumed
+    template<class F>
+    ::std::size_t consume(F&& f) {
+        ::std::size_t tail = m_tail.load(::std::memory_order_relaxed);
+        m_cached_head = m_head.load(::std::memory_order_acquire);
+        ::std::size_t n = m_cached_head - tail;
+        if (n == 0) {
+            return 0;
+        }
+        ::std::size_t first = tail & m_mask;
+        ::std::size_t run = n < capacity() - first ? n : capacity() - first;
+        f(static_cast<const T*>(m_slots.get() + first), run);
+        if (run != n) {
+            f(static_cast<const T*>(m_slots.get()), n - run);
+        }
+        m_tail.store(tail + n, ::std::memory_order_release);
+        return n;
+    }
+
+    // Approximate when called while the other side is running
+    ::std::size_t size() const noexcept {
+        return m_head.load(::std::memory_order_acquire) - m_tail.load(::std::memory_order_acquire);
+    }
+private:
+    static ::std::size_t round_up(::std::size_t n) noexcept {
+        ::std::size_t result = 2;
+        while (result < n) {
+            result *= 2;
+        }
+        return result;
+    }
+
+    static constexpr ::std::size_t cache_line = 64;
+
+    const ::std::size_t m_mask;
+    ::std::unique_ptr<T[]> m_slots;
+    // Producer side, and the consumer side on another cache line
+    char m_pad0[cache_line];
+    ::std::atomic< ::std::size_t> m_head;
+    ::std::size_t m_cached_tail;
+    char m_pad1[cache_line - sizeof(::std::atomic< ::std::size_t>) - sizeof(::std::size_t)];
+    ::std::atomic< ::std::size_t> m_tail;
+    ::std::size_t m_cached_head;
+    char m_pad2[cache_line - sizeof(::std::atomic< ::std::size_t>) - sizeof(::std::size_t)];
+};
+
+// The header at the start of a trace file. Everything is in the byte order of the machine that wrote it
+struct trace_file_header {
+    static constexpr ::std::uint32_t current_version = 1;
+
+    // "PTWTRACE"
+    char magic[8];
+    ::std::uint32_t version;
+    ::std::uint32_t record_size;
+    ::std::uint64_t count;
+    char reserved[40];
+};
+
+static_assert(sizeof(::ptracewrap::trace_file_header) == 64, "trace_file_header is part of the trace file format");
+
+namespace detail {
+
+[[noreturn]] inline void throw_file_error(const ::std::string& path) {
+    throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), path);
+}
+
+}
+
+// Appends `syscall_record`s to a trace file through a shared mapping, which grows in large steps. The file is
+// truncated to the records written when the writer is closed. Opening an existing trace file appends to it.
+// Throws `std::system_error` on failure
+class trace_writer {
+public:
+    static constexpr ::std::size_t default_growth = ::std::size_t(4) << 20;
+
+    explicit trace_writer(const ::std::string& path, ::std::size_t growth = default_growth) :
+      m_path(path), m_fd(::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)), m_map(nullptr), m_mapped(0), m_growth(growth) {
+        if (m_fd == -1) {
+            ::ptracewrap::detail::throw_file_error(m_path);
+        }
+        struct ::stat st;
+        if (::fstat(m_fd, &st) == -1) {
+            close_fd();
+            ::ptracewrap::detail::throw_file_error(m_path);
+        }
+        ::std::size_t existing = static_cast< ::std::size_t>(st.st_size);
+        if (existing != 0 && existing < sizeof(::ptracewrap::trace_file_header)) {
+            close_fd();
+            errno = EINVAL;
+            ::ptracewrap::detail::throw_file_error(m_path);
+        }
+        try {
+            remap(existing > sizeof(::ptracewrap::trace_file_header) ? existing : sizeof(::ptracewrap::trace_file_header));
+        } catch (...) {
+            close_fd();
+            throw;
+        }
+        ::ptracewrap::trace_file_header& h = header();
+        if (existing == 0) {
+            ::std::memcpy(h.magic, "PTWTRACE", 8);
+            h.version = ::ptracewrap::trace_file_header::current_version;
+            h.record_size = sizeof(::ptracewrap::syscall_record);
+            h.count = 0;
+        } else if (::std::memcmp(h.magic, "PTWTRACE", 8) != 0 || h.record_size != sizeof(::ptracewrap::syscall_record)) {
+            ::munmap(m_map, m_mapped);
+            close_fd();
+            errno = EINVAL;
+            ::ptracewrap::detail::throw_file_error(m_path);
+        }
+    }
+
+    trace_writer(const trace_writer&) = delete;
+    trace_writer& operator=(const trace_writer&) = delete;
+
+    ~trace_writer() {
+        try {
+            close();
+        } catch (...) {}
+    }
+
+    ::std::uint64_t size() const noexcept {
+        return m_map ? header().count : 0;
+    }
+
+    void append(const ::ptracewrap::syscall_record* records, ::std::size_t n) {
+        ::std::size_t end = offset_of(size() + n);
+        if (end > m_mapped) {
+            remap(end + m_growth);
+        }
+        ::std::memcpy(m_map + offset_of(size()), records, n * sizeof(::ptracewrap::syscall_record));
+        header().count += n;
+    }
+
+    void append(const ::ptracewrap::syscall_record& record) {
+        append(&record, 1);
+    }
+
+    // Schedules the written records to be written back to the file (msync(MS_ASYNC))
+    void flush() noexcept {
+        if (m_map) {
+            ::msync(m_map, offset_of(size()), MS_ASYNC);
+        }
+    }
+
+    void close() {
+        if (m_fd == -1) {
+            return;
+        }
+        ::std::size_t end = offset_of(size());
+        ::munmap(m_map, m_mapped);
+        m_map = nullptr;
+        m_mapped = 0;
+        int result = ::ftruncate(m_fd, static_cast< ::off_t>(end));
+        int errnum = errno;
+        close_fd();
+        if (result == -1) {
+            errno = errnum;
+            ::ptracewrap::detail::throw_file_error(m_path);
+        }
+    }
+private:
+    static ::std::size_t offset_of(::std::uint64_t record) noexcept {
+        return sizeof(::ptracewrap::trace_file_header) + static_cast< ::std::size_t>(record) * sizeof(::ptracewrap::syscall_record);
+    }
+
+    ::ptracewrap::trace_file_header& header() const noexcept {
+        return *reinterpret_cast< ::ptracewrap::trace_file_header*>(m_map);
+    }
+
+    void remap(::std::size_t length) {
+        if (::ftruncate(m_fd, static_cast< ::off_t>(length)) == -1) {
+            ::ptracewrap::detail::throw_file_error(m_path);
+        }
+        void* map = m_map ?
+            ::mremap(m_map, m_mapped, length, MREMAP_MAYMOVE) :
+            ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (map == MAP_FAILED) {
+            ::ptracewrap::detail::throw_file_error(m_path);
+        }
+        m_map = static_cast<unsigned char*>(map);
+        m_mapped = length;
+    }
+
+    void close_fd() noexcept {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+
+    ::std::string m_path;
+    int m_fd;
+    unsigned char* m_map;
+    ::std::size_t m_mapped;
+    ::std::size_t m_growth;
+};
+
+// Moves everything queued in `ring` to `writer`. Returns the number of records moved.
+// Meant to be called in a loop on a thread other than the tracer that fills the ring
+inline ::std::size_t drain(::ptracewrap::spsc_ring< ::ptracewrap::syscall_record>& ring, ::ptracewrap::trace_writer& writer) {
+    return ring.consume([&writer](const ::ptracewrap::syscall_record* records, ::std::size_t n) {
+        writer.append(records, n);
+    });
+}
+
+// Maps a trace file read only. Throws `std::system_error` if it can't be opened or isn't a trace file
+class trace_reader {
+public:
+    explicit trace_reader(const ::std::string& path) : m_map(nullptr), m_length(0), m_count(0) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            ::ptracewrap::detail::throw_file_error(path);
+        }
+        struct ::stat st;
+        if (::fstat(fd, &st) == -1) {
+            int errnum = errno;
+            ::close(fd);
+            errno = errnum;
+            ::ptracewrap::detail::throw_file_error(path);
+        }
+        m_length = static_cast< ::std::size_t>(st.st_size);
+        if (m_length < sizeof(::ptracewrap::trace_file_header)) {
+            ::close(fd);
+            errno = EINVAL;
+            ::ptracewrap::detail::throw_file_error(path);
+        }
+        void* map = ::mmap(nullptr, m_length, PROT_READ, MAP_SHARED, fd, 0);
+        int errnum = errno;
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            errno = errnum;
+            ::ptracewrap::detail::throw_file_error(path);
+        }
+        m_map = static_cast<const unsigned char*>(map);
+        const ::ptracewrap::trace_file_header& h = header();
+        ::std::size_t available = (m_length - sizeof(h)) / sizeof(::ptracewrap::syscall_record);
+        if (::std::memcmp(h.magic, "PTWTRACE", 8) != 0 || h.record_size != sizeof(::ptracewrap::syscall_record) || h.count > available) {
+            ::munmap(const_cast<unsigned char*>(m_map), m_length);
+            m_map = nullptr;
+            errno = EINVAL;
+            ::ptracewrap::detail::throw_file_error(path);
+        }
+        m_count = static_cast< ::std::size_t>(h.count);
+    }
+
+    trace_reader(const trace_reader&) = delete;
+    trace_reader& operator=(const trace_reader&) = delete;
+
+    ~trace_reader() {
+        if (m_map) {
+            ::munmap(const_cast<unsigned char*>(m_map), m_length);
+        }
+    }
+
+    const ::ptracewrap::trace_file_header& header() const noexcept {
+        return *reinterpret_cast<const ::ptracewrap::trace_file_header*>(m_map);
+    }
+
+    ::std::size_t size() const noexcept {
+        return m_count;
+    }
+
+    const ::ptracewrap::syscall_record& operator[](::std::size_t i) const noexcept {
+        return begin()[i];
+    }
+
+    const ::ptracewrap::syscall_record* begin() const noexcept {
+        return reinterpret_cast<const ::ptracewrap::syscall_record*>(m_map + sizeof(::ptracewrap::trace_file_header));
+    }
+
+    const ::ptracewrap::syscall_record* end() const noexcept {
+        return begin() + m_count;
+    }
+private:
+    const unsigned char* m_map;
+    ::std::size_t m_length;
+    ::std::size_t m_count;
+};
+
+}
+
+#endif  // PTRACEWRAP_TRACE_HPP_
@@ -0,0 +1,552 @@
+#ifndef PTRACEWRAP_TRACER_POOL_HPP_
+#define PTRACEWRAP_TRACER_POOL_HPP_
+
+#include "../ptracewrap.hpp"
+
+#include <atomic>
+#include <csignal>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+namespace ptracewrap {
+
+// A change in the state of a tracee, as reported by waitpid(2)
+struct stop_event {
+    enum kind_type {
+        // The tracee exited (`exit_code`) or was killed by `signal`. It is no longer traced
+        exited,
+        killed,
+        // Signal-delivery-stop: `signal` is about to be delivered
+        signal_stop,
+        // Group-stop (With PTRACE_SEIZE, reported as PTRACE_EVENT_STOP with a stopping `signal`)
+        group_stop,
+        // Syscall-enter-stop or syscall-exit-stop (Requires PTRACE_O_TRACESYSGOOD)
+        syscall_stop,
+        // A PTRACE_EVENT_* stop (`event`), including PTRACE_INTERRUPT and the initial stop of new threads
+        event_stop
+    };
+
+    ::pid_t pid;
+    // The raw status from waitpid(2)
+    int status;
+    kind_type kind;
+    int signal;
+    int event;
+    int exit_code;
+
+    static stop_event from_status(::pid_t pid, int status) noexcept {
+        stop_event e;
+        e.pid = pid;
+        e.status = status;
+        e.signal = 0;
+        e.event = 0;
+        e.exit_code = 0;
+        if (WIFEXITED(status)) {
+            e.kind = exited;
+            e.exit_code = WEXITSTATUS(status);
+        } else if (WIFSIGNALED(status)) {
+            e.kind = killed;
+            e.signal = WTERMSIG(status);
+        } else {
+            e.signal = WSTOPSIG(status);
+            e.event = (status >> 16) & 0xff;
+            if (e.signal == (SIGTRAP | 0x80)) {
+                e.kind = syscall_stop;
+                e.signal = SIGTRAP;
+            } else if (e.event == PTRACE_EVENT_STOP && e.signal != SIGTRAP) {
+                e.kind = group_stop;
+            } else if (e.event != 0) {
+                e.kind = event_stop;
+            } else {
+                e.kind = signal_stop;
+            }
+        }
+        return e;
+    }
+
+    bool is_terminal() const noexcept {
+        return kind == exited || kind == killed;
+    }
+};
+
+// What to do with a stopped tracee after its event was handled
+struct resume_action {
+    enum how_type {
+        // Signal-delivery-stops continue with their signal, group-stops are PTRACE_LISTENed and
+        // everything else continues with no signal (Or PTRACE_SYSCALL if the last action was `syscall`)
+        automatic,
+        cont,
+        syscall,
+        listen,
+        detach,
+        // Leave the tracee stopped (e.g. to resume it later from a posted task)
+        stay_stopped
+    };
+
+    how_type how;
+    int signal;
+
+    resume_action(how_type h = automatic, int sig = 0) noexcept : how(h), signal(sig) {}
+};
+
+class tracer_pool;
+
+// One tracer thread of a `tracer_pool`. Every tracee is attached by (And so can only be controlled from) one worker
+class tracer_worker {
+public:
+    tracer_worker(const tracer_worker&) = delete;
+    tracer_worker& operator=(const tracer_worker&) = delete;
+
+    ~tracer_worker() {
+        for (auto& t : m_tracees) {
+            close_pidfd(*t.second);
+        }
+        for (int fd : { m_epoll, m_wake, m_signals }) {
+            if (fd != -1) {
+                ::close(fd);
+            }
+        }
+    }
+
+    ::std::size_t get_index() const noexcept {
+        return m_index;
+    }
+
+    // Number of tracees (Including their threads) traced by this worker
+    ::std::size_t get_tracee_count() const noexcept {
+        return m_count.load(::std::memory_order_relaxed);
+    }
+
+    // The handle for a tracee of this worker. Only call this on the worker's thread
+    ::ptracewrap::tracee& get_tracee(::pid_t pid) {
+        ::std::unique_ptr<entry>& e = m_tracees[pid];
+        if (!e) {
+            e.reset(new entry(pid));
+            m_count.fetch_add(1, ::std::memory_order_relaxed);
+        }
+        return e->handle;
+    }
+
+    // Resumes a tracee that was left stopped with `resume_action::stay_stopped`. Only call this on the worker's thread.
+    // `automatic` continues it (With PTRACE_SYSCALL if that is how it was last resumed) with `action.signal`
+    void resume(::pid_t pid, ::ptracewrap::resume_action action) {
+        entry& e = get_entry(pid);
+        if (action.how == resume_action::automatic) {
+            action.how = e.last == resume_action::syscall ? resume_action::syscall : resume_action::cont;
+        }
+        perform(e, pid, action);
+    }
+private:
+    friend class ::ptracewrap::tracer_pool;
+
+    struct entry {
+        explicit entry(::pid_t pid) : handle(pid), pidfd(-1), last(resume_action::cont) {}
+
+        ::ptracewrap::tracee handle;
+        int pidfd;
+        resume_action::how_type last;
+    };
+
+    tracer_worker(::ptracewrap::tracer_pool& pool, ::std::size_t index) :
+      m_pool(pool), m_index(index), m_epoll(-1), m_wake(-1), m_signals(-1), m_stopping(false), m_count(0) {}
+
+    entry& get_entry(::pid_t pid) {
+        get_tracee(pid);
+        return *m_tracees[pid];
+    }
+
+    void post(::std::function<void(tracer_worker&)> task) {
+        {
+            ::std::lock_guard< ::std::mutex> lock(m_mutex);
+            m_tasks.push_back(::std::move(task));
+        }
+        wake();
+    }
+
+    void wake() noexcept {
+        ::std::uint64_t one = 1;
+        ssize_t result = ::write(m_wake, &one, sizeof(one));
+        static_cast<void>(result);
+    }
+
+    void stop() {
+        m_stopping.store(true, ::std::memory_order_relaxed);
+        wake();
+    }
+
+    void open_fds() {
+        m_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+        m_wake = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        ::sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        m_signals = ::signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+        if (m_epoll == -1 || m_wake == -1 || m_signals == -1) {
+            throw ::std::system_error(::std::error_code(errno, ::std::generic_category()), "tracer_worker");
+        }
+        watch(m_wake, -1);
+        watch(m_signals, -2);
+    }
+
+    void watch(int fd, ::pid_t key) {
+        ::epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = static_cast< ::std::uint64_t>(static_cast< ::std::int64_t>(key));
+        ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void close_pidfd(entry& e) noexcept {
+        if (e.pidfd != -1) {
+            ::epoll_ctl(m_epoll, EPOLL_CTL_DEL, e.pidfd, nullptr);
+            ::close(e.pidfd);
+            e.pidfd = -1;
+        }
+    }
+
+    void attach(::pid_t pid, unsigned long options) {
+        ::ptracewrap::ptrace_w_error(PTRACE_SEIZE, pid, nullptr, reinterpret_cast<void*>(options));
+        entry& e = get_entry(pid);
+#ifdef SYS_pidfd_open
+        e.pidfd = static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+        if (e.pidfd != -1) {
+            watch(e.pidfd, pid);
+        }
+#endif
+    }
+
+    // Run on the worker's own thread
+    void run();
+
+    void run_tasks() {
+        ::std::deque< ::std::function<void(tracer_worker&)> > tasks;
+        {
+            ::std::lock_guard< ::std::mutex> lock(m_mutex);
+            tasks.swap(m_tasks);
+        }
+        for (::std::function<void(tracer_worker&)>& task : tasks) {
+            try {
+                task(*this);
+            } catch (...) {
+                report_error();
+            }
+        }
+    }
+
+    // Passes the exception being handled to the pool
+    void report_error() noexcept;
+
+    // Handles every pending event of this worker's tracees
+    void reap();
+
+    // Resumes the tracee after `event` as the callback returned
+    void apply(entry& e, const ::ptracewrap::stop_event& event, ::ptracewrap::resume_action action) {
+        if (action.how == resume_action::automatic) {
+            switch (event.kind) {
+            case stop_event::signal_stop:
+                action.how = e.last == resume_action::syscall ? resume_action::syscall : resume_action::cont;
+                action.signal = event.signal;
+                break;
+            case stop_event::group_stop:
+                action.how = resume_action::listen;
+                break;
+            default:
+                action.how = e.last == resume_action::syscall ? resume_action::syscall : resume_action::cont;
+                break;
+            }
+        }
+        perform(e, event.pid, action);
+    }
+
+    // `action.how` is not `automatic`
+    void perform(entry& e, ::pid_t pid, ::ptracewrap::resume_action action) {
+        ::ptracewrap::tracee& t = e.handle;
+        switch (action.how) {
+        case resume_action::cont:
+            t.cont(action.signal);
+            break;
+        case resume_action::syscall:
+            t.syscall(action.signal);
+            break;
+        case resume_action::listen:
+            t.ptrace_w_error(PTRACE_LISTEN);
+            break;
+        case resume_action::detach:
+            t.detach(action.signal);
+            forget(pid);
+            return;
+        default:
+            return;
+        }
+        e.last = action.how;
+    }
+
+    void forget(::pid_t pid) {
+        ::std::unordered_map< ::pid_t, ::std::unique_ptr<entry> >::iterator it = m_tracees.find(pid);
+        if (it != m_tracees.end()) {
+            close_pidfd(*it->second);
+            m_tracees.erase(it);
+            m_count.fetch_sub(1, ::std::memory_order_relaxed);
+        }
+    }
+
+    ::ptracewrap::tracer_pool& m_pool;
+    ::std::size_t m_index;
+    int m_epoll;
+    int m_wake;
+    int m_signals;
+    ::std::atomic<bool> m_stopping;
+    ::std::atomic< ::std::size_t> m_count;
+    ::std::mutex m_mutex;
+    ::std::deque< ::std::function<void(tracer_worker&)> > m_tasks;
+    ::std::unordered_map< ::pid_t, ::std::unique_ptr<entry> > m_tracees;
+    ::std::thread m_thread;
+};
+
+// Traces many processes at once on a pool of threads. A tracee is seized by one worker thread, and since ptrace
+// requests have to come from the thread that attached, all of its events are handled on that thread. Each worker has
+// its own task queue, so a slow tracee only delays the tracees of its own worker.
+//
+// Workers sleep in epoll(7) on an eventfd (Posted tasks and wake-ups), a signalfd for SIGCHLD and a pidfd per tracee.
+// A pidfd only becomes readable when its process exits, so stops are only announced by SIGCHLD, which is process wide
+// and coalesces: the worker whose signalfd reads it can't tell whose tracees changed state, so it wakes every worker
+// and each one polls waitpid(2) for its own tracees. Every batch of stops costs one wake-up and one waitpid(2) call
+// per worker, so this suits a few workers with many tracees each rather than many workers. A SIGCHLD delivered to a
+// thread that doesn't block it is lost to the signalfds, so workers also poll every 100ms.
+//
+// Only the worker threads block SIGCHLD, and the caller's signal mask is left as it was. Block it in the other threads
+// of the process too for stops to be handled without waiting for the poll.
+//
+// Callbacks and tasks run on a worker and must not wait for another worker (e.g. with `seize_on` for it, which
+// deadlocks if that worker is doing the same). Use `post()` for that instead
+class tracer_pool {
+public:
+    // Called on the worker thread for every event. The tracee is resumed as returned afterwards
+    typedef ::std::function< ::ptracewrap::resume_action(::ptracewrap::tracer_worker&, const ::ptracewrap::stop_event&)> callback_type;
+    // Called on the worker thread with an exception thrown by the callback, by a posted task or by resuming a tracee.
+    // The worker carries on afterwards
+    typedef ::std::function<void(::ptracewrap::tracer_worker&, ::std::exception_ptr)> error_callback_type;
+
+    // Without `error_callback`, the first exception is kept for `get_error()` and later ones are dropped
+    tracer_pool(::std::size_t workers, callback_type callback, error_callback_type error_callback = error_callback_type()) :
+      m_callback(::std::move(callback)), m_error_callback(::std::move(error_callback)), m_next(0) {
+        if (workers == 0) {
+            workers = 1;
+        }
+        for (::std::size_t i = 0; i < workers; ++i) {
+            m_workers.emplace_back(new tracer_worker(*this, i));
+            m_workers.back()->open_fds();
+        }
+
+        // The workers inherit SIGCHLD blocked, and the caller's mask is put back afterwards
+        ::sigset_t mask;
+        ::sigset_t old_mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        ::pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+        try {
+            for (::std::unique_ptr<tracer_worker>& w : m_workers) {
+                tracer_worker* worker = w.get();
+                w->m_thread = ::std::thread([worker]() { worker->run(); });
+            }
+        } catch (...) {
+            ::pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+            // Joined, or destroying them would call std::terminate
+            stop();
+            throw;
+        }
+        ::pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    }
+
+    tracer_pool(const tracer_pool&) = delete;
+    tracer_pool& operator=(const tracer_pool&) = delete;
+
+    // Stops the workers. Tracees that are still attached are detached by the kernel when their tracer thread exits
+    ~tracer_pool() {
+        stop();
+    }
+
+    ::std::size_t get_worker_count() const noexcept {
+        return m_workers.size();
+    }
+
+    ::ptracewrap::tracer_worker& get_worker(::std::size_t index) noexcept {
+        return *m_workers[index];
+    }
+
+    // PTRACE_SEIZEs `pid` with `options` (PTRACE_O_*) on the worker with the fewest tracees.
+    // Returns the index of that worker. Throws a `ptrace_error` if the seize fails
+    ::std::size_t seize(::pid_t pid, unsigned long options = 0) {
+        ::std::size_t index = m_next.fetch_add(1, ::std::memory_order_relaxed) % m_workers.size();
+        for (::std::size_t i = 0; i < m_workers.size(); ++i) {
+            if (m_workers[i]->get_tracee_count() < m_workers[index]->get_tracee_count()) {
+                index = i;
+            }
+        }
+        seize_on(index, pid, options);
+        return index;
+    }
+
+    // Like `seize`, on worker `worker`. From that worker's own thread it attaches right away, and otherwise it waits
+    // for the worker to do it, so a callback or task must not call it for another worker
+    void seize_on(::std::size_t worker, ::pid_t pid, unsigned long options = 0) {
+        tracer_worker& w = *m_workers[worker];
+        if (::std::this_thread::get_id() == w.m_thread.get_id()) {
+            // Called from that worker (e.g. in the callback), which can't also run the task while waiting for it
+            w.attach(pid, options);
+            return;
+        }
+        ::std::shared_ptr< ::std::promise<void> > done = ::std::make_shared< ::std::promise<void> >();
+        m_workers[worker]->post([done, pid, options](tracer_worker& w) {
+            try {
+                w.attach(pid, options);
+                done->set_value();
+            } catch (...) {
+                done->set_exception(::std::current_exception());
+            }
+        });
+        done->get_future().get();
+    }
+
+    // Runs `task` on a worker's thread (e.g. to make ptrace calls for one of its tracees)
+    void post(::std::size_t worker, ::std::function<void(::ptracewrap::tracer_worker&)> task) {
+        m_workers[worker]->post(::std::move(task));
+    }
+
+    // The first exception caught by a worker when there is no error callback, or nullptr
+    ::std::exception_ptr get_error() const {
+        ::std::lock_guard< ::std::mutex> lock(m_error_mutex);
+        return m_error;
+    }
+
+    void stop() {
+        for (::std::unique_ptr<tracer_worker>& w : m_workers) {
+            w->stop();
+        }
+        for (::std::unique_ptr<tracer_worker>& w : m_workers) {
+            if (w->m_thread.joinable()) {
+                w->m_thread.join();
+            }
+        }
+    }
+private:
+    friend class ::ptracewrap::tracer_worker;
+
+    // A SIGCHLD may have been read by another worker's signalfd, so every worker checks for events
+    void wake_all() noexcept {
+        for (::std::unique_ptr<tracer_worker>& w : m_workers) {
+            w->wake();
+        }
+    }
+
+    void report_error(tracer_worker& worker, ::std::exception_ptr error) noexcept {
+        if (m_error_callback) {
+            try {
+                m_error_callback(worker, error);
+                return;
+            } catch (...) {
+                error = ::std::current_exception();
+            }
+        }
+        ::std::lock_guard< ::std::mutex> lock(m_error_mutex);
+        if (!m_error) {
+            m_error = error;
+        }
+    }
+
+    callback_type m_callback;
+    error_callback_type m_error_callback;
+    mutable ::std::mutex m_error_mutex;
+    ::std::exception_ptr m_error;
+    ::std::atomic< ::std::size_t> m_next;
+    ::std::vector< ::std::unique_ptr<tracer_worker> > m_workers;
+};
+
+inline void tracer_worker::report_error() noexcept {
+    m_pool.report_error(*this, ::std::current_exception());
+}
+
+inline void tracer_worker::run() {
+    const int max_events = 64;
+    ::epoll_event events[max_events];
+    while (!m_stopping.load(::std::memory_order_relaxed)) {
+        // A lost SIGCHLD (From a thread that doesn't block it) only delays events by the timeout
+        int n = ::epoll_wait(m_epoll, events, max_events, 100);
+        bool broadcast = false;
+        for (int i = 0; i < n; ++i) {
+            ::std::int64_t key = static_cast< ::std::int64_t>(events[i].data.u64);
+            if (key == -1) {
+                ::std::uint64_t count;
+                ssize_t result = ::read(m_wake, &count, sizeof(count));
+                static_cast<void>(result);
+            } else if (key == -2) {
+                ::signalfd_siginfo info;
+                while (::read(m_signals, &info, sizeof(info)) == static_cast<ssize_t>(sizeof(info))) {
+                    broadcast = true;
+                }
+            }
+        }
+        if (broadcast && m_pool.m_workers.size() > 1) {
+            m_pool.wake_all();
+        }
+        run_tasks();
+        try {
+            reap();
+        } catch (...) {
+            report_error();
+        }
+    }
+}
+
+inline void tracer_worker::reap() {
+    for (;;) {
+        int status;
+        // __WNOTHREAD: only this thread's tracees
+        ::pid_t pid = ::waitpid(-1, &status, __WALL | __WNOTHREAD | WNOHANG);
+        if (pid <= 0) {
+            return;
+        }
+        ::ptracewrap::stop_event event = ::ptracewrap::stop_event::from_status(pid, status);
+        entry& e = get_entry(pid);
+        ::ptracewrap::resume_action action;
+        try {
+            action = m_pool.m_callback(*this, event);
+        } catch (...) {
+            // The tracee is left stopped, the error callback can resume it
+            action = resume_action::stay_stopped;
+            report_error();
+        }
+        if (event.is_terminal()) {
+            forget(pid);
+            continue;
+        }
+        try {
+            apply(e, event, action);
+        } catch (const ::ptracewrap::ptrace_error& error) {
+            // ESRCH: the tracee was killed while stopped, its exit will be reported next
+            if (error.get_errno() != ESRCH) {
+                report_error();
+            }
+        } catch (...) {
+            report_error();
+        }
+    }
+}
+
+}
+
+#endif  // PTRACEWRAP_TRACER_POOL_HPP_
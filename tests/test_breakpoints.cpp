@@ -0,0 +1,154 @@
+// breakpoint_manager: batched patching, the memory overlay, hitting breakpoints, and injecting a syscall on top of one
+#include "test_common.hpp"
+
+#include <ptracewrap/breakpoints.hpp>
+#if defined(__x86_64__) && !defined(__ILP32__)
+#include <ptracewrap/inject.hpp>
+#include <sys/syscall.h>
+#endif
+
+#include <vector>
+
+static volatile int counter = 0;
+
+__attribute__((noinline)) static void target() {
+    counter = counter + 1;
+    asm volatile("");
+}
+
+static void test_patching() {
+    const ::std::size_t pg = ::test::page_size();
+    ::test::test_pages pages;
+    ::test::child c;
+    ::ptracewrap::tracee t(c.get_pid());
+    ::ptracewrap::breakpoint_manager manager(t);
+    CHECK(t.get_memory_overlay() == &manager);
+
+    // Breakpoints every 3 bytes of the writable pages, on the read-only ones too
+    ::std::vector< ::std::uintptr_t> addresses;
+    for (::std::size_t i = 0; i < 8 * pg; i += 3) {
+        addresses.push_back(reinterpret_cast< ::std::uintptr_t>(pages.rw + i));
+    }
+    addresses.push_back(reinterpret_cast< ::std::uintptr_t>(pages.ro + 1));
+    CHECK(manager.insert(addresses) == addresses.size());
+    CHECK(manager.get_page_writes() == 9);
+    CHECK(manager.insert(addresses) == 0);
+    CHECK(manager.size() == addresses.size());
+
+    // Through the tracee the memory looks unpatched, and underneath it is patched
+    ::std::vector<char> back(8 * pg);
+    t.read_bytes(pages.rw, back.data(), back.size());
+    CHECK(::std::memcmp(back.data(), pages.rw, back.size()) == 0);
+    t.read_bytes_raw(pages.rw, back.data(), back.size());
+    for (::std::size_t i = 0; i < back.size(); ++i) {
+        CHECK(back[i] == (i % 3 == 0 ? static_cast<char>(0xcc) : pages.rw[i]));
+    }
+    ::ptracewrap::read_bytes(c.get_pid(), pages.ro, back.data(), 2);
+    CHECK(back[0] == pages.ro[0] && back[1] == static_cast<char>(0xcc));
+
+    // Writing over a breakpoint changes its original byte and keeps the int3
+    const char values[4] = { 1, 2, 3, 4 };
+    t.write_bytes(pages.rw + 2, values, 4);
+    CHECK(manager.original(reinterpret_cast< ::std::uintptr_t>(pages.rw + 3)) == 2);
+    ::ptracewrap::read_bytes(c.get_pid(), pages.rw + 2, back.data(), 4);
+    CHECK(back[0] == 1 && back[1] == static_cast<char>(0xcc) && back[2] == 3 && back[3] == 4);
+    t.read_bytes(pages.rw + 2, back.data(), 4);
+    CHECK(::std::memcmp(back.data(), values, 4) == 0);
+    // A raw write replaces the int3 itself
+    const char raw = 9;
+    t.write_bytes_raw(pages.rw + 6, &raw, 1);
+    CHECK(manager.original(reinterpret_cast< ::std::uintptr_t>(pages.rw + 6)) == pages.rw[6]);
+    t.read_bytes(pages.rw + 6, back.data(), 1);
+    CHECK(back[0] == pages.rw[6]);
+    t.read_bytes_raw(pages.rw + 6, back.data(), 1);
+    CHECK(back[0] == 9);
+
+    CHECK(manager.remove(::std::vector< ::std::uintptr_t>(addresses.begin(), addresses.begin() + 100)) == 100);
+    CHECK(manager.size() == addresses.size() - 100);
+    CHECK(!manager.contains(addresses[0]) && manager.contains(addresses[100]));
+    manager.remove_all();
+    CHECK(manager.size() == 0);
+    ::ptracewrap::read_bytes(c.get_pid(), pages.rw + 2, back.data(), 4);
+    CHECK(::std::memcmp(back.data(), values, 4) == 0);
+    ::ptracewrap::read_bytes(c.get_pid(), pages.ro, back.data(), 2 * pg);
+    CHECK(::std::memcmp(back.data(), pages.ro, 2 * pg) == 0);
+
+    // Unmapped
+    CHECK_THROWS_PTRACE_ERROR(manager.insert(reinterpret_cast< ::std::uintptr_t>(pages.unmapped)));
+    CHECK(manager.size() == 0);
+}
+
+static void test_hits() {
+    ::pid_t pid = ::fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        ::ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        ::raise(SIGSTOP);
+        for (int i = 0; i < 5; ++i) {
+            target();
+        }
+        ::_exit(counter);
+    }
+    int status;
+    CHECK(::waitpid(pid, &status, 0) == pid && WIFSTOPPED(status));
+    CHECK(::ptrace(PTRACE_SETOPTIONS, pid, nullptr, reinterpret_cast<void*>(PTRACE_O_EXITKILL)) == 0);
+    ::ptracewrap::tracee t(pid);
+    ::ptracewrap::breakpoint_manager manager(t);
+    const ::std::uintptr_t address = reinterpret_cast< ::std::uintptr_t>(&target);
+    CHECK(manager.insert(address));
+    int hits = 0;
+    t.cont();
+    for (;;) {
+        CHECK(::waitpid(pid, &status, 0) == pid);
+        if (WIFEXITED(status)) {
+            break;
+        }
+        CHECK(WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP);
+        CHECK(manager.hit() == address);
+        ++hits;
+        int step = manager.step_over();
+        CHECK(WIFSTOPPED(step) && WSTOPSIG(step) == SIGTRAP);
+        // Put back after the step
+        CHECK(manager.contains(address));
+        t.cont();
+    }
+    CHECK(hits == 5 && WEXITSTATUS(status) == 5);
+}
+
+#if defined(__x86_64__) && !defined(__ILP32__)
+// The injected syscall instruction used to be written through the overlay, which turned it into int3s
+static void test_inject_at_breakpoint() {
+    ::test::child c;
+    c.cont_and_stop();
+    ::ptracewrap::tracee t(c.get_pid());
+    ::ptracewrap::breakpoint_manager manager(t);
+    const ::std::uintptr_t pc = static_cast< ::std::uintptr_t>(t.registers().get_regs().rip);
+    unsigned char code[8];
+    t.read_bytes(reinterpret_cast<void*>(pc), code, sizeof(code));
+    CHECK(manager.insert(::std::vector< ::std::uintptr_t>{ pc, pc + 1, pc + 5 }) == 3);
+
+    CHECK(::ptracewrap::remote_syscall(t, SYS_getpid) == c.get_pid());
+
+    // The breakpoints and their original bytes are as they were
+    unsigned char after[8];
+    t.read_bytes(reinterpret_cast<void*>(pc), after, sizeof(after));
+    CHECK(::std::memcmp(after, code, sizeof(code)) == 0);
+    CHECK(manager.original(pc) == code[0] && manager.original(pc + 1) == code[1] && manager.original(pc + 5) == code[5]);
+    ::ptracewrap::read_bytes(c.get_pid(), reinterpret_cast<void*>(pc), after, sizeof(after));
+    for (::std::size_t i = 0; i < sizeof(after); ++i) {
+        CHECK(after[i] == (i == 0 || i == 1 || i == 5 ? 0xcc : code[i]));
+    }
+    manager.remove_all();
+    ::ptracewrap::read_bytes(c.get_pid(), reinterpret_cast<void*>(pc), after, sizeof(after));
+    CHECK(::std::memcmp(after, code, sizeof(code)) == 0);
+}
+#endif
+
+int main() {
+    test_patching();
+    test_hits();
+#if defined(__x86_64__) && !defined(__ILP32__)
+    test_inject_at_breakpoint();
+#endif
+    return 0;
+}
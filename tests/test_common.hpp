@@ -0,0 +1,146 @@
+#ifndef PTRACEWRAP_TESTS_TEST_COMMON_HPP_
+#define PTRACEWRAP_TESTS_TEST_COMMON_HPP_
+
+#include <ptracewrap.hpp>
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Fails the test (Exit status 1) if `condition` is false
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            ::std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ::std::exit(1); \
+        } \
+    } while (0)
+
+// Checks that `expression` throws a `ptrace_error`
+#define CHECK_THROWS_PTRACE_ERROR(expression) \
+    do { \
+        bool thrown = false; \
+        try { \
+            static_cast<void>(expression); \
+        } catch (const ::ptracewrap::ptrace_error&) { \
+            thrown = true; \
+        } \
+        CHECK(thrown); \
+    } while (0)
+
+namespace test {
+
+inline ::std::size_t page_size() {
+    return static_cast< ::std::size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+// Memory set up before forking, so the child has the same contents at the same addresses
+struct test_pages {
+    // 8 writable pages, byte `i` is `i * 7 + 1`
+    char* rw;
+    // 2 read-only pages, byte `i` is `i * 3 + 5`
+    char* ro;
+    // 1 PROT_NONE page, byte `i` is `i + 9`
+    char* none;
+    // An address that is never mapped
+    char* unmapped;
+
+    test_pages() {
+        ::std::size_t pg = ::test::page_size();
+        rw = map(8, 7, 1);
+        ro = map(2, 3, 5);
+        ::mprotect(ro, 2 * pg, PROT_READ);
+        none = map(1, 1, 9);
+        ::mprotect(none, pg, PROT_NONE);
+        unmapped = reinterpret_cast<char*>(8);
+    }
+private:
+    static char* map(::std::size_t pages, int multiplier, int add) {
+        ::std::size_t n = pages * ::test::page_size();
+        void* p = ::mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        CHECK(p != MAP_FAILED);
+        char* c = static_cast<char*>(p);
+        for (::std::size_t i = 0; i < n; ++i) {
+            c[i] = static_cast<char>(static_cast<int>(i) * multiplier + add);
+        }
+        return c;
+    }
+};
+
+// A forked child that is traced by this process (With PTRACE_TRACEME) and stopped. It is killed when this is destroyed
+class child {
+public:
+    child() {
+        m_pid = ::fork();
+        CHECK(m_pid >= 0);
+        if (m_pid == 0) {
+            ::ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+            ::raise(SIGSTOP);
+            for (;;) {
+                ::pause();
+            }
+        }
+        int status;
+        CHECK(::waitpid(m_pid, &status, 0) == m_pid && WIFSTOPPED(status));
+        // So a failed CHECK (Which exits without running destructors) doesn't leave the child behind
+        CHECK(::ptrace(PTRACE_SETOPTIONS, m_pid, nullptr, reinterpret_cast<void*>(PTRACE_O_EXITKILL)) == 0);
+    }
+
+    ~child() {
+        ::kill(m_pid, SIGKILL);
+        int status;
+        ::waitpid(m_pid, &status, 0);
+    }
+
+    child(const child&) = delete;
+    child& operator=(const child&) = delete;
+
+    ::pid_t get_pid() const noexcept {
+        return m_pid;
+    }
+
+    // Continues the child (Which is in pause()) and stops it again
+    void cont_and_stop() const {
+        CHECK(::ptrace(PTRACE_CONT, m_pid, nullptr, nullptr) == 0);
+        CHECK(::kill(m_pid, SIGSTOP) == 0);
+        int status;
+        CHECK(::waitpid(m_pid, &status, 0) == m_pid && WIFSTOPPED(status));
+    }
+private:
+    ::pid_t m_pid;
+};
+
+// A unique path in the temporary directory, which is removed when this is destroyed
+class temp_file {
+public:
+    temp_file() {
+        const char* dir = ::std::getenv("TMPDIR");
+        m_path = ::std::string(dir != nullptr && *dir != '\0' ? dir : "/tmp") + "/ptracewrap_test_XXXXXX";
+        int fd = ::mkstemp(&m_path[0]);
+        CHECK(fd >= 0);
+        ::close(fd);
+    }
+
+    ~temp_file() {
+        ::unlink(m_path.c_str());
+    }
+
+    temp_file(const temp_file&) = delete;
+    temp_file& operator=(const temp_file&) = delete;
+
+    const ::std::string& get_path() const noexcept {
+        return m_path;
+    }
+private:
+    ::std::string m_path;
+};
+
+}
+
+#endif  // PTRACEWRAP_TESTS_TEST_COMMON_HPP_
@@ -0,0 +1,121 @@
+// dump_memory / dump_reader round-trip, sparse output, filters, errors and corrupt files
+#include "test_common.hpp"
+
+#include <ptracewrap/dump.hpp>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <new>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <system_error>
+
+static int open_fds() {
+    int count = 0;
+    DIR* dir = ::opendir("/proc/self/fd");
+    CHECK(dir != nullptr);
+    while (::readdir(dir) != nullptr) {
+        ++count;
+    }
+    ::closedir(dir);
+    return count;
+}
+
+static int reader_error(const ::std::string& path) {
+    try {
+        ::ptracewrap::dump_reader reader(path);
+    } catch (const ::std::system_error& e) {
+        return e.code().value();
+    }
+    return 0;
+}
+
+int main() {
+    const ::std::size_t pg = ::test::page_size();
+    ::test::test_pages pages;
+    // A third of the pages aren't zero
+    const ::std::size_t big_size = ::std::size_t(16) << 20;
+    char* big = static_cast<char*>(::mmap(nullptr, big_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    CHECK(big != MAP_FAILED);
+    for (::std::size_t i = 0; i < big_size; i += 3 * pg) {
+        ::std::memset(big + i, static_cast<int>(i / pg % 250) + 1, pg);
+    }
+    ::test::child c;
+    ::test::temp_file file;
+
+    ::ptracewrap::dump_options options;
+    options.threads = 3;
+    options.chunk_size = ::std::size_t(1) << 20;
+    ::ptracewrap::dump_result result = ::ptracewrap::dump_memory(c.get_pid(), file.get_path(), options);
+    CHECK(result.bytes_zero >= big_size / 2);
+    struct ::stat st;
+    CHECK(::stat(file.get_path().c_str(), &st) == 0);
+    CHECK(static_cast< ::std::uint64_t>(st.st_blocks) * 512 < static_cast< ::std::uint64_t>(st.st_size) / 2);
+    {
+        ::ptracewrap::dump_reader reader(file.get_path());
+        CHECK(reader.size() == result.regions);
+        CHECK(reader.header().page_size == pg);
+        const char* data = reader.find(reinterpret_cast< ::std::uintptr_t>(big));
+        CHECK(data != nullptr && ::std::memcmp(data, big, big_size) == 0);
+        data = reader.find(reinterpret_cast< ::std::uintptr_t>(pages.rw));
+        CHECK(data != nullptr && ::std::memcmp(data, pages.rw, 8 * pg) == 0);
+        data = reader.find(reinterpret_cast< ::std::uintptr_t>(pages.ro + 1));
+        CHECK(data != nullptr && ::std::memcmp(data, pages.ro + 1, 2 * pg - 1) == 0);
+        // Not readable
+        CHECK(reader.find(reinterpret_cast< ::std::uintptr_t>(pages.none)) == nullptr);
+        bool stack = false;
+        for (::std::size_t i = 0; i < reader.size(); ++i) {
+            CHECK(i == 0 || reader.region(i - 1).end <= reader.region(i).start);
+            CHECK(reader.path(i) != "[vsyscall]");
+            if (reader.path(i) == "[stack]") {
+                stack = true;
+            }
+        }
+        CHECK(stack);
+    }
+
+    ::ptracewrap::dump_options only_stack;
+    only_stack.filter = [](const ::ptracewrap::memory_region&, const ::std::string& path) { return path == "[stack]"; };
+    CHECK(::ptracewrap::dump_memory(c.get_pid(), file.get_path(), only_stack).regions == 1);
+
+    // Exceptions reach the caller, and the file isn't left open
+    int fds = open_fds();
+    ::ptracewrap::dump_options throwing;
+    throwing.filter = [](const ::ptracewrap::memory_region&, const ::std::string&) -> bool { throw ::std::runtime_error("filter"); };
+    bool thrown = false;
+    try {
+        ::ptracewrap::dump_memory(c.get_pid(), file.get_path(), throwing);
+    } catch (const ::std::runtime_error& e) {
+        thrown = ::std::strcmp(e.what(), "filter") == 0;
+    }
+    CHECK(thrown);
+    // Each copying thread fails to allocate its buffer
+    ::ptracewrap::dump_options huge;
+    huge.threads = 3;
+    huge.chunk_size = ::std::size_t(1) << 62;
+    thrown = false;
+    try {
+        ::ptracewrap::dump_memory(c.get_pid(), file.get_path(), huge);
+    } catch (const ::std::bad_alloc&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(open_fds() == fds);
+
+    // A region count that overflows when multiplied by the size of a region
+    ::ptracewrap::dump_memory(c.get_pid(), file.get_path(), only_stack);
+    ::ptracewrap::dump_file_header header;
+    int fd = ::open(file.get_path().c_str(), O_RDWR | O_CLOEXEC);
+    CHECK(fd != -1 && ::pread(fd, &header, sizeof(header), 0) == static_cast< ::ssize_t>(sizeof(header)));
+    header.region_count = ::std::uint64_t(1) << 60;
+    header.strings_offset = sizeof(header);
+    header.strings_size = 0;
+    CHECK(::pwrite(fd, &header, sizeof(header), 0) == static_cast< ::ssize_t>(sizeof(header)));
+    ::close(fd);
+    CHECK(reader_error(file.get_path()) == EINVAL);
+
+    CHECK(::truncate(file.get_path().c_str(), 0) == 0);
+    CHECK(reader_error(file.get_path()) == EINVAL);
+    CHECK(reader_error(file.get_path() + ".missing") == ENOENT);
+    return 0;
+}
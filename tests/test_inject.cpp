@@ -0,0 +1,161 @@
+// remote_syscall and shared_mapping, including failures part way through shared_mapping::create. Built with
+// PTRACEWRAP_INSTRUMENTATION to check that transfers inside a shared_mapping make no syscalls
+#include "test_common.hpp"
+
+#include <ptracewrap/inject.hpp>
+
+#include <atomic>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int fd_count(::pid_t pid) {
+    int count = 0;
+    DIR* dir = ::opendir(("/proc/" + ::std::to_string(pid) + "/fd").c_str());
+    CHECK(dir != nullptr);
+    while (::readdir(dir) != nullptr) {
+        ++count;
+    }
+    ::closedir(dir);
+    return count;
+}
+
+// Bytes below the tracee's stack pointer, where `shared_mapping::create` puts the name
+static ::std::vector<char> below_stack(::ptracewrap::tracee& t) {
+    ::std::vector<char> bytes(1024);
+    t.read_bytes(reinterpret_cast<void*>(t.registers().get_regs().rsp - bytes.size()), bytes.data(), bytes.size());
+    return bytes;
+}
+
+static int create_error(::ptracewrap::tracee& t, ::std::size_t size, const char* name) {
+    try {
+        ::ptracewrap::shared_mapping::create(t, size, name);
+    } catch (const ::std::system_error& e) {
+        return e.code().value();
+    }
+    return 0;
+}
+
+// Every ptrace(2) and process_vm_{readv,writev}(2) call made since the last reset
+static ::std::uint64_t call_count() {
+    ::std::uint64_t calls = 0;
+    ::ptracewrap::get_instrumentation_snapshot().for_each([&](const ::std::string&, const ::ptracewrap::ptrace_call_stats& stats) {
+        calls += stats.calls;
+    });
+    return calls;
+}
+
+int main() {
+    const ::std::size_t pg = ::test::page_size();
+    // Code that ends at a page followed by a gap, inherited by the child
+    char* code = static_cast<char*>(::mmap(nullptr, 2 * pg, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    CHECK(code != MAP_FAILED);
+    CHECK(::munmap(code + pg, pg) == 0);
+    ::test::child c;
+    // In pause(), so there is a syscall to restart when it is resumed
+    c.cont_and_stop();
+    ::ptracewrap::tracee t(c.get_pid());
+    t.enable_memory_map();
+
+    const ::ptracewrap::register_cache::regs_type before = t.registers().get_regs();
+    CHECK(::ptracewrap::remote_syscall(t, SYS_getpid) == c.get_pid());
+    CHECK(::ptracewrap::remote_syscall(t, SYS_close, 12345) == -EBADF);
+    const ::ptracewrap::register_cache::regs_type after = t.registers().get_regs();
+    CHECK(::std::memcmp(&before, &after, sizeof(before)) == 0);
+
+    // Only the 2 bytes of `syscall` are patched, so it works in the last 2 bytes of an executable mapping
+    ::ptracewrap::register_cache::regs_type at_end = before;
+    at_end.rip = reinterpret_cast< ::std::uintptr_t>(code + pg - 2);
+    t.registers().set_regs(at_end);
+    CHECK(::ptracewrap::remote_syscall(t, SYS_getpid) == c.get_pid());
+    CHECK(t.registers().get_regs().rip == at_end.rip);
+    char tail[2];
+    t.read_bytes(code + pg - 2, tail, 2);
+    CHECK(tail[0] == 0 && tail[1] == 0);
+    t.registers().set_regs(before);
+
+    // A signal that arrives during the step is suppressed, and then sent again
+    CHECK(::kill(c.get_pid(), SIGUSR1) == 0);
+    CHECK(::ptracewrap::remote_syscall(t, SYS_getppid) == ::getpid());
+    CHECK(::ptrace(PTRACE_CONT, c.get_pid(), nullptr, nullptr) == 0);
+    int status;
+    CHECK(::waitpid(c.get_pid(), &status, 0) == c.get_pid() && WIFSTOPPED(status) && WSTOPSIG(status) == SIGUSR1);
+    t.registers().invalidate();
+
+    // A real SIGTRAP that arrives during the step isn't taken for the end of the step, and is sent again too
+    CHECK(::kill(c.get_pid(), SIGTRAP) == 0);
+    CHECK(::ptracewrap::remote_syscall(t, SYS_getppid) == ::getpid());
+    CHECK(::ptrace(PTRACE_CONT, c.get_pid(), nullptr, nullptr) == 0);
+    CHECK(::waitpid(c.get_pid(), &status, 0) == c.get_pid() && WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP);
+    t.registers().invalidate();
+
+    CHECK(::ptracewrap::detail::thread_group_id(c.get_pid()) == c.get_pid());
+    // A thread that isn't the main thread of its process, while it is still running
+    ::std::atomic< ::pid_t> thread_tid(0);
+    ::std::atomic<bool> checked(false);
+    ::std::thread thread([&] {
+        thread_tid = static_cast< ::pid_t>(::syscall(SYS_gettid));
+        while (!checked) {
+            ::usleep(1000);
+        }
+    });
+    while (thread_tid == 0) {
+        ::usleep(1000);
+    }
+    CHECK(thread_tid != ::getpid() && ::ptracewrap::detail::thread_group_id(thread_tid) == ::getpid());
+    checked = true;
+    thread.join();
+
+    const int fds = fd_count(c.get_pid());
+    const ::std::vector<char> stack = below_stack(t);
+    {
+        ::ptracewrap::shared_mapping mapping = ::ptracewrap::shared_mapping::create(t, 10000, "exchange");
+        CHECK(mapping.size() == 3 * pg);
+        CHECK(fd_count(c.get_pid()) == fds);
+        CHECK(below_stack(t) == stack);
+        static_cast<char*>(mapping.get_local())[100] = 77;
+        char value;
+        ::ptracewrap::reset_instrumentation();
+        t.read_bytes(reinterpret_cast<void*>(mapping.get_remote() + 100), &value, 1);
+        CHECK(value == 77);
+        t.write_bytes(reinterpret_cast<void*>(mapping.get_remote() + 200), "hi", 3);
+        CHECK(::std::strcmp(static_cast<char*>(mapping.local(reinterpret_cast<void*>(mapping.get_remote() + 200))), "hi") == 0);
+        long number = ::ptracewrap::read<long>(t, reinterpret_cast<long*>(mapping.get_remote() + 8));
+        ::ptracewrap::write(t, reinterpret_cast<long*>(mapping.get_remote() + 16), number + 5);
+        CHECK(*static_cast<long*>(mapping.local(reinterpret_cast<void*>(mapping.get_remote() + 16))) == 5);
+        CHECK(call_count() == 0);
+        // Written by the tracee itself
+        CHECK(::ptracewrap::remote_syscall(t, SYS_getcwd, static_cast<long>(mapping.get_remote() + pg), 256) > 0);
+        ::ptracewrap::reset_instrumentation();
+        char cwd[2];
+        t.read_bytes(reinterpret_cast<void*>(mapping.get_remote() + pg), cwd, 2);
+        CHECK(cwd[0] == '/' && call_count() == 0);
+        // Anywhere else still goes through the kernel
+        CHECK(below_stack(t) == stack && call_count() != 0);
+        CHECK(mapping.contains(reinterpret_cast<void*>(mapping.get_remote()), 3 * pg));
+        CHECK(!mapping.contains(reinterpret_cast<void*>(mapping.get_remote()), 3 * pg + 1));
+        CHECK(t.get_memory_map()->find(reinterpret_cast<void*>(mapping.get_remote())) != nullptr);
+
+        ::std::uintptr_t remote = mapping.get_remote();
+        mapping.unmap(t);
+        CHECK(mapping.get_local() == nullptr);
+        CHECK(!t.remove_local_mapping(remote));
+        CHECK(!::ptracewrap::read_bytes(c.get_pid(), reinterpret_cast<void*>(remote), &value, 1, ::std::nothrow));
+        CHECK(t.get_memory_map()->find(reinterpret_cast<void*>(remote)) == nullptr);
+    }
+
+    // memfd_create fails (The name is too long), and the stack is still restored
+    ::std::string long_name(300, 'x');
+    CHECK(create_error(t, pg, long_name.c_str()) == EINVAL);
+    CHECK(below_stack(t) == stack);
+    // Mapping it here fails after the memfd was created, and the tracee's descriptor is still closed
+    CHECK(create_error(t, ::std::size_t(1) << 50, "huge") == ENOMEM);
+    CHECK(below_stack(t) == stack);
+    CHECK(fd_count(c.get_pid()) == fds);
+    return 0;
+}
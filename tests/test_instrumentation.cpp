@@ -0,0 +1,60 @@
+// ptrace(2) / process_vm_readv(2) call counting, from several threads. Built with and without PTRACEWRAP_INSTRUMENTATION
+#include "test_common.hpp"
+
+#include <cerrno>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main() {
+    const ::std::size_t pg = ::test::page_size();
+    ::test::test_pages pages;
+    ::test::child c;
+    ::ptracewrap::reset_instrumentation();
+
+    ::std::vector<char> buffer(2 * pg);
+    ::ptracewrap::read_bytes(c.get_pid(), pages.rw, buffer.data(), buffer.size());
+    // Each thread has its own counters, which are added together
+    ::std::thread thread([&] {
+        long value;
+        for (int i = 0; i < 10; ++i) {
+            ::ptracewrap::read_bytes(c.get_pid(), pages.rw, &value, sizeof(value));
+        }
+    });
+    thread.join();
+    long value;
+    for (int i = 0; i < 10; ++i) {
+        ::ptracewrap::read_bytes(c.get_pid(), pages.rw, &value, sizeof(value), ::ptracewrap::transfer_backend::peek_poke);
+    }
+    errno = 0;
+    ::ptracewrap::ptrace(PTRACE_PEEKDATA, c.get_pid(), pages.unmapped);
+    const int peek_error = errno;
+    CHECK(peek_error == EIO || peek_error == EFAULT);
+    ::ptracewrap::ptrace(PTRACE_CONT, 999999);
+
+    ::ptracewrap::instrumentation_snapshot snapshot = ::ptracewrap::get_instrumentation_snapshot();
+    if (!::ptracewrap::instrumentation_enabled) {
+        CHECK(snapshot.format().empty());
+        CHECK(snapshot.get_process_vm_readv().calls == 0 && snapshot.get(PTRACE_PEEKDATA).calls == 0);
+        return 0;
+    }
+    CHECK(snapshot.get_process_vm_readv().calls == 11 && snapshot.get_process_vm_readv().bytes == 2 * pg + 10 * sizeof(long));
+    CHECK(snapshot.get(PTRACE_PEEKDATA).calls == 11 && snapshot.get(PTRACE_PEEKDATA).errors == 1);
+    CHECK(snapshot.get(PTRACE_PEEKDATA).bytes == 10 * sizeof(long));
+    CHECK(snapshot.get(PTRACE_CONT).calls == 1 && snapshot.get(PTRACE_CONT).errors == 1);
+    CHECK(snapshot.get_error_count(ESRCH) == 1 && snapshot.get_error_count(peek_error) == 1);
+    ::std::uint64_t latencies = 0;
+    for (::std::uint64_t count : snapshot.get(PTRACE_PEEKDATA).latency) {
+        latencies += count;
+    }
+    CHECK(latencies == 11);
+    ::std::string text = snapshot.format();
+    CHECK(text.find("PTRACE_PEEKDATA") != ::std::string::npos && text.find("process_vm_readv") != ::std::string::npos);
+
+    // Only calls after the reset are counted
+    ::ptracewrap::reset_instrumentation();
+    ::ptracewrap::read_bytes(c.get_pid(), pages.rw, buffer.data(), 8);
+    ::ptracewrap::instrumentation_snapshot after = ::ptracewrap::get_instrumentation_snapshot();
+    CHECK(after.get_process_vm_readv().calls == 1 && after.get(PTRACE_PEEKDATA).calls == 0 && after.get_error_count(ESRCH) == 0);
+    return 0;
+}
@@ -0,0 +1,88 @@
+// memory_map: parsing, lookups, interning and in-place updates
+#include "test_common.hpp"
+
+#include <vector>
+
+int main() {
+    const ::std::size_t pg = ::test::page_size();
+    ::test::test_pages pages;
+    ::test::child c;
+
+    ::ptracewrap::memory_map map(c.get_pid());
+    CHECK(map.get_pid() == c.get_pid());
+    const ::std::vector< ::ptracewrap::memory_region>& regions = map.get_regions();
+    CHECK(regions.size() > 5);
+    for (::std::size_t i = 1; i < regions.size(); ++i) {
+        CHECK(regions[i - 1].end <= regions[i].start);
+    }
+
+    const ::ptracewrap::memory_region* rw = map.find(pages.rw + 5);
+    CHECK(rw != nullptr && (rw->permissions & ::ptracewrap::memory_region::write) && rw->path_id == 0);
+    CHECK(map.find(pages.ro)->permissions == ::ptracewrap::memory_region::read);
+    CHECK(map.find(pages.none)->permissions == 0);
+    CHECK(map.find(pages.unmapped) == nullptr);
+    const ::ptracewrap::memory_region* libc = map.find(reinterpret_cast<void*>(&::std::printf));
+    CHECK(libc != nullptr && (libc->permissions & ::ptracewrap::memory_region::execute));
+    CHECK(map.get_path(libc->path_id).find("libc") != ::std::string::npos);
+    CHECK(map.get_path(0).empty());
+    CHECK(map.contains(pages.rw, 8 * pg, ::ptracewrap::memory_region::read));
+    CHECK(!map.contains(pages.ro, 2 * pg, ::ptracewrap::memory_region::write));
+
+    CHECK(map.intern("") == 0);
+    CHECK(map.intern(map.get_path(libc->path_id)) == libc->path_id);
+    ::std::uint32_t file = map.intern("/tmp/some file");
+    CHECK(file != 0 && map.intern("/tmp/some file") == file && map.get_path(file) == "/tmp/some file");
+
+    // Unmapping the middle of a region splits it
+    ::std::size_t before = regions.size();
+    map.on_munmap(pages.rw + pg, pg);
+    CHECK(regions.size() == before + 1);
+    CHECK(map.find(pages.rw + pg) == nullptr);
+    CHECK(map.find(pages.rw) != nullptr && map.find(pages.rw + 2 * pg) != nullptr);
+    CHECK(map.find(pages.rw + 2 * pg)->start == reinterpret_cast< ::std::uintptr_t>(pages.rw + 2 * pg));
+
+    // A file mapped into the hole
+    map.on_mmap(pages.rw + pg, pg, ::ptracewrap::memory_region::read, 3 * pg, file);
+    CHECK(regions.size() == before + 2);
+    const ::ptracewrap::memory_region* mapped = map.find(pages.rw + pg);
+    CHECK(mapped->permissions == ::ptracewrap::memory_region::read && mapped->path_id == file && mapped->offset == 3 * pg);
+    CHECK(mapped->size() == pg);
+
+    // mprotect over several regions
+    map.on_mprotect(pages.rw, 8 * pg, ::ptracewrap::memory_region::read | ::ptracewrap::memory_region::write);
+    CHECK(map.contains(pages.rw, 8 * pg, ::ptracewrap::memory_region::write));
+    CHECK(map.find(pages.rw + pg)->path_id == file);
+
+    map.refresh();
+    CHECK(regions.size() == before);
+    CHECK(map.find(pages.rw + pg)->path_id == 0);
+    map.on_exec();
+    CHECK(regions.size() == before);
+
+    // With a memory map, a tracee rejects unmapped addresses without a syscall and uses /proc/<pid>/mem for pages
+    // process_vm_{readv,writev} can't access
+    ::ptracewrap::tracee t(c.get_pid());
+    t.enable_memory_map();
+    CHECK(t.get_memory_map() != nullptr);
+    ::std::vector<char> buffer(3 * pg);
+    ::ptracewrap::read_to(t, pages.rw + 7, buffer.data(), buffer.size());
+    CHECK(::std::memcmp(buffer.data(), pages.rw + 7, buffer.size()) == 0);
+    char none[100];
+    ::ptracewrap::read_to(t, pages.none + 10, none);
+    CHECK(none[0] == static_cast<char>(19) && none[99] == static_cast<char>(118));
+    ::ptracewrap::write(t, pages.ro + 5, 123L);
+    CHECK(::ptracewrap::read<long>(c.get_pid(), pages.ro + 5) == 123L);
+    try {
+        ::ptracewrap::read<long>(t, pages.unmapped);
+        CHECK(false);
+    } catch (const ::ptracewrap::ptrace_error& e) {
+        CHECK(e.get_errno() == EIO);
+    }
+    // After the tracee unmaps memory, the map must be told
+    t.get_memory_map()->on_munmap(pages.rw, pg);
+    CHECK_THROWS_PTRACE_ERROR(::ptracewrap::read<long>(t, pages.rw));
+    t.enable_memory_map(false);
+    CHECK(t.get_memory_map() == nullptr);
+    CHECK(::ptracewrap::read<long>(t, pages.rw + 8) == ::ptracewrap::read<long>(c.get_pid(), pages.rw + 8));
+    return 0;
+}
@@ -0,0 +1,58 @@
+// The std::nothrow overloads, ptrace_status and ptrace_result
+#include "test_common.hpp"
+
+#include <vector>
+
+int main() {
+    ::test::test_pages pages;
+    ::test::child c;
+    const ::pid_t pid = c.get_pid();
+    ::ptracewrap::tracee t(pid);
+    t.enable_memory_map();
+
+    ::ptracewrap::ptrace_status ok;
+    CHECK(ok && ok.ok() && ok.get_errno() == 0);
+    ok.throw_if_error();
+
+    long value;
+    ::ptracewrap::ptrace_status status = ::ptracewrap::read_to(pid, pages.unmapped, value, ::std::nothrow);
+    CHECK(!status && !status.ok());
+    CHECK(status.get_request() == PTRACE_PEEKDATA && status.get_pid() == pid && status.get_addr() == pages.unmapped);
+    CHECK(status.code().value() == status.get_errno() && status.get_errno() != 0);
+    CHECK(status.to_error().get_errno() == status.get_errno());
+    CHECK_THROWS_PTRACE_ERROR(status.throw_if_error());
+    CHECK(::ptracewrap::read_to(pid, pages.rw, value, ::std::nothrow));
+    CHECK(::std::memcmp(&value, pages.rw, sizeof(value)) == 0);
+
+    ::ptracewrap::ptrace_result<long> result = ::ptracewrap::read<long>(pid, pages.rw, ::std::nothrow);
+    CHECK(result && result.has_value() && *result == value && result.value() == value);
+    CHECK(result.status().ok());
+
+    // The memory map rejects the address without a syscall, with the same error as ptrace(2)
+    ::ptracewrap::ptrace_result<long> bad = ::ptracewrap::read<long>(t, pages.unmapped, ::std::nothrow);
+    CHECK(!bad && !bad.has_value() && bad.status().get_errno() == EIO);
+    try {
+        bad.value();
+        CHECK(false);
+    } catch (const ::ptracewrap::ptrace_error& e) {
+        CHECK(e.get_addr() == pages.unmapped);
+    }
+
+    char buffer[10];
+    CHECK(::ptracewrap::read_to(t, pages.rw, buffer, 10, ::std::nothrow));
+    CHECK(!::ptracewrap::read_to(t, pages.unmapped, buffer, 10, ::std::nothrow));
+    CHECK(!::ptracewrap::read_bytes(pid, pages.unmapped, buffer, 3, ::ptracewrap::transfer_backend::peek_poke, ::std::nothrow));
+
+    CHECK(::ptracewrap::write(pid, pages.rw, 5L, ::std::nothrow));
+    CHECK(::ptracewrap::read<long>(pid, pages.rw) == 5L);
+    CHECK(!::ptracewrap::write(pid, pages.unmapped, 5L, ::std::nothrow));
+    CHECK(::ptracewrap::write(t, pages.rw, buffer, 10, ::std::nothrow));
+    CHECK(!::ptracewrap::write_bytes(t, pages.unmapped, buffer, 3, ::std::nothrow));
+
+    ::std::vector<int> ints{ 1, 2 };
+    CHECK(::ptracewrap::write(pid, pages.rw, ints.begin(), ints.end(), ::std::nothrow));
+    CHECK(::ptracewrap::write(t, pages.rw + 8, ints.begin(), ints.end(), ::std::nothrow));
+    CHECK(::ptracewrap::read<int>(pid, pages.rw + 12) == 2);
+    CHECK(!::ptracewrap::write(pid, pages.unmapped, ints.begin(), ints.end(), ::std::nothrow));
+    return 0;
+}
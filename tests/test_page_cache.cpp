@@ -0,0 +1,64 @@
+// tracee's page cache: hits while stopped, write-through and invalidation
+#include "test_common.hpp"
+
+#include <vector>
+
+int main() {
+    ::test::test_pages pages;
+    ::test::child c;
+
+    ::ptracewrap::tracee t(c.get_pid());
+    CHECK(!t.page_cache_enabled());
+    t.enable_page_cache();
+    CHECK(t.page_cache_enabled());
+
+    for (int repeat = 0; repeat < 3; ++repeat) {
+        for (::std::size_t offset : { 0, 1, 4093, 8000 }) {
+            for (::std::size_t n : { 1, 9, 4096, 9000 }) {
+                ::std::vector<char> buffer(n);
+                ::ptracewrap::read_to(t, pages.rw + offset, buffer.data(), n);
+                CHECK(::std::memcmp(buffer.data(), pages.rw + offset, n) == 0);
+            }
+        }
+    }
+    // Every page in [rw, rw + 17000) was only fetched once
+    CHECK(t.page_cache_misses() == 5);
+    CHECK(t.page_cache_hits() != 0);
+    t.reset_page_cache_counters();
+    CHECK(t.page_cache_hits() == 0 && t.page_cache_misses() == 0);
+
+    char none[100];
+    ::ptracewrap::read_to(t, pages.none + 10, none);
+    for (int i = 0; i < 100; ++i) {
+        CHECK(none[i] == static_cast<char>(i + 19));
+    }
+    CHECK_THROWS_PTRACE_ERROR(::ptracewrap::read<long>(t, pages.unmapped));
+
+    // Writes through the handle update cached pages, across a page boundary
+    ::ptracewrap::write(t, pages.rw + 4094, 0x1122334455667788L);
+    CHECK(::ptracewrap::read<long>(t, pages.rw + 4094) == 0x1122334455667788L);
+    CHECK(::ptracewrap::read<long>(c.get_pid(), pages.rw + 4094) == 0x1122334455667788L);
+
+    // A write behind the handle's back isn't seen until the cache is invalidated
+    ::ptracewrap::ptrace_w_error(PTRACE_POKEDATA, c.get_pid(), pages.rw, reinterpret_cast<void*>(77L));
+    CHECK(::ptracewrap::read<long>(t, pages.rw) != 77L);
+    t.invalidate_page_cache();
+    CHECK(::ptracewrap::read<long>(t, pages.rw) == 77L);
+
+    // ptrace through the handle invalidates it
+    t.ptrace_w_error(PTRACE_POKEDATA, pages.rw, reinterpret_cast<void*>(78L));
+    CHECK(::ptracewrap::read<long>(t, pages.rw) == 78L);
+
+    // So does resuming through the handle
+    ::ptracewrap::read<long>(t, pages.rw + 8);
+    ::ptracewrap::ptrace_w_error(PTRACE_POKEDATA, c.get_pid(), pages.rw + 8, reinterpret_cast<void*>(79L));
+    t.cont();
+    CHECK(::kill(c.get_pid(), SIGSTOP) == 0);
+    int status;
+    CHECK(::waitpid(c.get_pid(), &status, 0) == c.get_pid() && WIFSTOPPED(status));
+    CHECK(::ptracewrap::read<long>(t, pages.rw + 8) == 79L);
+
+    t.enable_page_cache(false);
+    CHECK(!t.page_cache_enabled() && t.page_cache_misses() == 0);
+    return 0;
+}
@@ -0,0 +1,111 @@
+// sample_histogram and sampling_profiler on a multithreaded process, including a thread created while profiling
+#include "test_common.hpp"
+
+#include <ptracewrap/profiler.hpp>
+
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+
+#include <sys/prctl.h>
+
+__attribute__((noinline)) static void spin_inner(volatile unsigned long& x) {
+    for (int i = 0; i < 1000; ++i) {
+        x = x + 1;
+    }
+}
+
+__attribute__((noinline)) static void spin_outer(volatile unsigned long& x) {
+    for (;;) {
+        spin_inner(x);
+    }
+}
+
+static void spin() {
+    volatile unsigned long x = 0;
+    spin_outer(x);
+}
+
+static void test_histogram() {
+    ::ptracewrap::sample_histogram histogram(16, 3);
+    const ::std::uintptr_t a[] = { 1, 2, 3, 4 };
+    const ::std::uintptr_t b[] = { 1, 2 };
+    CHECK(histogram.add(a, 4));
+    // Only the first 3 frames are kept, so this is the same stack
+    CHECK(histogram.add(a, 3));
+    CHECK(histogram.add(b, 2));
+    ::std::uint64_t total = 0;
+    ::std::size_t stacks = 0;
+    histogram.for_each([&](const ::std::uintptr_t* frames, ::std::size_t depth, ::std::uint64_t count) {
+        ++stacks;
+        total += count;
+        CHECK(frames[0] == 1 && frames[1] == 2);
+        CHECK((depth == 3 && count == 2) || (depth == 2 && count == 1));
+    });
+    CHECK(stacks == 2 && total == 3 && histogram.get_dropped() == 0);
+
+    // Three quarters of the 16 slots can be used
+    for (::std::uintptr_t i = 10; i < 30; ++i) {
+        histogram.add(&i, 1);
+    }
+    stacks = 0;
+    histogram.for_each([&](const ::std::uintptr_t*, ::std::size_t, ::std::uint64_t) { ++stacks; });
+    CHECK(stacks == 12 && histogram.get_dropped() == 10);
+}
+
+static void test_profile() {
+    ::pid_t pid = ::fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+        ::std::thread(spin).detach();
+        ::usleep(300000);
+        // Created while being profiled
+        ::std::thread(spin).detach();
+        for (;;) {
+            ::pause();
+        }
+    }
+    ::usleep(100000);
+    ::ptracewrap::profiler_options options;
+    options.frequency = 200;
+    ::ptracewrap::sampling_profiler profiler(pid, options);
+    CHECK(profiler.get_pid() == pid);
+    // Profiles can be read while `run` is sampling
+    ::std::thread reader([&] {
+        for (int i = 0; i < 20; ++i) {
+            profiler.folded();
+            ::usleep(20000);
+        }
+    });
+    profiler.run(::std::chrono::milliseconds(800));
+    reader.join();
+
+    ::std::set< ::pid_t> threads;
+    ::std::uint64_t counted = 0;
+    profiler.for_each_thread([&](::pid_t tid, const ::ptracewrap::sample_histogram& histogram) {
+        threads.insert(tid);
+        histogram.for_each([&](const ::std::uintptr_t*, ::std::size_t, ::std::uint64_t count) { counted += count; });
+        counted += histogram.get_dropped();
+    });
+    CHECK(threads.size() == 3 && threads.count(pid) == 1);
+    CHECK(profiler.get_sample_count() > 200 && counted == profiler.get_sample_count());
+
+    ::std::string folded = profiler.folded();
+    CHECK(!folded.empty() && folded.find("0x") == 0 && folded[folded.size() - 1] == '\n');
+    ::std::string per_thread = profiler.folded(true);
+    CHECK(per_thread.find("tid-") == 0);
+
+    // Detached, and still running
+    int status;
+    CHECK(::waitpid(pid, &status, WNOHANG) == 0);
+    ::kill(pid, SIGKILL);
+    CHECK(::waitpid(pid, &status, 0) == pid && WIFSIGNALED(status));
+}
+
+int main() {
+    test_histogram();
+    test_profile();
+    return 0;
+}
@@ -0,0 +1,64 @@
+// read_batch: merging adjacent and overlapping entries, IOV_MAX chunking and per-entry errors
+#include "test_common.hpp"
+
+#include <vector>
+
+int main() {
+    const ::std::size_t pg = ::test::page_size();
+    ::test::test_pages pages;
+    ::test::child c;
+
+    ::ptracewrap::read_batch batch(c.get_pid());
+    CHECK(batch.get_pid() == c.get_pid());
+    CHECK(batch.execute() == 0);
+
+    // Overlapping and adjacent entries, which are merged
+    ::std::vector< ::std::vector<char> > out;
+    ::std::vector<const char*> from;
+    for (::std::size_t i = 0; i < 3000; ++i) {
+        from.push_back(pages.rw + (i * 37) % (8 * pg - 64));
+        out.push_back(::std::vector<char>(1 + i % 60));
+    }
+    // Separate 8 byte entries with gaps between them, more than IOV_MAX of them
+    for (::std::size_t i = 0; i < 8 * pg / 16; ++i) {
+        from.push_back(pages.rw + i * 16);
+        out.push_back(::std::vector<char>(8));
+    }
+    for (::std::size_t i = 0; i < from.size(); ++i) {
+        CHECK(batch.add(from[i], out[i].data(), out[i].size()) == i);
+    }
+    // Unreadable with process_vm_readv, read with PTRACE_PEEKDATA
+    char none[8];
+    ::std::size_t none_index = batch.add(pages.none + 5, none);
+    // Fails without failing the entries around it
+    long unmapped;
+    ::std::size_t unmapped_index = batch.add(pages.unmapped, unmapped);
+    char across[8];
+    ::std::size_t across_index = batch.add(pages.ro + pg - 4, across);
+    long last;
+    ::std::size_t last_index = batch.add(pages.rw + 3, last);
+    CHECK(batch.size() == from.size() + 4);
+
+    CHECK(batch.execute() == 1);
+    for (::std::size_t i = 0; i < from.size(); ++i) {
+        CHECK(batch.succeeded(i) && batch.get_errno(i) == 0);
+        CHECK(::std::memcmp(out[i].data(), from[i], out[i].size()) == 0);
+    }
+    CHECK(batch.succeeded(none_index));
+    for (int i = 0; i < 8; ++i) {
+        CHECK(none[i] == static_cast<char>(i + 14));
+    }
+    CHECK(!batch.succeeded(unmapped_index) && batch.get_errno(unmapped_index) != 0);
+    CHECK(batch.get_error(unmapped_index).get_addr() == pages.unmapped);
+    CHECK(batch.get_error(unmapped_index).get_request() == PTRACE_PEEKDATA);
+    CHECK(batch.succeeded(across_index) && ::std::memcmp(across, pages.ro + pg - 4, 8) == 0);
+    CHECK(batch.succeeded(last_index) && ::std::memcmp(&last, pages.rw + 3, 8) == 0);
+
+    // Reusable after clear()
+    batch.clear();
+    CHECK(batch.size() == 0);
+    int value;
+    batch.add(pages.rw + 100, value);
+    CHECK(batch.execute() == 0 && ::std::memcmp(&value, pages.rw + 100, sizeof(value)) == 0);
+    return 0;
+}
@@ -0,0 +1,43 @@
+// read_cstring / read_string_into, including strings that end right before an unmapped page
+#include "test_common.hpp"
+
+#include <string>
+
+int main() {
+    const ::std::size_t pg = ::test::page_size();
+    ::test::test_pages pages;
+    char* strings = static_cast<char*>(::mmap(nullptr, 3 * pg, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    CHECK(strings != MAP_FAILED);
+    CHECK(::munmap(strings + 2 * pg, pg) == 0);
+    ::std::memset(strings, 'a', 2 * pg);
+    strings[2 * pg - 1] = '\0';
+    ::std::strcpy(strings + 100, "hello");
+    ::test::child c;
+    ::ptracewrap::tracee t(c.get_pid());
+    t.enable_page_cache();
+
+    CHECK(::ptracewrap::read_cstring(c.get_pid(), strings + 100) == "hello");
+    CHECK(::ptracewrap::read_cstring(t, strings + 100) == "hello");
+    CHECK(::ptracewrap::read_cstring(c.get_pid(), strings + 100, 3) == "hel");
+    CHECK(::ptracewrap::read_cstring(c.get_pid(), strings + 2 * pg - 1).empty());
+
+    // Ends on the last byte before the unmapped page, so reading past it fails
+    ::std::string out;
+    CHECK(::ptracewrap::read_string_into(c.get_pid(), strings + 106, out));
+    CHECK(out.size() == 2 * pg - 1 - 106 && out == ::std::string(out.size(), 'a'));
+    CHECK(::ptracewrap::read_string_into(t, strings + 2 * pg - 10, out));
+    CHECK(out == ::std::string(9, 'a'));
+
+    // Too long: truncated to `max_length`
+    CHECK(!::ptracewrap::read_string_into(c.get_pid(), strings + 106, out, 5000));
+    CHECK(out.size() == 5000);
+    CHECK(!::ptracewrap::read_string_into(t, strings + 106, out, 0));
+    CHECK(out.empty());
+
+    // Readable only through PTRACE_PEEKDATA
+    CHECK(::ptracewrap::read_cstring(c.get_pid(), pages.none + 1, 4).size() == 4);
+
+    CHECK_THROWS_PTRACE_ERROR(::ptracewrap::read_cstring(c.get_pid(), pages.unmapped));
+    CHECK_THROWS_PTRACE_ERROR(::ptracewrap::read_cstring(t, strings + 2 * pg));
+    return 0;
+}
@@ -0,0 +1,77 @@
+// register_cache: one fetch per stop, dirty tracking and flushing on resume
+#include "test_common.hpp"
+
+#include <elf.h>
+
+// A callee-saved register, which the child's pause() loop leaves alone
+#if defined(__aarch64__)
+#define TEST_REGISTER(regs) (regs).regs[19]
+#define TEST_OTHER_REGISTER(regs) (regs).regs[20]
+#else
+#define TEST_REGISTER(regs) (regs).r15
+#define TEST_OTHER_REGISTER(regs) (regs).r14
+#endif
+
+static ::ptracewrap::register_cache::regs_type get_regs(::pid_t pid) {
+    ::ptracewrap::register_cache::regs_type regs;
+    ::iovec iov = { &regs, sizeof(regs) };
+    ::ptracewrap::ptrace_w_error(PTRACE_GETREGSET, pid, reinterpret_cast<void*>(NT_PRSTATUS), &iov);
+    return regs;
+}
+
+int main() {
+    ::test::child c;
+    ::ptracewrap::tracee t(c.get_pid());
+    ::ptracewrap::register_cache& registers = t.registers();
+    CHECK(registers.get_pid() == c.get_pid());
+
+    // Both register sets, each fetched once
+    ::ptracewrap::register_cache::regs_type before = registers.get_regs();
+    static_cast<void>(registers.get_regs());
+    static_cast<void>(registers.get_fpregs());
+    static_cast<void>(registers.get_fpregs());
+    CHECK(registers.get_fetch_count() == 2);
+    CHECK(!registers.is_dirty());
+    CHECK(::std::memcmp(&before, &registers.get_regs(), sizeof(before)) == 0);
+
+    // Any number of changes are written back with one PTRACE_SETREGSET
+    TEST_REGISTER(registers.modify_regs()) = 0x1234;
+    TEST_OTHER_REGISTER(registers.modify_regs()) = 0x99;
+    CHECK(registers.is_dirty());
+    CHECK(TEST_REGISTER(get_regs(c.get_pid())) == TEST_REGISTER(before));
+    registers.flush();
+    CHECK(registers.get_flush_count() == 1 && !registers.is_dirty());
+    ::ptracewrap::register_cache::regs_type after = get_regs(c.get_pid());
+    CHECK(TEST_REGISTER(after) == 0x1234 && TEST_OTHER_REGISTER(after) == 0x99);
+    registers.flush();
+    CHECK(registers.get_flush_count() == 1);
+
+    // set_regs doesn't need to fetch
+    registers.invalidate();
+    registers.set_regs(after);
+    CHECK(registers.get_fetch_count() == 2);
+    TEST_REGISTER(registers.modify_regs()) = 0x5678;
+    CHECK(registers.get_fetch_count() == 2);
+
+    // Resuming through the tracee flushes the changes and forgets the registers
+    t.cont();
+    CHECK(::kill(c.get_pid(), SIGSTOP) == 0);
+    int status;
+    CHECK(::waitpid(c.get_pid(), &status, 0) == c.get_pid() && WIFSTOPPED(status));
+    CHECK(registers.get_flush_count() == 2);
+    CHECK(TEST_REGISTER(registers.get_regs()) == 0x5678);
+    CHECK(registers.get_fetch_count() == 3);
+
+    // Unflushed changes are dropped by invalidate()
+    TEST_REGISTER(registers.modify_regs()) = 1;
+    registers.invalidate();
+    CHECK(!registers.is_dirty());
+    CHECK(TEST_REGISTER(registers.get_regs()) == 0x5678);
+
+    // The floating point registers
+    ::ptracewrap::register_cache::fpregs_type fp = registers.get_fpregs();
+    registers.set_fpregs(fp);
+    registers.flush();
+    CHECK(registers.get_flush_count() == 3);
+    return 0;
+}
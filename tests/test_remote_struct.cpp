@@ -0,0 +1,110 @@
+// read_graph: a tree and a cyclic list read level by level through remote_layout descriptions
+#include "test_common.hpp"
+
+#include <ptracewrap/remote_struct.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The layout in the tracee
+struct remote_tree;
+
+struct remote_node {
+    int value;
+    remote_node* next;
+    remote_tree* other;
+};
+
+struct remote_tree {
+    long key;
+    remote_tree* kids[3];
+    remote_node* list;
+};
+
+// The local copies, with pointers kept as addresses
+struct local_node {
+    int value;
+    ::std::uintptr_t next;
+    ::std::uintptr_t other;
+};
+
+struct local_tree {
+    long key;
+    ::std::uintptr_t kids[3];
+    ::std::uintptr_t list;
+};
+
+template<>
+struct ptracewrap::remote_layout<local_node> {
+    static constexpr ::std::size_t size = sizeof(remote_node);
+    typedef ::ptracewrap::remote_fields<
+        PTRACEWRAP_REMOTE_FIELD(local_node, value, offsetof(remote_node, value)),
+        PTRACEWRAP_REMOTE_POINTER(local_node, next, offsetof(remote_node, next), local_node),
+        PTRACEWRAP_REMOTE_POINTER(local_node, other, offsetof(remote_node, other), local_tree)
+    > fields;
+};
+
+template<>
+struct ptracewrap::remote_layout<local_tree> {
+    static constexpr ::std::size_t size = sizeof(remote_tree);
+    typedef ::ptracewrap::remote_fields<
+        PTRACEWRAP_REMOTE_FIELD(local_tree, key, offsetof(remote_tree, key)),
+        PTRACEWRAP_REMOTE_POINTER_ARRAY(local_tree, kids, offsetof(remote_tree, kids), local_tree),
+        PTRACEWRAP_REMOTE_POINTER(local_tree, list, offsetof(remote_tree, list), local_node)
+    > fields;
+};
+
+static remote_tree* make_tree(int depth, long key, remote_node* list, ::std::vector<remote_tree*>& all) {
+    remote_tree* tree = new remote_tree();
+    tree->key = key;
+    all.push_back(tree);
+    for (int i = 0; i < 3; ++i) {
+        tree->kids[i] = depth != 0 ? make_tree(depth - 1, key * 3 + i, list, all) : nullptr;
+    }
+    tree->list = depth != 0 ? nullptr : list;
+    return tree;
+}
+
+int main() {
+    // A list of 5 in a cycle, and a tree of 1 + 3 + 9 nodes whose leaves point to the list
+    remote_node* nodes = new remote_node[5];
+    for (int i = 0; i < 5; ++i) {
+        nodes[i].value = i * 10;
+        nodes[i].next = &nodes[(i + 1) % 5];
+        nodes[i].other = nullptr;
+    }
+    ::std::vector<remote_tree*> trees;
+    remote_tree* root = make_tree(2, 1, nodes, trees);
+    nodes[2].other = root;
+    // Never mapped
+    const ::std::uintptr_t bad = 0x1000;
+    nodes[3].other = reinterpret_cast<remote_tree*>(bad);
+    ::test::child c;
+
+    ::ptracewrap::remote_graph graph = ::ptracewrap::read_graph<local_tree>(c.get_pid(), reinterpret_cast< ::std::uintptr_t>(root));
+    CHECK(graph.count<local_tree>() == 13 && graph.count<local_node>() == 5 && graph.size() == 18);
+    CHECK(graph.get_failed().size() == 1 && graph.get_failed()[0] == bad);
+    for (remote_tree* tree : trees) {
+        const local_tree* copy = graph.get<local_tree>(reinterpret_cast< ::std::uintptr_t>(tree));
+        CHECK(copy != nullptr && copy->key == tree->key);
+        CHECK(copy->kids[1] == reinterpret_cast< ::std::uintptr_t>(tree->kids[1]) && copy->list == reinterpret_cast< ::std::uintptr_t>(tree->list));
+    }
+    for (int i = 0; i < 5; ++i) {
+        const local_node* copy = graph.get<local_node>(reinterpret_cast< ::std::uintptr_t>(&nodes[i]));
+        CHECK(copy != nullptr && copy->value == i * 10 && copy->next == reinterpret_cast< ::std::uintptr_t>(&nodes[(i + 1) % 5]));
+    }
+    // Not read, and a node isn't found as a different type
+    CHECK(graph.get<local_tree>(bad) == nullptr);
+    CHECK(graph.get<local_tree>(reinterpret_cast< ::std::uintptr_t>(&nodes[0])) == nullptr);
+    ::std::size_t visited = 0;
+    graph.for_each<local_node>([&](::std::uintptr_t, const local_node&) { ++visited; });
+    CHECK(visited == 5);
+
+    ::ptracewrap::remote_graph small = ::ptracewrap::read_graph<local_tree>(c.get_pid(), reinterpret_cast< ::std::uintptr_t>(root), 4);
+    CHECK(small.size() == 4 && small.get_levels() == 2);
+
+    ::ptracewrap::remote_graph empty = ::ptracewrap::read_graph<local_tree>(c.get_pid(), 0);
+    CHECK(empty.size() == 0 && empty.get_failed().empty());
+    return 0;
+}
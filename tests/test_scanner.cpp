@@ -0,0 +1,140 @@
+// scan_memory / scan_values: matches across chunk and region boundaries, masks, stopping early and errors
+#include "test_common.hpp"
+
+#include <ptracewrap/scanner.hpp>
+
+#include <cstdint>
+#include <set>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+int main() {
+    const ::std::size_t pg = ::test::page_size();
+    const ::std::size_t big_size = ::std::size_t(16) << 20;
+    char* big = static_cast<char*>(::mmap(nullptr, big_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    CHECK(big != MAP_FAILED);
+    for (::std::size_t i = 0; i < big_size; i += 8) {
+        ::std::uint64_t value = i * 0x9E3779B97F4A7C15ull;
+        ::std::memcpy(big + i, &value, 8);
+    }
+    unsigned char pattern[13];
+    for (int i = 0; i < 13; ++i) {
+        pattern[i] = static_cast<unsigned char>(0xA0 + i * 3);
+    }
+    // At the start, across page and chunk boundaries, at the end, and across into the read-only last page
+    ::std::set< ::std::uintptr_t> expected;
+    const ::std::size_t places[] = { 0, pg - 5, ::std::size_t(1) << 20, (::std::size_t(2) << 20) - 6, big_size / 2 + pg - 6, big_size - 13, big_size - pg - 6 };
+    for (::std::size_t place : places) {
+        ::std::memcpy(big + place, pattern, 13);
+        expected.insert(reinterpret_cast< ::std::uintptr_t>(big + place));
+    }
+    CHECK(::mprotect(big + big_size - pg, pg, PROT_READ) == 0);
+    // Two pages with an unmapped page between them
+    char* gap = static_cast<char*>(::mmap(nullptr, 3 * pg, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    CHECK(gap != MAP_FAILED && ::munmap(gap + pg, pg) == 0);
+    ::test::child c;
+
+    for (::std::size_t chunk_size : { pg, ::std::size_t(1) << 20 }) {
+        for (unsigned threads : { 1u, 3u }) {
+            ::ptracewrap::scan_options options;
+            options.chunk_size = chunk_size;
+            options.threads = threads;
+            ::std::set< ::std::uintptr_t> found;
+            ::std::size_t n = ::ptracewrap::scan_memory(c.get_pid(), pattern, 13, [&](::std::uintptr_t address) {
+                CHECK(found.insert(address).second);
+                return true;
+            }, options);
+            CHECK(n == found.size());
+            for (::std::uintptr_t address : expected) {
+                CHECK(found.count(address) == 1);
+            }
+        }
+    }
+
+    // The second byte is a wildcard, and only the high half of the fifth byte has to match. Then with no byte that has
+    // to match exactly at the start
+    unsigned char mask[13];
+    ::std::memset(mask, 0xff, sizeof(mask));
+    mask[1] = 0;
+    mask[4] = 0xf0;
+    unsigned char masked[13];
+    ::std::memcpy(masked, pattern, 13);
+    masked[1] = 0x11;
+    masked[4] ^= 0x0f;
+    for (int i = 0; i < 2; ++i) {
+        ::std::set< ::std::uintptr_t> found;
+        ::ptracewrap::scan_memory(c.get_pid(), masked, 13, mask, [&](::std::uintptr_t address) {
+            found.insert(address);
+            return true;
+        });
+        for (::std::uintptr_t address : expected) {
+            CHECK(found.count(address) == 1);
+        }
+        mask[0] = 0;
+    }
+
+    ::std::size_t calls = 0;
+    CHECK(::ptracewrap::scan_memory(c.get_pid(), pattern, 13, [&](::std::uintptr_t) {
+        ++calls;
+        return false;
+    }) == 1);
+    CHECK(calls == 1);
+
+    const ::std::uint64_t target = 8192 * 0x9E3779B97F4A7C15ull;
+    ::std::set< ::std::uintptr_t> values;
+    ::ptracewrap::scan_values< ::std::uint64_t>(c.get_pid(), [&](const ::std::uint64_t& value) { return value == target; }, [&](::std::uintptr_t address) {
+        values.insert(address);
+        return true;
+    });
+    CHECK(values.count(reinterpret_cast< ::std::uintptr_t>(big + 8192)) == 1);
+
+    // Exceptions from `on_match` and `predicate` are rethrown on the calling thread
+    ::ptracewrap::scan_options options;
+    options.threads = 3;
+    options.chunk_size = pg;
+    bool thrown = false;
+    try {
+        ::ptracewrap::scan_memory(c.get_pid(), pattern, 13, [](::std::uintptr_t) -> bool {
+            throw ::std::runtime_error("on_match");
+        }, options);
+    } catch (const ::std::runtime_error& e) {
+        thrown = ::std::strcmp(e.what(), "on_match") == 0;
+    }
+    CHECK(thrown);
+    thrown = false;
+    try {
+        ::ptracewrap::scan_values<char>(c.get_pid(), [](const char&) -> bool {
+            throw ::std::runtime_error("predicate");
+        }, [](::std::uintptr_t) { return true; }, options);
+    } catch (const ::std::runtime_error& e) {
+        thrown = ::std::strcmp(e.what(), "predicate") == 0;
+    }
+    CHECK(thrown);
+
+    // Unreadable pages are skipped
+    ::std::vector<char> buffer(3 * pg);
+    ::std::vector< ::std::pair< ::std::size_t, ::std::size_t>> runs;
+    ::ptracewrap::detail::scan_read(c.get_pid(), reinterpret_cast< ::std::uintptr_t>(gap), buffer.data(), 3 * pg, [&](::std::size_t offset, ::std::size_t length) {
+        runs.push_back(::std::make_pair(offset, length));
+    });
+    CHECK(runs.size() == 2 && runs[0] == ::std::make_pair(::std::size_t(0), pg) && runs[1] == ::std::make_pair(2 * pg, pg));
+
+    // Other errors end the read instead of failing once per page
+    ::pid_t zombie = ::fork();
+    CHECK(zombie >= 0);
+    if (zombie == 0) {
+        ::_exit(0);
+    }
+    CHECK(::waitid(P_PID, static_cast< ::id_t>(zombie), nullptr, WEXITED | WNOWAIT) == 0);
+    ::std::vector<char> large(big_size);
+    ::ptracewrap::reset_instrumentation();
+    runs.clear();
+    ::ptracewrap::detail::scan_read(zombie, reinterpret_cast< ::std::uintptr_t>(big), large.data(), big_size, [&](::std::size_t offset, ::std::size_t length) {
+        runs.push_back(::std::make_pair(offset, length));
+    });
+    CHECK(runs.empty());
+    CHECK(::ptracewrap::get_instrumentation_snapshot().get_process_vm_readv().calls == 1);
+    ::waitpid(zombie, nullptr, 0);
+    return 0;
+}
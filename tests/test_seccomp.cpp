@@ -0,0 +1,95 @@
+// seccomp_session: only the filtered syscalls stop, across forks and execs, and setup failures are thrown by launch
+#include "test_common.hpp"
+
+#include <ptracewrap/seccomp.hpp>
+
+#include <string>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/syscall.h>
+
+static int filter_error(::std::size_t syscalls) {
+    try {
+        ::ptracewrap::seccomp_filter filter(::std::vector<long>(syscalls, SYS_getpid));
+    } catch (const ::std::system_error& e) {
+        return e.code().value();
+    }
+    return 0;
+}
+
+// Runs in a child process, since the filters it installs can't be removed. Returns the errno launch throws once the
+// filters already installed leave no room for another one
+static int launch_error_with_filters_installed() {
+    // Syscall numbers that don't exist, so nothing is traced
+    ::std::vector<long> unused(1000);
+    for (::std::size_t i = 0; i < unused.size(); ++i) {
+        unused[i] = 100000 + static_cast<long>(i);
+    }
+    ::ptracewrap::seccomp_filter large(unused);
+    // The kernel allows 32768 instructions (Plus 4 per filter) across all the filters of a thread, including any this
+    // test was started with
+    int installed = 0;
+    while (large.install() == 0) {
+        if (++installed == 64) {
+            return -1;
+        }
+    }
+    if (errno != ENOMEM) {
+        return -1;
+    }
+    char* argv[] = { const_cast<char*>("true"), nullptr };
+    try {
+        ::ptracewrap::seccomp_session::launch("true", argv, large);
+    } catch (const ::std::system_error& e) {
+        return e.code().value();
+    }
+    return 0;
+}
+
+int main() {
+    // Two instructions per syscall, and 5 more
+    CHECK(filter_error(2045) == 0);
+    CHECK(filter_error(2046) == EINVAL);
+
+    ::pid_t helper = ::fork();
+    CHECK(helper != -1);
+    if (helper == 0) {
+        ::_exit(launch_error_with_filters_installed() == ENOMEM ? 0 : 1);
+    }
+    int helper_status;
+    CHECK(::waitpid(helper, &helper_status, 0) == helper && WIFEXITED(helper_status) && WEXITSTATUS(helper_status) == 0);
+
+    ::ptracewrap::seccomp_filter filter({ SYS_openat, SYS_execve }, 42);
+    char* argv[] = { const_cast<char*>("sh"), const_cast<char*>("-c"), const_cast<char*>("cat /etc/hostname >/dev/null && /bin/true && exit 3"), nullptr };
+    ::ptracewrap::seccomp_session session = ::ptracewrap::seccomp_session::launch("sh", argv, filter);
+
+    ::pid_t pid;
+    ::ptracewrap::syscall_info info;
+    int execs = 0;
+    bool saw_hostname = false;
+    ::std::unordered_set< ::pid_t> pids;
+    while (session.next(pid, info)) {
+        CHECK(info.op == ::ptracewrap::syscall_info::seccomp);
+        CHECK(info.ret_data == 42);
+        pids.insert(pid);
+        if (info.nr == SYS_openat) {
+            if (::ptracewrap::read_cstring(pid, reinterpret_cast<const void*>(info.args[1])) == "/etc/hostname") {
+                saw_hostname = true;
+            }
+        } else {
+            CHECK(info.nr == SYS_execve);
+            ++execs;
+        }
+    }
+    CHECK(saw_hostname);
+    // sh, cat and true
+    CHECK(execs >= 3 && pids.size() >= 3);
+    CHECK(WIFEXITED(session.get_exit_status()) && WEXITSTATUS(session.get_exit_status()) == 3);
+
+    // Not a tracee
+    ::ptracewrap::ptrace_result< ::ptracewrap::syscall_info> result = ::ptracewrap::get_syscall_info(::getpid(), ::std::nothrow);
+    CHECK(!result && result.status().get_errno() == ESRCH);
+    return 0;
+}
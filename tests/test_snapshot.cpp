@@ -0,0 +1,75 @@
+// memory_snapshot: full captures, deltas, and what happens without soft-dirty bits
+#include "test_common.hpp"
+
+#include <ptracewrap/snapshot.hpp>
+
+#include <cerrno>
+#include <set>
+#include <system_error>
+
+#include <fcntl.h>
+
+static bool self_soft_dirty(const void* address) {
+    int fd = ::open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    CHECK(fd != -1);
+    ::std::uint64_t entry = 0;
+    CHECK(::pread(fd, &entry, sizeof(entry), static_cast< ::off_t>(reinterpret_cast< ::std::uintptr_t>(address) / ::test::page_size() * sizeof(entry))) == static_cast< ::ssize_t>(sizeof(entry)));
+    ::close(fd);
+    return (entry & ::ptracewrap::detail::pagemap_soft_dirty) != 0;
+}
+
+int main() {
+    const ::std::size_t pg = ::test::page_size();
+    ::test::test_pages pages;
+
+    // Checking for support doesn't clear this process's soft-dirty bits
+    pages.rw[0] = 1;
+    bool dirty_before = self_soft_dirty(pages.rw);
+    bool supported = ::ptracewrap::memory_snapshot::soft_dirty_supported();
+    CHECK(self_soft_dirty(pages.rw) == dirty_before);
+    CHECK(!supported || dirty_before);
+    pages.rw[0] = 1;
+
+    ::test::child c;
+    ::ptracewrap::memory_snapshot snapshot(c.get_pid());
+    CHECK(snapshot.get_pid() == c.get_pid());
+    ::ptracewrap::memory_delta full = snapshot.capture();
+    ::std::set< ::std::uintptr_t> captured(full.pages.begin(), full.pages.end());
+    for (::std::size_t i = 0; i < 8; ++i) {
+        CHECK(captured.count(reinterpret_cast< ::std::uintptr_t>(pages.rw + i * pg)) == 1);
+    }
+    CHECK(captured.count(reinterpret_cast< ::std::uintptr_t>(pages.ro)) == 0);
+    CHECK(full.pages_failed == 0 && full.data.size() == full.size() * pg);
+
+    CHECK(snapshot.update().size() == 0);
+
+    // One page changed, and one written to with the same contents
+    ::ptracewrap::write(c.get_pid(), pages.rw + 3 * pg + 5, static_cast<char>(42));
+    ::ptracewrap::write(c.get_pid(), pages.rw + 5 * pg, pages.rw[5 * pg]);
+    ::ptracewrap::memory_delta delta = snapshot.update();
+    CHECK(delta.size() == 1 && delta.pages[0] == reinterpret_cast< ::std::uintptr_t>(pages.rw + 3 * pg));
+    CHECK(delta.page(0)[5] == 42 && ::std::memcmp(delta.page(0), pages.rw + 3 * pg, 5) == 0);
+    CHECK(snapshot.update().size() == 0);
+    if (supported) {
+        // Only the dirty pages are looked at
+        CHECK(delta.pages_checked < full.pages_checked);
+    }
+
+    // Without hashes, only soft-dirty bits can say what changed
+    if (supported) {
+        ::ptracewrap::memory_snapshot unhashed(c.get_pid(), false);
+        unhashed.capture();
+        ::ptracewrap::write(c.get_pid(), pages.rw + 5 * pg, pages.rw[5 * pg]);
+        ::ptracewrap::memory_delta written = unhashed.update();
+        CHECK(written.size() == 1 && written.pages[0] == reinterpret_cast< ::std::uintptr_t>(pages.rw + 5 * pg));
+    } else {
+        bool thrown = false;
+        try {
+            ::ptracewrap::memory_snapshot unhashed(c.get_pid(), false);
+        } catch (const ::std::system_error& e) {
+            thrown = e.code().value() == EOPNOTSUPP;
+        }
+        CHECK(thrown);
+    }
+    return 0;
+}
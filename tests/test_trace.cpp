@@ -0,0 +1,91 @@
+// spsc_ring, syscall_record::capture and the trace_writer / trace_reader round-trip
+#include "test_common.hpp"
+
+#include <ptracewrap/trace.hpp>
+
+#include <atomic>
+#include <system_error>
+#include <thread>
+
+#include <sys/stat.h>
+
+int main() {
+    const ::std::size_t pg = ::test::page_size();
+    ::test::test_pages pages;
+    // A page followed by an unmapped one
+    char* last = static_cast<char*>(::mmap(nullptr, 2 * pg, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    CHECK(last != MAP_FAILED && ::munmap(last + pg, pg) == 0);
+    ::std::memset(last, 'x', pg);
+    ::test::child c;
+    ::test::temp_file file;
+
+    ::ptracewrap::spsc_ring< ::ptracewrap::syscall_record> ring(1000);
+    CHECK(ring.capacity() == 1024);
+
+    // A consumer thread drains into the file while this thread produces, with a small growth step to remap often
+    const int n = 100000;
+    ::std::atomic<bool> done(false);
+    ::std::thread consumer([&] {
+        ::ptracewrap::trace_writer writer(file.get_path(), 1 << 16);
+        for (;;) {
+            bool d = done.load();
+            ::ptracewrap::drain(ring, writer);
+            if (d && ring.size() == 0) {
+                break;
+            }
+        }
+    });
+    ::ptracewrap::syscall_record record;
+    for (int i = 0; i < n; ++i) {
+        record.clear();
+        record.pid = c.get_pid();
+        record.nr = i;
+        if (i % 1000 == 0) {
+            CHECK(record.capture(c.get_pid(), pages.rw + 10, 100, 1) == ::ptracewrap::syscall_record::payload_capacity);
+        }
+        while (!ring.try_push(record)) {}
+    }
+    done = true;
+    consumer.join();
+
+    {
+        // Appends to the existing file
+        ::ptracewrap::trace_writer writer(file.get_path());
+        CHECK(writer.size() == static_cast< ::std::uint64_t>(n));
+        record.clear();
+        record.nr = -5;
+        CHECK(record.capture(c.get_pid(), pages.unmapped, 8) == 0 && record.payload_arg == 0xffff);
+        // Only the bytes before the unmapped page can be read
+        CHECK(record.capture(c.get_pid(), last + pg - 8, 64, 2) == 8 && record.payload_arg == 2);
+        writer.append(record);
+    }
+
+    ::ptracewrap::trace_reader reader(file.get_path());
+    CHECK(reader.size() == static_cast< ::std::size_t>(n) + 1);
+    for (int i = 0; i < n; ++i) {
+        CHECK(reader[i].nr == i && reader[i].pid == c.get_pid());
+        if (i % 1000 == 0) {
+            CHECK(reader[i].payload_size == 64 && reader[i].payload_arg == 1);
+            CHECK(::std::memcmp(reader[i].payload, pages.rw + 10, 64) == 0);
+        } else {
+            CHECK(reader[i].payload_size == 0);
+        }
+    }
+    CHECK(reader[n].nr == -5 && reader[n].payload_size == 8 && ::std::memcmp(reader[n].payload, "xxxxxxxx", 8) == 0);
+    // Truncated to the records when closed
+    struct ::stat st;
+    CHECK(::stat(file.get_path().c_str(), &st) == 0);
+    CHECK(static_cast< ::std::size_t>(st.st_size) == sizeof(::ptracewrap::trace_file_header) + sizeof(::ptracewrap::syscall_record) * (n + 1));
+
+    // Not a trace file
+    ::test::temp_file other;
+    CHECK(::truncate(other.get_path().c_str(), 4096) == 0);
+    bool thrown = false;
+    try {
+        ::ptracewrap::trace_reader bad(other.get_path());
+    } catch (const ::std::system_error& e) {
+        thrown = e.code().value() == EINVAL;
+    }
+    CHECK(thrown);
+    return 0;
+}
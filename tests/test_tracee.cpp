@@ -0,0 +1,65 @@
+// tracee transfers through /proc/<pid>/mem, and falling back when it can't be opened
+#include "test_common.hpp"
+
+#include <utility>
+#include <vector>
+
+int main() {
+    const ::std::size_t pg = ::test::page_size();
+    ::test::test_pages pages;
+    ::test::child c;
+
+    ::ptracewrap::tracee t(c.get_pid());
+    CHECK(t.get_pid() == c.get_pid());
+    CHECK(t.get_mem_fd() >= 0);
+
+    for (::std::size_t offset : { 0, 1, 4093 }) {
+        for (::std::size_t n : { 1, 7, 9, 4096, 9000 }) {
+            ::std::vector<char> buffer(n);
+            ::ptracewrap::read_to(t, pages.rw + offset, buffer.data(), n);
+            CHECK(::std::memcmp(buffer.data(), pages.rw + offset, n) == 0);
+        }
+    }
+    char none[100];
+    ::ptracewrap::read_to(t, pages.none + 10, none);
+    for (int i = 0; i < 100; ++i) {
+        CHECK(none[i] == static_cast<char>(i + 19));
+    }
+
+    // /proc/<pid>/mem can write read-only pages
+    char patch[5] = { 1, 2, 3, 4, 5 };
+    ::ptracewrap::write(t, pages.ro + pg - 2, patch);
+    char check[5];
+    ::ptracewrap::read_to(c.get_pid(), pages.ro + pg - 2, check);
+    CHECK(::std::memcmp(check, patch, sizeof(patch)) == 0);
+
+    ::std::vector<int> ints{ 1, 2, 3 };
+    ::ptracewrap::write(t, pages.rw + 5, ints.begin(), ints.end());
+    CHECK(::ptracewrap::read<int>(t, pages.rw + 9) == 2);
+
+    CHECK_THROWS_PTRACE_ERROR(::ptracewrap::read<long>(t, pages.unmapped));
+    try {
+        ::ptracewrap::read<long>(t, pages.unmapped);
+    } catch (const ::ptracewrap::ptrace_error& e) {
+        CHECK(e.get_request() == PTRACE_PEEKDATA);
+    }
+
+    ::ptracewrap::tracee moved(::std::move(t));
+    CHECK(t.get_mem_fd() == -1);
+    CHECK(moved.get_mem_fd() >= 0);
+    CHECK(::ptracewrap::read<int>(moved, pages.rw + 9) == 2);
+
+    // A moved-from handle keeps the pid but not `/proc/<pid>/mem`, so it uses the default backend
+    for (::ptracewrap::transfer_backend backend : { ::ptracewrap::transfer_backend::peek_poke, ::ptracewrap::transfer_backend::process_vm }) {
+        ::ptracewrap::set_default_transfer_backend(backend);
+        ::std::vector<char> buffer(2 * pg + 3);
+        ::ptracewrap::read_to(t, pages.rw + 2 * pg + 1, buffer.data(), buffer.size());
+        CHECK(::std::memcmp(buffer.data(), pages.rw + 2 * pg + 1, buffer.size()) == 0);
+        ::ptracewrap::read_to(t, pages.none + 10, none);
+        CHECK(none[0] == static_cast<char>(19));
+        ::ptracewrap::write(t, pages.ro + 1, 42L);
+        CHECK(::ptracewrap::read<long>(moved, pages.ro + 1) == 42L);
+        CHECK_THROWS_PTRACE_ERROR(::ptracewrap::read<long>(t, pages.unmapped));
+    }
+    return 0;
+}
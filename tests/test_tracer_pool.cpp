@@ -0,0 +1,229 @@
+// tracer_pool: events handled on the worker that seized the tracee, errors, seize_on from a worker and signal masks
+#include "test_common.hpp"
+
+#include <ptracewrap/tracer_pool.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Makes some syscalls, raises SIGUSR1 (Ignored) and exits with 7
+static ::pid_t fork_worker_child() {
+    ::pid_t pid = ::fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        ::signal(SIGUSR1, SIG_IGN);
+        ::usleep(100000);
+        for (int i = 0; i < 20; ++i) {
+            ::getppid();
+        }
+        ::raise(SIGUSR1);
+        ::_exit(7);
+    }
+    return pid;
+}
+
+template<class F>
+static bool wait_for(F&& done) {
+    ::std::chrono::steady_clock::time_point deadline = ::std::chrono::steady_clock::now() + ::std::chrono::seconds(10);
+    while (!done()) {
+        if (::std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        ::usleep(1000);
+    }
+    return true;
+}
+
+static void reap(const ::std::vector< ::pid_t>& children) {
+    for (::pid_t pid : children) {
+        int status;
+        ::waitpid(pid, &status, 0);
+    }
+}
+
+static void test_events() {
+    const int children = 6;
+    ::std::atomic<int> syscalls(0), signals(0), interrupts(0), exits(0);
+    ::std::mutex mutex;
+    ::std::unordered_map< ::pid_t, ::std::thread::id> owners;
+    ::std::atomic<bool> wrong_thread(false);
+
+    ::ptracewrap::tracer_pool pool(3, [&](::ptracewrap::tracer_worker& worker, const ::ptracewrap::stop_event& event) {
+        {
+            ::std::lock_guard< ::std::mutex> lock(mutex);
+            ::std::unordered_map< ::pid_t, ::std::thread::id>::iterator it = owners.find(event.pid);
+            if (it == owners.end()) {
+                owners[event.pid] = ::std::this_thread::get_id();
+            } else if (it->second != ::std::this_thread::get_id()) {
+                wrong_thread = true;
+            }
+        }
+        switch (event.kind) {
+        case ::ptracewrap::stop_event::syscall_stop:
+            ++syscalls;
+            return ::ptracewrap::resume_action(::ptracewrap::resume_action::syscall);
+        case ::ptracewrap::stop_event::signal_stop:
+            CHECK(event.signal == SIGUSR1);
+            ++signals;
+            // Suppress the signal
+            return ::ptracewrap::resume_action(::ptracewrap::resume_action::syscall, 0);
+        case ::ptracewrap::stop_event::event_stop: {
+            ++interrupts;
+            // The tracee's handle works on its worker
+            long value;
+            worker.get_tracee(event.pid).read_bytes(&value, &value, sizeof(value));
+            return ::ptracewrap::resume_action(::ptracewrap::resume_action::syscall);
+        }
+        case ::ptracewrap::stop_event::exited:
+            CHECK(event.exit_code == 7);
+            ++exits;
+            break;
+        default:
+            break;
+        }
+        return ::ptracewrap::resume_action();
+    });
+    CHECK(pool.get_worker_count() == 3);
+
+    ::std::vector< ::pid_t> pids;
+    for (int i = 0; i < children; ++i) {
+        pids.push_back(fork_worker_child());
+    }
+    ::std::vector< ::std::size_t> counts(pool.get_worker_count());
+    for (::pid_t pid : pids) {
+        ::std::size_t worker = pool.seize(pid, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+        ++counts[worker];
+        // Start syscall tracing with a PTRACE_INTERRUPT from the right worker
+        pool.post(worker, [pid](::ptracewrap::tracer_worker&) {
+            ::ptracewrap::ptrace_w_error(PTRACE_INTERRUPT, pid);
+        });
+    }
+    // Spread over the workers
+    for (::std::size_t count : counts) {
+        CHECK(count == children / 3);
+    }
+    CHECK(wait_for([&] { return exits == children; }));
+    CHECK(!wrong_thread);
+    CHECK(signals == children && interrupts == children && syscalls >= children * 40);
+    CHECK(pool.get_error() == nullptr);
+    for (::std::size_t i = 0; i < pool.get_worker_count(); ++i) {
+        CHECK(pool.get_worker(i).get_tracee_count() == 0);
+    }
+    CHECK_THROWS_PTRACE_ERROR(pool.seize(1));
+    pool.stop();
+    reap(pids);
+}
+
+static void test_errors() {
+    ::std::atomic<int> errors(0), exits(0);
+    ::pid_t thrown_for = 0;
+    ::ptracewrap::tracer_pool pool(1, [&](::ptracewrap::tracer_worker&, const ::ptracewrap::stop_event& event) {
+        if (event.kind == ::ptracewrap::stop_event::event_stop) {
+            thrown_for = event.pid;
+            throw ::std::runtime_error("from the callback");
+        }
+        if (event.kind == ::ptracewrap::stop_event::exited) {
+            ++exits;
+        }
+        return ::ptracewrap::resume_action();
+    }, [&](::ptracewrap::tracer_worker& worker, ::std::exception_ptr error) {
+        try {
+            ::std::rethrow_exception(error);
+        } catch (const ::std::runtime_error& e) {
+            if (::std::strcmp(e.what(), "from the callback") == 0) {
+                // The tracee was left stopped
+                worker.resume(thrown_for, ::ptracewrap::resume_action());
+            }
+        }
+        ++errors;
+    });
+
+    // Exceptions from tasks don't stop the worker
+    pool.post(0, [](::ptracewrap::tracer_worker&) { throw ::std::runtime_error("from a task"); });
+    CHECK(wait_for([&] { return errors == 1; }));
+
+    ::pid_t pid = fork_worker_child();
+    pool.seize(pid, PTRACE_O_EXITKILL);
+    pool.post(0, [pid](::ptracewrap::tracer_worker&) {
+        ::ptracewrap::ptrace_w_error(PTRACE_INTERRUPT, pid);
+    });
+    CHECK(wait_for([&] { return exits == 1; }));
+    CHECK(errors == 2);
+    CHECK(pool.get_error() == nullptr);
+    pool.stop();
+    reap({ pid });
+
+    // Without an error callback the first exception is kept
+    ::ptracewrap::tracer_pool quiet(1, [](::ptracewrap::tracer_worker&, const ::ptracewrap::stop_event&) {
+        return ::ptracewrap::resume_action();
+    });
+    quiet.post(0, [](::ptracewrap::tracer_worker&) { throw ::std::runtime_error("first"); });
+    quiet.post(0, [](::ptracewrap::tracer_worker&) { throw ::std::runtime_error("second"); });
+    CHECK(wait_for([&] { return quiet.get_error() != nullptr; }));
+    ::usleep(10000);
+    try {
+        ::std::rethrow_exception(quiet.get_error());
+    } catch (const ::std::runtime_error& e) {
+        CHECK(::std::strcmp(e.what(), "first") == 0);
+    }
+}
+
+static void test_seize_on_from_worker() {
+    ::std::atomic<int> exits(0);
+    ::ptracewrap::tracer_pool pool(2, [&](::ptracewrap::tracer_worker&, const ::ptracewrap::stop_event& event) {
+        if (event.kind == ::ptracewrap::stop_event::exited) {
+            ++exits;
+        }
+        return ::ptracewrap::resume_action();
+    });
+    ::pid_t pid = fork_worker_child();
+    ::std::atomic<bool> seized(false);
+    // Would wait forever for itself if it wasn't run inline
+    pool.post(1, [&](::ptracewrap::tracer_worker& worker) {
+        pool.seize_on(worker.get_index(), pid, PTRACE_O_EXITKILL);
+        seized = true;
+    });
+    CHECK(wait_for([&] { return seized.load(); }));
+    CHECK(pool.get_worker(1).get_tracee_count() == 1);
+    CHECK(wait_for([&] { return exits == 1; }));
+    CHECK(pool.get_error() == nullptr);
+    pool.stop();
+    reap({ pid });
+}
+
+static bool blocks_sigchld() {
+    ::sigset_t mask;
+    CHECK(::pthread_sigmask(SIG_BLOCK, nullptr, &mask) == 0);
+    return sigismember(&mask, SIGCHLD) == 1;
+}
+
+// Only the workers block SIGCHLD
+static void test_signal_mask() {
+    CHECK(!blocks_sigchld());
+    ::ptracewrap::tracer_pool pool(2, [](::ptracewrap::tracer_worker&, const ::ptracewrap::stop_event&) {
+        return ::ptracewrap::resume_action();
+    });
+    CHECK(!blocks_sigchld());
+    ::std::atomic<int> blocked(0);
+    for (::std::size_t i = 0; i < pool.get_worker_count(); ++i) {
+        pool.post(i, [&](::ptracewrap::tracer_worker&) {
+            if (blocks_sigchld()) {
+                ++blocked;
+            }
+        });
+    }
+    CHECK(wait_for([&] { return blocked == 2; }));
+}
+
+int main() {
+    test_signal_mask();
+    test_events();
+    test_errors();
+    test_seize_on_from_worker();
+    return 0;
+}
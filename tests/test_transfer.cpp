@@ -0,0 +1,108 @@
+// read_to / write through both transfer backends, including the fallback to PTRACE_PEEKDATA / PTRACE_POKEDATA
+#include "test_common.hpp"
+
+#include <vector>
+
+using ::ptracewrap::transfer_backend;
+
+int main() {
+    const ::std::size_t pg = ::test::page_size();
+    ::test::test_pages pages;
+    ::test::child c;
+    const ::pid_t pid = c.get_pid();
+
+    for (transfer_backend backend : { transfer_backend::peek_poke, transfer_backend::process_vm }) {
+        ::ptracewrap::set_default_transfer_backend(backend);
+        CHECK(::ptracewrap::get_default_transfer_backend() == backend);
+
+        // Partial words, word multiples and ranges over page boundaries
+        for (::std::size_t offset : { 0, 1, 3, 8, 4093 }) {
+            for (::std::size_t n : { 0, 1, 3, 7, 8, 9, 15, 4096, 5000, 9000 }) {
+                ::std::vector<char> buffer(n);
+                ::ptracewrap::read_to(pid, pages.rw + offset, buffer.data(), n);
+                CHECK(::std::memcmp(buffer.data(), pages.rw + offset, n) == 0);
+            }
+        }
+
+        // process_vm_readv can't read PROT_NONE pages, so these go through PTRACE_PEEKDATA
+        ::std::vector<char> buffer(2 * pg);
+        ::ptracewrap::read_to(pid, pages.ro, buffer.data(), buffer.size());
+        CHECK(::std::memcmp(buffer.data(), pages.ro, buffer.size()) == 0);
+        char none[100];
+        ::ptracewrap::read_to(pid, pages.none + 10, none);
+        for (int i = 0; i < 100; ++i) {
+            CHECK(none[i] == static_cast<char>(i + 19));
+        }
+
+        // A partial word at the end of the last page of a mapping mustn't read past it
+        char tail[3];
+        ::ptracewrap::read_to(pid, pages.none + pg - 3, tail);
+        CHECK(tail[0] == static_cast<char>(pg - 3 + 9) && tail[2] == static_cast<char>(pg - 1 + 9));
+
+        CHECK_THROWS_PTRACE_ERROR(::ptracewrap::read<long>(pid, pages.unmapped));
+        try {
+            ::ptracewrap::read<long>(pid, pages.unmapped);
+        } catch (const ::ptracewrap::ptrace_error& e) {
+            CHECK(e.get_request() == PTRACE_PEEKDATA);
+            CHECK(e.get_errno() == EIO || e.get_errno() == EFAULT);
+        }
+    }
+
+    for (transfer_backend backend : { transfer_backend::peek_poke, transfer_backend::process_vm }) {
+        ::ptracewrap::set_default_transfer_backend(backend);
+        char salt = backend == transfer_backend::peek_poke ? 0 : 1;
+
+        // Writes of partial words mustn't change the bytes around them
+        for (::std::size_t offset : { 0, 1, 5 }) {
+            for (::std::size_t n : { 1, 3, 8, 13, 4100 }) {
+                ::std::vector<char> data(n);
+                for (::std::size_t i = 0; i < n; ++i) {
+                    data[i] = static_cast<char>(i ^ 0x5a ^ salt);
+                }
+                char* at = pages.rw + pg + offset;
+                ::std::vector<char> before(n + 32);
+                ::ptracewrap::read_to(pid, at - 16, before.data(), before.size());
+                ::ptracewrap::write(pid, at, data.data(), n);
+                ::std::vector<char> after(n + 32);
+                ::ptracewrap::read_to(pid, at - 16, after.data(), after.size());
+                CHECK(::std::memcmp(after.data(), before.data(), 16) == 0);
+                CHECK(::std::memcmp(after.data() + 16, data.data(), n) == 0);
+                CHECK(::std::memcmp(after.data() + 16 + n, before.data() + 16 + n, 16) == 0);
+            }
+        }
+
+        // process_vm_writev can't write read-only pages, so this goes through PTRACE_POKEDATA
+        char patch[5] = { 1, 2, 3, 4, salt };
+        ::ptracewrap::write(pid, pages.ro + pg - 2, patch);
+        char check[5];
+        ::ptracewrap::read_to(pid, pages.ro + pg - 2, check);
+        CHECK(::std::memcmp(check, patch, sizeof(patch)) == 0);
+
+        struct point { int x; char y; };
+        ::ptracewrap::write(pid, pages.rw + 3, point{ 7, 'x' });
+        point p = ::ptracewrap::read<point>(pid, pages.rw + 3);
+        CHECK(p.x == 7 && p.y == 'x');
+
+        ::std::vector<short> shorts{ 1, 2, 3, 4, 5 };
+        ::ptracewrap::write(pid, pages.rw + 1, shorts.begin(), shorts.end());
+        short read_shorts[5];
+        ::ptracewrap::read_to(pid, pages.rw + 1, read_shorts, 5);
+        for (int i = 0; i < 5; ++i) {
+            CHECK(read_shorts[i] == i + 1);
+        }
+
+        // Elements that don't divide the copy buffer's size, so some are split between two chunks
+        struct triple { long a, b, c; };
+        ::std::vector<triple> triples(1000);
+        for (::std::size_t i = 0; i < triples.size(); ++i) {
+            triples[i] = triple{ static_cast<long>(i), static_cast<long>(i) * 2 + salt, -static_cast<long>(i) };
+        }
+        ::ptracewrap::write(pid, pages.rw + 4, triples.begin(), triples.end());
+        ::std::vector<triple> read_triples(triples.size());
+        ::ptracewrap::read_to(pid, pages.rw + 4, read_triples.data(), read_triples.size());
+        CHECK(::std::memcmp(read_triples.data(), triples.data(), triples.size() * sizeof(triple)) == 0);
+
+        CHECK_THROWS_PTRACE_ERROR(::ptracewrap::write(pid, pages.unmapped, 1L));
+    }
+    return 0;
+}